@@ -0,0 +1,181 @@
+#include "CopyQueue.h"
+#include "util.hpp"
+#include "madmax/copy.h"
+#include <filesystem>
+
+CopyQueue::CopyQueue()
+{
+
+}
+
+CopyQueue::~CopyQueue()
+{
+	this->stop();
+}
+
+CopyQueue& CopyQueue::getInstance() {
+	static CopyQueue instance;
+	return instance;
+}
+
+void CopyQueue::enqueue(std::wstring src,
+	std::wstring dst,
+	std::shared_ptr<Job> job,
+	std::shared_ptr<JobTaskItem> task,
+	FinishCallback onFinish)
+{
+	Request request;
+	request.src = src;
+	request.dst = dst;
+	request.job = job;
+	request.task = task;
+	request.onFinish = onFinish;
+
+	std::unique_lock<std::mutex> lock(this->mutex);
+	if (!this->isRunning) {
+		// shutting down, copy in the caller's thread
+		lock.unlock();
+		this->copy(request);
+		return;
+	}
+	this->queue.push_back(std::move(request));
+	if (this->copyThreads.size() < this->maxConcurrent &&
+		this->copyThreads.size() < this->numActive + this->queue.size()) {
+		this->copyThreads.push_back(std::thread(&CopyQueue::copyThreadProc, this));
+	}
+	this->signal.notify_all();
+}
+
+void CopyQueue::setMaxConcurrent(uint32_t count)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->maxConcurrent = count < 1 ? 1 : count;
+	while (this->copyThreads.size() < this->maxConcurrent &&
+		this->copyThreads.size() < this->numActive + this->queue.size()) {
+		this->copyThreads.push_back(std::thread(&CopyQueue::copyThreadProc, this));
+	}
+	this->signal.notify_all();
+}
+
+void CopyQueue::setBandwidthLimit(uint64_t bytesPerSec)
+{
+	std::lock_guard<std::mutex> lock(this->throttleMutex);
+	this->bandwidthLimit = bytesPerSec;
+}
+
+size_t CopyQueue::countPending()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->queue.size() + this->numActive;
+}
+
+void CopyQueue::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->signal.wait(lock, [this]() {
+		return this->queue.empty() && this->numActive == 0;
+	});
+}
+
+void CopyQueue::stop()
+{
+	std::vector<std::thread> threads;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->isRunning = false;
+		threads.swap(this->copyThreads);
+		this->signal.notify_all();
+	}
+	for (auto& thread : threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+}
+
+void CopyQueue::copyThreadProc()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (true) {
+		this->signal.wait(lock, [this]() {
+			return (!this->queue.empty() && this->numActive < this->maxConcurrent)
+				|| (!this->isRunning && this->queue.empty());
+		});
+		if (this->queue.empty()) {
+			break;
+		}
+		Request request = std::move(this->queue.front());
+		this->queue.pop_front();
+		this->numActive++;
+		lock.unlock();
+		this->copy(request);
+		lock.lock();
+		this->numActive--;
+		this->signal.notify_all();
+	}
+}
+
+void CopyQueue::copy(Request& request)
+{
+	const auto begin = std::chrono::steady_clock::now();
+	const std::wstring dstDir = std::filesystem::path(request.dst).parent_path().wstring();
+	if (request.task) {
+		std::error_code ec;
+		const auto fileSize = std::filesystem::file_size(request.src, ec);
+		request.task->totalWorkItem.set(ec ? 0 : fileSize);
+		request.task->completedWorkItem.set(0);
+		request.task->start();
+	}
+	JobManager::getInstance().log("Started copy to " + ws2s(request.dst), request.job);
+	bool success = true;
+	try {
+		mad::final_copy(request.src, request.dst, [this, &dstDir, &request](uint64_t numBytes) {
+			if (request.task) {
+				request.task->completedWorkItem.add(numBytes);
+			}
+			this->throttle(dstDir, numBytes);
+		});
+		if (!std::filesystem::exists(request.dst)) {
+			throw std::runtime_error("rename to destination failed");
+		}
+		const auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		JobManager::getInstance().log("Copy to " + ws2s(request.dst) + " finished, took " + std::to_string(time) + " sec", request.job);
+	}
+	catch (const std::exception& ex) {
+		success = false;
+		JobManager::getInstance().logErr("Copy to " + ws2s(request.dst) + " failed with: " + ex.what()
+			+ ", plot left at " + ws2s(request.src), request.job);
+	}
+	if (request.task) {
+		request.task->stop(success);
+	}
+	if (request.onFinish) {
+		try {
+			request.onFinish(success);
+		}
+		catch (...) {
+
+		}
+	}
+}
+
+void CopyQueue::throttle(const std::wstring& dstDir, uint64_t numBytes)
+{
+	std::chrono::steady_clock::time_point wakeTime;
+	{
+		std::lock_guard<std::mutex> lock(this->throttleMutex);
+		if (this->bandwidthLimit == 0) {
+			return;
+		}
+		// every chunk reserves its share of the directory's time line, so concurrent
+		// copies into the same directory add up to at most bandwidthLimit
+		const auto now = std::chrono::steady_clock::now();
+		auto& next = this->nextWriteTime[dstDir];
+		if (next < now) {
+			next = now;
+		}
+		next += std::chrono::microseconds(numBytes * 1000000 / this->bandwidthLimit);
+		wakeTime = next;
+	}
+	std::this_thread::sleep_until(wakeTime);
+}
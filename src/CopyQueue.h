@@ -0,0 +1,61 @@
+#ifndef _COPY_QUEUE_H_
+#define _COPY_QUEUE_H_
+#include "Job.hpp"
+#include <map>
+#include <deque>
+#include <condition_variable>
+
+// Process-wide service that moves finished plots to their destination in the background,
+// so a plot job can finish (and the next one start) while its file is still being copied.
+// Copies run on dedicated threads, at most maxConcurrent at a time, and the total rate
+// into one destination directory can be capped.
+class CopyQueue {
+public:
+	// called on the copy thread when the copy is done, success is false if it failed
+	typedef std::function<void(bool success)> FinishCallback;
+
+	CopyQueue();
+	~CopyQueue();
+	static CopyQueue& getInstance();
+
+	// src is removed once it has been moved to dst, task (optional) is started and stopped with the copy
+	void enqueue(std::wstring src,
+		std::wstring dst,
+		std::shared_ptr<Job> job,
+		std::shared_ptr<JobTaskItem> task = nullptr,
+		FinishCallback onFinish = nullptr);
+	void setMaxConcurrent(uint32_t count);
+	// bytes per second into each destination directory, 0 = unlimited
+	void setBandwidthLimit(uint64_t bytesPerSec);
+	size_t countPending();
+	// blocks until every queued copy has finished
+	void waitIdle();
+	// finishes the queued copies, then stops the copy threads
+	void stop();
+protected:
+	struct Request {
+		std::wstring src;
+		std::wstring dst;
+		std::shared_ptr<Job> job;
+		std::shared_ptr<JobTaskItem> task;
+		FinishCallback onFinish;
+	};
+	void copyThreadProc();
+	void copy(Request& request);
+	void throttle(const std::wstring& dstDir, uint64_t numBytes);
+
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::deque<Request> queue;
+	std::vector<std::thread> copyThreads;
+	uint32_t maxConcurrent {1};
+	uint32_t numActive {0};
+	bool isRunning {true};
+
+	std::mutex throttleMutex;
+	uint64_t bandwidthLimit {0};
+	// earliest time the next chunk may be written, per destination directory
+	std::map<std::wstring, std::chrono::steady_clock::time_point> nextWriteTime;
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "util.hpp"
 #include "Implot/implot.h"
 #include "JobRule.h"
+#include "madmax/CpuExecutor.h"
 
 std::vector<std::function<void()>> JobManager::registrations = std::vector<std::function<void()>>();
 
@@ -176,6 +177,16 @@ void JobManager::stop()
 	}
 }
 
+void JobManager::setCpuThreads(int count)
+{
+	mad::CpuExecutor::get_instance().set_num_slots(count);
+}
+
+int JobManager::getCpuThreads()
+{
+	return mad::CpuExecutor::get_instance().get_num_slots();
+}
+
 void JobManager::start()
 {
 	if (this->myProcess == NULL) {
@@ -643,9 +654,9 @@ float JobTaskItem::getProgress()
 	}
 	else {
 		float val = 0.0f;
-		uint32_t selfWorkItem = this->getTotalWorkItems();
+		uint64_t selfWorkItem = this->getTotalWorkItems();
 		if (selfWorkItem > 0) {
-			val = (float)this->getCompletedWorkItems() / (float)selfWorkItem;
+			val = (float)((double)this->getCompletedWorkItems() / (double)selfWorkItem);
 		}
 		if (val > 1.0f) {
 			val = 1.0f;
@@ -660,22 +671,22 @@ float JobTaskItem::getProgress()
 	}
 }
 
-uint32_t JobTaskItem::getTotalWorkItems()
+uint64_t JobTaskItem::getTotalWorkItems()
 {
-	uint32_t childTotal = 0;
+	uint64_t childTotal = 0;
 	for (auto child : this->tasks) {
 		childTotal += child->getTotalWorkItems();	
 	}
-	return childTotal + this->totalWorkItem;
+	return childTotal + this->totalWorkItem.get();
 }
 
-uint32_t JobTaskItem::getCompletedWorkItems()
+uint64_t JobTaskItem::getCompletedWorkItems()
 {
-	uint32_t childTotal = 0;
+	uint64_t childTotal = 0;
 	for (auto child : this->tasks) {
 		childTotal += child->getCompletedWorkItems();	
 	}
-	return childTotal + this->completedWorkItem;
+	return childTotal + this->completedWorkItem.get();
 }
 
 bool JobTaskItem::start()
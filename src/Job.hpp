@@ -6,6 +6,7 @@
 #include <memory>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #define NOMINMAX
 #include <windows.h> 
@@ -25,6 +26,40 @@ public:
 };
 
 
+// 64-bit work item counter, sharded over cache lines so that worker threads never
+// write to the same line. Threads accumulate locally and add() once per block,
+// get() sums the shards without locking. [thread-safe]
+class ProgressCounter {
+public:
+	void add(uint64_t count) {
+		this->shards[getShard()].value.fetch_add(count, std::memory_order_relaxed);
+	}
+	void set(uint64_t count) {
+		for (auto& shard : this->shards) {
+			shard.value.store(0, std::memory_order_relaxed);
+		}
+		this->shards[0].value.store(count, std::memory_order_relaxed);
+	}
+	uint64_t get() const {
+		uint64_t sum = 0;
+		for (const auto& shard : this->shards) {
+			sum += shard.value.load(std::memory_order_relaxed);
+		}
+		return sum;
+	}
+private:
+	static constexpr size_t numShards = 32;
+	struct alignas(64) shard_t {
+		std::atomic<uint64_t> value {0};
+	};
+	static size_t getShard() {
+		static std::atomic<size_t> nextShard {0};
+		thread_local const size_t shard = nextShard++ % numShards;
+		return shard;
+	}
+	shard_t shards[numShards];
+};
+
 class JobTaskItem : public std::enable_shared_from_this<JobTaskItem> {
 public:
 	JobTaskItem(std::string name);
@@ -32,16 +67,16 @@ public:
 	virtual void addChild(std::shared_ptr<JobTaskItem> task);
 	virtual void removeChild(std::shared_ptr<JobTaskItem> task);
 	virtual float getProgress();
-	virtual uint32_t getTotalWorkItems();
-	virtual uint32_t getCompletedWorkItems();
+	virtual uint64_t getTotalWorkItems();
+	virtual uint64_t getCompletedWorkItems();
 	virtual bool start();
 	virtual bool stop(bool finished = true);	
 	bool isRunning() const;
 	bool isFinished() const;
 	std::string name;
 	std::string status;
-	uint32_t completedWorkItem {0};
-	uint32_t totalWorkItem {0};
+	ProgressCounter completedWorkItem;
+	ProgressCounter totalWorkItem;
 	virtual bool drawStatusWidget();
 	std::chrono::time_point<std::chrono::system_clock> startTime;
 	std::chrono::time_point<std::chrono::system_clock> finishTime;
@@ -51,6 +86,35 @@ protected:
 	JobActivityState state;
 };
 
+// Counts completed work items of a task in a local variable and flushes them to
+// JobTaskItem::completedWorkItem every flushInterval items, in flush() and on destruction.
+// For loops that finish one item at a time.
+class ProgressUpdater {
+public:
+	ProgressUpdater(std::shared_ptr<JobTaskItem> task, uint64_t flushInterval = 65536)
+		: task(task), flushInterval(flushInterval) {}
+	~ProgressUpdater() {
+		this->flush();
+	}
+	ProgressUpdater(const ProgressUpdater&) = delete;
+	ProgressUpdater& operator=(const ProgressUpdater&) = delete;
+	void operator++() {
+		if (++this->pending >= this->flushInterval) {
+			this->flush();
+		}
+	}
+	void flush() {
+		if (this->pending && this->task) {
+			this->task->completedWorkItem.add(this->pending);
+		}
+		this->pending = 0;
+	}
+private:
+	std::shared_ptr<JobTaskItem> task;
+	uint64_t flushInterval;
+	uint64_t pending {0};
+};
+
 class JobActvity : public JobTaskItem{
 public:
 	JobActvity(std::string name, Job* owner);
@@ -157,6 +221,9 @@ public:
 	void logErr(std::string text, std::shared_ptr<Job> job = nullptr);
 	std::vector<std::string> getAvailableEventTypes();
 	std::vector<std::string> getAvailableEventEmitters();
+	// CPU-bound work of all running jobs shares this many threads, 0 = one per core
+	void setCpuThreads(int count);
+	int getCpuThreads();
 	static std::vector<std::function<void()>> registrations;
 protected:
 	std::recursive_mutex logMutex;
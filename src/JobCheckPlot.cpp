@@ -6,15 +6,55 @@
 #include "chiapos/verifier.hpp"
 #include "bits.hpp"
 #include <random>
+#include <winioctl.h>
 
 FactoryRegistration<JobCheckPlotFactory> JobCheckPlotFactoryRegistration;
 int JobCheckPlot::jobIdCounter = 1;
 
+// name of the physical drive a file is on, falls back to its volume (like for spanned volumes)
+static std::string getDriveName(const std::wstring& file)
+{
+	wchar_t volumePath[MAX_PATH];
+	if (!GetVolumePathNameW(file.c_str(), volumePath, MAX_PATH)) {
+		return ws2s(std::filesystem::path(file).root_name().wstring());
+	}
+	wchar_t volumeName[MAX_PATH];
+	if (GetVolumeNameForVolumeMountPointW(volumePath, volumeName, MAX_PATH)) {
+		// "\\?\Volume{GUID}\" without the trailing backslash opens the volume itself
+		std::wstring device(volumeName);
+		device.pop_back();
+		HANDLE volume = CreateFileW(device.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+		if (volume != INVALID_HANDLE_VALUE) {
+			VOLUME_DISK_EXTENTS extents;
+			DWORD size = 0;
+			const BOOL ok = DeviceIoControl(volume, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS,
+				NULL, 0, &extents, sizeof(extents), &size, NULL);
+			CloseHandle(volume);
+			if (ok && extents.NumberOfDiskExtents == 1) {
+				return "PhysicalDrive" + std::to_string(extents.Extents[0].DiskNumber);
+			}
+		}
+	}
+	return ws2s(volumePath);
+}
+
+double JobCheckPlotDrive::getBusySeconds() const
+{
+	double seconds = this->busySeconds;
+	if (this->numActive > 0) {
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - this->busySince).count();
+	}
+	return seconds;
+}
+
 JobCheckPlotParam::JobCheckPlotParam(const JobCheckPlotParam& rhs)
 {
 	this->paths = rhs.paths;
 	this->watchDirs = rhs.watchDirs;
 	this->iteration = rhs.iteration;
+	this->concurrentPlots = rhs.concurrentPlots;
+	this->plotsPerDrive = rhs.plotsPerDrive;
+	this->parkCacheSize = rhs.parkCacheSize;
 }
 
 JobCheckPlotParam::JobCheckPlotParam()
@@ -74,6 +114,45 @@ bool JobCheckPlotParam::drawEditor()
 	ImGui::Text("Randomize Challenge");
 	ImGui::SameLine();
 	ImGui::Checkbox("##Randomize", &this->randomizeChallenge);
+
+	ImGui::Text("Concurrent Plots");
+	ImGui::SameLine();
+	if (ImGui::InputInt("##concurrentPlots", &this->concurrentPlots, 1, 4)) {
+		if (this->concurrentPlots < 1) {
+			this->concurrentPlots = 1;
+		}
+	}
+	if (ImGui::IsItemHovered()) {
+		ImGui::BeginTooltip();
+		tooltiipText("number of plots checked at the same time, each has its file open while it is checked");
+		ImGui::EndTooltip();
+	}
+
+	ImGui::Text("Plots Per Drive");
+	ImGui::SameLine();
+	if (ImGui::InputInt("##plotsPerDrive", &this->plotsPerDrive, 1, 1)) {
+		if (this->plotsPerDrive < 1) {
+			this->plotsPerDrive = 1;
+		}
+	}
+	if (ImGui::IsItemHovered()) {
+		ImGui::BeginTooltip();
+		tooltiipText("at most this many of the concurrent plots are on the same physical drive");
+		ImGui::EndTooltip();
+	}
+
+	ImGui::Text("Park Cache");
+	ImGui::SameLine();
+	if (ImGui::InputInt("##parkCacheSize", &this->parkCacheSize, 16, 256)) {
+		if (this->parkCacheSize < 0) {
+			this->parkCacheSize = 0;
+		}
+	}
+	if (ImGui::IsItemHovered()) {
+		ImGui::BeginTooltip();
+		tooltiipText("decoded parks (32 KiB each) kept per plot being checked, 0 = disabled");
+		ImGui::EndTooltip();
+	}
 	ImGui::ScopedSeparator();
 
 	if (!this->paths.empty() || !this->watchDirs.empty()) {
@@ -373,7 +452,8 @@ bool JobCheckPlot::drawItemWidget()
 bool JobCheckPlot::drawStatusWidget()
 {
 	bool result = Job::drawStatusWidget();
-	if (!this->results.empty()) {
+	const std::vector<std::shared_ptr<JobCheckPlotResult>> results = this->getResults();
+	if (!results.empty()) {
 		ImGui::ScopedSeparator();
 		size_t successCount = 0;
 		size_t failedCount = 0;
@@ -383,12 +463,17 @@ bool JobCheckPlot::drawStatusWidget()
 		float avgQuality = 0.0f;
 		float maxQuality = 0.0f;
 		float minQuality = 2.5f;
-		for (const auto& r : this->results) {
-			if (r->iterProgress > 0) {
-				successCount += r->success.size();
-				failedCount += r->fails.size();
-				totalCount += r->success.size() + r->fails.size();				
-				float plotQuality = (float)r->success.size() / (float)(r->iter);
+		for (const auto& r : results) {
+			size_t iterProgress = 0;
+			size_t plotSuccess = 0;
+			size_t plotFails = 0;
+			uint64_t bytesRead = 0;
+			r->getProgress(iterProgress, plotSuccess, plotFails, bytesRead);
+			if (iterProgress > 0) {
+				successCount += plotSuccess;
+				failedCount += plotFails;
+				totalCount += plotSuccess + plotFails;
+				float plotQuality = (float)plotSuccess / (float)(r->iter);
 				sumQuality += plotQuality;
 				if (plotQuality > maxQuality) {
 					maxQuality = plotQuality;
@@ -407,20 +492,62 @@ bool JobCheckPlot::drawStatusWidget()
 		ImGui::Text("avg %.1f %%", avgQuality * 100.0f);
 		ImGui::SameLine();
 		ImGui::Text("max %.1f %%", maxQuality * 100.0f);
+		{
+			const std::lock_guard<std::mutex> lock(this->drivesMutex);
+			if (!this->drives.empty()) {
+				const auto now = std::chrono::steady_clock::now();
+				const auto end = this->checkEnd == std::chrono::steady_clock::time_point() ? now : this->checkEnd;
+				const double seconds = std::chrono::duration<double>(end - this->checkBegin).count();
+				uint64_t challenges = 0;
+				for (const auto& drive : this->drives) {
+					challenges += drive.second.challenges;
+				}
+				ImGui::Text("%.1f challenges/sec", seconds > 0 ? challenges / seconds : 0.0);
+				if (ImGui::CollapsingHeader("Drives")) {
+					ImGui::Indent(20.0f);
+					for (const auto& drive : this->drives) {
+						const double busySeconds = drive.second.getBusySeconds();
+						ImGui::Text("%s plots %d / %d, %.1f challenges/sec, %.1f MB/s",
+							drive.first.c_str(),
+							(int)drive.second.numChecked,
+							(int)drive.second.numPlots,
+							busySeconds > 0 ? drive.second.challenges / busySeconds : 0.0,
+							busySeconds > 0 ? drive.second.bytesRead / busySeconds / 1048576.0 : 0.0);
+					}
+					ImGui::Unindent(20.0f);
+				}
+			}
+		}
 		if (ImGui::CollapsingHeader("Detailed Results")) {
-			for (const auto& r : this->results) {
+			for (const auto& r : results) {
 				ImGui::PushID(r.get());
-				float plotQuality = (float)r->success.size() / (float)(r->iter);
-				ImGui::Text(r->id.c_str());
+				size_t iterProgress = 0;
+				size_t plotSuccess = 0;
+				size_t plotFails = 0;
+				uint64_t bytesRead = 0;
+				r->getProgress(iterProgress, plotSuccess, plotFails, bytesRead);
+				float plotQuality = (float)plotSuccess / (float)(r->iter);
+				std::string id;
+				int kSize = 0;
+				std::string error;
+				r->getInfo(id, kSize, error);
+				std::vector<std::shared_ptr<JobCheckPlotIterationResult>> success;
+				std::vector<std::shared_ptr<JobCheckPlotIterationResult>> fails;
+				r->getIterations(success, fails);
+				ImGui::Text(id.c_str());
 				ImGui::Indent(20.0f);
 				ImGui::Text("path %s", ws2s(r->filePath).c_str());
-				ImGui::Text("kSize %d", r->kSize);
-				ImGui::Text("iteration done %d / %d ,quality %.1f", r->iterProgress, r->iter, plotQuality*100.0f);
+				ImGui::Text("drive %s", r->drive.c_str());
+				if (!error.empty()) {
+					ImGui::Text("error %s", error.c_str());
+				}
+				ImGui::Text("kSize %d", kSize);
+				ImGui::Text("iteration done %d / %d ,quality %.1f", (int)iterProgress, (int)r->iter, plotQuality*100.0f);
 				ImGui::ProgressBar(plotQuality);
-				if (!r->fails.empty() && ImGui::CollapsingHeader((std::string("Failed ") + std::to_string(r->fails.size())).c_str())) {
+				if (!fails.empty() && ImGui::CollapsingHeader((std::string("Failed ") + std::to_string(fails.size())).c_str())) {
 					ImGui::Indent(20.0f);
-					if (ImGui::BeginChild((std::string("##failed") + r->id).c_str(), ImVec2(0, 180))){
-						for (const auto& iter : r->fails) {
+					if (ImGui::BeginChild((std::string("##failed") + id).c_str(), ImVec2(0, 180))){
+						for (const auto& iter : fails) {
 							ImGui::PushID(iter.get());
 							ImGui::BeginGroupPanel();
 							ImGui::TextWrapped("challenge %s", iter->challenge.c_str());
@@ -431,10 +558,10 @@ bool JobCheckPlot::drawStatusWidget()
 					ImGui::EndChild();
 					ImGui::Unindent();
 				}
-				if (!r->success.empty() && ImGui::CollapsingHeader((std::string("Success ") + std::to_string(r->success.size())).c_str())) {
+				if (!success.empty() && ImGui::CollapsingHeader((std::string("Success ") + std::to_string(success.size())).c_str())) {
 					ImGui::Indent(20.0f);
-					if (ImGui::BeginChild((std::string("##sucess") + r->id).c_str(), ImVec2(0, 180))){
-						for (const auto& iter : r->success) {
+					if (ImGui::BeginChild((std::string("##sucess") + id).c_str(), ImVec2(0, 180))){
+						for (const auto& iter : success) {
 							ImGui::PushID(iter.get());
 							ImGui::BeginGroupPanel();
 							ImGui::TextWrapped("challenge %s", iter->challenge.c_str());
@@ -471,6 +598,12 @@ bool JobCheckPlot::drawStatusWidget()
 	return result;
 }
 
+std::vector<std::shared_ptr<JobCheckPlotResult>> JobCheckPlot::getResults()
+{
+	const std::lock_guard<std::mutex> lock(this->resultsMutex);
+	return this->results;
+}
+
 bool JobCheckPlot::relaunchAfterFinish()
 {
 	return this->finishRule.relaunchAfterFinish();
@@ -499,7 +632,6 @@ void JobCheckPlot::initActivity()
 {
 	Job::initActivity();
 	if (this->activity) {
-		this->results.clear();
 		this->startEvent->trigger(this->shared_from_this());
 		std::vector<std::wstring> files;
 		for (auto f : this->param.paths) {
@@ -521,73 +653,204 @@ void JobCheckPlot::initActivity()
 				}
 			}
 		}
+		// the plots are listed before the checks start, so the UI never sees the list grow
+		std::random_device rd;
+		std::mt19937 mt(rd());
+		std::uniform_int_distribution<int> dist(0, 65535);
+		const int iteration = this->param.iteration;
+		size_t startIterNum = 0;
+		if (this->param.randomizeChallenge) {
+			startIterNum = dist(mt);
+		}
+		std::vector<std::shared_ptr<JobCheckPlotResult>> results;
+		for (auto f : files) {
+			auto plot = std::make_shared<JobCheckPlotResult>(f,iteration,getDriveName(f));
+			plot->startIterNum = startIterNum;
+			startIterNum += iteration;
+			results.push_back(plot);
+		}
+		{
+			const std::lock_guard<std::mutex> lock(this->resultsMutex);
+			this->results = results;
+		}
 		this->activity->mainRoutine = [=](JobActivityState*) {
-			std::random_device rd;
-			std::mt19937 mt(rd());
-			std::uniform_int_distribution<int> dist(0, 65535);
-
-			Verifier verifier;
-			this->activity->totalWorkItem = files.size()*this->param.iteration;
-			size_t startIterNum = 0;
-			if (this->param.randomizeChallenge) {
-				startIterNum = dist(mt);
+			// the parameters can be edited while the job runs, only read them once
+			const int concurrentPlots = std::max(this->param.concurrentPlots, 1);
+			const int plotsPerDrive = std::max(this->param.plotsPerDrive, 1);
+			DiskProverOptions options;
+			options.park_cache_size = std::max(this->param.parkCacheSize, 0);
+			this->activity->totalWorkItem.set(results.size()*iteration);
+
+			{
+				const std::lock_guard<std::mutex> lock(this->drivesMutex);
+				this->drives.clear();
+				this->checkBegin = std::chrono::steady_clock::now();
+				this->checkEnd = std::chrono::steady_clock::time_point();
+				for (const auto& plot : results) {
+					auto& drive = this->drives[plot->drive];
+					drive.pending.push_back(plot);
+					drive.numPlots++;
+				}
 			}
 
-			for (auto f : files) {
-				this->results.push_back(std::make_shared<JobCheckPlotResult>(f,this->param.iteration));
+			std::vector<std::thread> workers;
+			for (size_t i = 0; i < std::min<size_t>(concurrentPlots, files.size()); i++) {
+				workers.push_back(std::thread(&JobCheckPlot::checkWorker, this, plotsPerDrive, options));
 			}
-			for (auto f : this->results) {
-				f->iterProgress = 0;
-				for (size_t i = 0; i < f->iter; i++) {
-					size_t num = startIterNum + i;
-					f->iterProgress++;
-					std::shared_ptr<JobCheckPlotIterationResult> iterResult = std::make_shared<JobCheckPlotIterationResult>();
-
-					std::vector<unsigned char> hash_input = intToBytes(num, 4);
-					hash_input.insert(hash_input.end(), &f->id_bytes[0], &f->id_bytes[32]);
-
-					std::vector<unsigned char> hash(picosha2::k_digest_size);
-					picosha2::hash256(hash_input.begin(), hash_input.end(), hash.begin(), hash.end());
-
-					iterResult->challenge = HexStr(hash.data(), 256 / 8);
-
-					try {
-						std::vector<LargeBits> qualities = f->prover.GetQualitiesForChallenge(hash.data());
-
-						for (size_t i = 0; i < qualities.size(); i++) {
-							LargeBits proof = f->prover.GetFullProof(hash.data(), i);
-							uint8_t *proof_data = new uint8_t[proof.GetSize() / 8];
-							proof.ToBytes(proof_data);
-							JobManager::getInstance().log("i: " + std::to_string(num),this->shared_from_this());
-							JobManager::getInstance().log("challenge: 0x" + HexStr(hash.data(), 256 / 8),this->shared_from_this());	
-
-							LargeBits quality =
-								verifier.ValidateProof(f->id_bytes, f->kSize, hash.data(), proof_data,f->kSize * 8);
-							if (quality.GetSize() == 256 && quality == qualities[i]) {
-								JobManager::getInstance().log("proof: 0x" + HexStr(proof_data, f->kSize * 8),this->shared_from_this());
-								JobManager::getInstance().log("quality: " + quality.ToString(),this->shared_from_this());
-								JobManager::getInstance().log("Proof verification suceeded. k = " + std::to_string(static_cast<int>(f->kSize)),this->shared_from_this());
-								iterResult->proof = HexStr(proof_data, f->kSize * 8);
-								f->success.push_back(iterResult);
-							} else {
-								JobManager::getInstance().logErr("Proof verification failed.",this->shared_from_this());
-								f->fails.push_back(iterResult);
-							}
-							delete[] proof_data;
-						}
-					} catch (const std::exception& error) {
-						JobManager::getInstance().logErr("Proof verification failed." + std::string(error.what()),this->shared_from_this());
-						f->fails.push_back(iterResult);
-					}
-					this->activity->completedWorkItem++;
+			for (auto& worker : workers) {
+				worker.join();
+			}
+
+			uint64_t challenges = 0;
+			double seconds = 0;
+			{
+				const std::lock_guard<std::mutex> lock(this->drivesMutex);
+				this->checkEnd = std::chrono::steady_clock::now();
+				seconds = std::chrono::duration<double>(this->checkEnd - this->checkBegin).count();
+				for (const auto& drive : this->drives) {
+					challenges += drive.second.challenges;
 				}
-				startIterNum += f->iter;
 			}
+			JobManager::getInstance().log("Checked " + std::to_string(files.size()) + " plots, "
+				+ std::to_string(challenges) + " challenges in " + std::to_string(seconds) + " sec ("
+				+ std::to_string(seconds > 0 ? challenges / seconds : 0.0) + " challenges/sec)", this->shared_from_this());
 		};
 		this->finishEvent->trigger(this->shared_from_this());
 	}
 }
 
+void JobCheckPlot::checkWorker(int plotsPerDrive, DiskProverOptions options)
+{
+	Verifier verifier;
+	std::unique_lock<std::mutex> lock(this->drivesMutex);
+	while (this->activity->isRunning()) {
+		// the drive with the least active checks that has plots left and is below the limit
+		JobCheckPlotDrive* drive = nullptr;
+		bool pending = false;
+		for (auto& entry : this->drives) {
+			if (entry.second.pending.empty()) {
+				continue;
+			}
+			pending = true;
+			if (entry.second.numActive < plotsPerDrive && (!drive || entry.second.numActive < drive->numActive)) {
+				drive = &entry.second;
+			}
+		}
+		if (!pending) {
+			break;
+		}
+		if (!drive || this->activity->isPaused()) {
+			// with a timeout, pausing does not signal the workers
+			this->drivesSignal.wait_for(lock, std::chrono::seconds(1));
+			continue;
+		}
+		std::shared_ptr<JobCheckPlotResult> plot = drive->pending.front();
+		drive->pending.pop_front();
+		if (drive->numActive++ == 0) {
+			drive->busySince = std::chrono::steady_clock::now();
+		}
+		lock.unlock();
+
+		try {
+			this->checkPlot(plot, options, verifier);
+		}
+		catch (const std::exception& error) {
+			plot->close();
+			JobManager::getInstance().logErr("Checking " + ws2s(plot->filePath) + " failed: " + error.what(), this->shared_from_this());
+		}
+
+		lock.lock();
+		if (--drive->numActive == 0) {
+			drive->busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - drive->busySince).count();
+		}
+		size_t iterProgress = 0;
+		size_t successCount = 0;
+		size_t failedCount = 0;
+		uint64_t bytesRead = 0;
+		plot->getProgress(iterProgress, successCount, failedCount, bytesRead);
+		drive->numChecked++;
+		drive->challenges += iterProgress;
+		drive->bytesRead += bytesRead;
+		this->drivesSignal.notify_all();
+	}
+}
+
+void JobCheckPlot::checkPlot(std::shared_ptr<JobCheckPlotResult> f, const DiskProverOptions& options, Verifier& verifier)
+{
+	try {
+		f->open(options);
+	}
+	catch (const std::exception& error) {
+		f->setError(error.what());
+		JobManager::getInstance().logErr("Opening " + ws2s(f->filePath) + " failed: " + error.what(), this->shared_from_this());
+		this->activity->completedWorkItem.add(f->iter);
+		return;
+	}
+
+	f->setProgress(0);
+	// the challenges of a plot go to the prover as one batch, so their reads are sorted and merged
+	std::vector<std::vector<unsigned char>> hashes;
+	std::vector<const uint8_t*> challenges;
+	for (size_t i = 0; i < f->iter; i++) {
+		std::vector<unsigned char> hash_input = intToBytes(f->startIterNum + i, 4);
+		hash_input.insert(hash_input.end(), &f->id_bytes[0], &f->id_bytes[32]);
+
+		std::vector<unsigned char> hash(picosha2::k_digest_size);
+		picosha2::hash256(hash_input.begin(), hash_input.end(), hash.begin(), hash.end());
+		hashes.push_back(hash);
+	}
+	for (const auto& hash : hashes) {
+		challenges.push_back(hash.data());
+	}
+	std::vector<DiskProver::ChallengeResult> batch = f->prover->GetQualitiesForChallenges(challenges, true);
+
+	for (size_t i = 0; i < f->iter; i++) {
+		size_t num = f->startIterNum + i;
+		f->setProgress(i + 1);
+		std::shared_ptr<JobCheckPlotIterationResult> iterResult = std::make_shared<JobCheckPlotIterationResult>();
+		const std::vector<unsigned char>& hash = hashes[i];
+
+		iterResult->challenge = HexStr(hash.data(), 256 / 8);
+
+		const DiskProver::ChallengeResult& result = batch[i];
+
+		try {
+			if (result.error) {
+				std::rethrow_exception(result.error);
+			}
+			const std::vector<LargeBits>& qualities = result.qualities;
+
+			for (size_t i = 0; i < qualities.size(); i++) {
+				const LargeBits& proof = result.proofs[i];
+				uint8_t *proof_data = new uint8_t[proof.GetSize() / 8];
+				proof.ToBytes(proof_data);
+				JobManager::getInstance().log("i: " + std::to_string(num),this->shared_from_this());
+				JobManager::getInstance().log("challenge: 0x" + HexStr(hash.data(), 256 / 8),this->shared_from_this());	
+
+				LargeBits quality =
+					verifier.ValidateProof(f->id_bytes, f->kSize, hash.data(), proof_data,f->kSize * 8);
+				if (quality.GetSize() == 256 && quality == qualities[i]) {
+					JobManager::getInstance().log("proof: 0x" + HexStr(proof_data, f->kSize * 8),this->shared_from_this());
+					JobManager::getInstance().log("quality: " + quality.ToString(),this->shared_from_this());
+					JobManager::getInstance().log("Proof verification suceeded. k = " + std::to_string(static_cast<int>(f->kSize)),this->shared_from_this());
+					iterResult->proof = HexStr(proof_data, f->kSize * 8);
+					f->addSuccess(iterResult);
+				} else {
+					JobManager::getInstance().logErr("Proof verification failed.",this->shared_from_this());
+					f->addFail(iterResult);
+				}
+				delete[] proof_data;
+			}
+		} catch (const std::exception& error) {
+			JobManager::getInstance().logErr("Proof verification failed." + std::string(error.what()),this->shared_from_this());
+			f->addFail(iterResult);
+		}
+		this->activity->completedWorkItem.add(1);
+	}
+	f->setBytesRead(f->prover->GetBytesRead());
+	f->close();
+}
+
 std::string JobCheckPlotFactory::getName()
 {
 	return "Check Plot Files";
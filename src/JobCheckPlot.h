@@ -2,10 +2,15 @@
 #define _JOB_CHECK_PLOT_H_
 #include "Job.hpp"
 #include "JobRule.h"
+#include <map>
+#include <deque>
 #include <filesystem>
+#include <condition_variable>
 #include "ImFrame.h"
 #include "chiapos/prover_disk.hpp"
 
+class Verifier;
+
 class JobCheckPlotParam {
 public:
 	JobCheckPlotParam();
@@ -14,6 +19,12 @@ public:
 	std::vector<std::pair<std::wstring, bool>> watchDirs;
 	int iteration {50};
 	bool randomizeChallenge {true};
+	// plots checked at the same time, and at most plotsPerDrive of them on one physical drive
+	int concurrentPlots {4};
+	int plotsPerDrive {1};
+	// decoded parks cached per open plot, entries of a plot's challenges that fall into the same
+	// park of a table decode it once
+	int parkCacheSize {64};
 	bool drawEditor();
 	std::vector<ImFrame::Filter> pickPlotFileFilter;
 protected:
@@ -37,21 +48,93 @@ public:
 
 class JobCheckPlotResult {
 public:
-	JobCheckPlotResult(std::wstring file, size_t iter):
-		filePath(file), iter(iter), prover(file){
-		this->prover.GetId(this->id_bytes);
-		this->kSize = prover.GetSize();
+	JobCheckPlotResult(std::wstring file, size_t iter, std::string drive):
+		filePath(file), iter(iter), drive(drive){
+	}
+	// the prover is only open while the plot is being checked, so the number of open files
+	// stays at the number of concurrent checks
+	void open(const DiskProverOptions& options) {
+		this->prover = std::make_unique<DiskProver>(this->filePath, options);
+		this->prover->GetId(this->id_bytes);
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		this->kSize = prover->GetSize();
 		this->id = HexStr(id_bytes,32);
 	}
-	std::vector<std::shared_ptr<JobCheckPlotIterationResult>> success;
-	std::vector<std::shared_ptr<JobCheckPlotIterationResult>> fails;
+	void close() {
+		this->prover.reset();
+	}
+	void setError(const std::string& text) {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		this->error = text;
+	}
+	void setProgress(size_t iterProgress) {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		this->iterProgress = iterProgress;
+	}
+	void addSuccess(std::shared_ptr<JobCheckPlotIterationResult> iterResult) {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		this->success.push_back(iterResult);
+	}
+	void addFail(std::shared_ptr<JobCheckPlotIterationResult> iterResult) {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		this->fails.push_back(iterResult);
+	}
+	void setBytesRead(uint64_t bytesRead) {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		this->bytesRead = bytesRead;
+	}
+	// copies of the fields set by the checking thread, for the UI thread
+	void getInfo(std::string& id, int& kSize, std::string& error) const {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		id = this->id;
+		kSize = this->kSize;
+		error = this->error;
+	}
+	void getProgress(size_t& iterProgress, size_t& successCount, size_t& failedCount, uint64_t& bytesRead) const {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		iterProgress = this->iterProgress;
+		successCount = this->success.size();
+		failedCount = this->fails.size();
+		bytesRead = this->bytesRead;
+	}
+	// the iteration results themselves are not modified after being added
+	void getIterations(std::vector<std::shared_ptr<JobCheckPlotIterationResult>>& success,
+		std::vector<std::shared_ptr<JobCheckPlotIterationResult>>& fails) const {
+		const std::lock_guard<std::mutex> lock(this->mutex);
+		success = this->success;
+		fails = this->fails;
+	}
 	std::wstring filePath;
-	int kSize{32};
+	int kSize{32};			// written under mutex, the checking thread reads it without
 	size_t iter{50};
-	std::string id;
+	std::string id;			// written under mutex
 	uint8_t id_bytes[32];
-	DiskProver prover;
+	std::unique_ptr<DiskProver> prover;
+	size_t startIterNum {0};	// number of the first challenge
+	std::string drive;
+	std::string error;		// set under mutex if the plot could not be opened
+protected:
+	// written by the checking thread, read through getProgress() and getIterations()
+	std::vector<std::shared_ptr<JobCheckPlotIterationResult>> success;
+	std::vector<std::shared_ptr<JobCheckPlotIterationResult>> fails;
 	size_t iterProgress {0};
+	uint64_t bytesRead {0};
+	mutable std::mutex mutex;
+};
+
+// plots of one physical drive, and what has been checked on it so far
+class JobCheckPlotDrive {
+public:
+	std::deque<std::shared_ptr<JobCheckPlotResult>> pending;
+	size_t numPlots {0};
+	size_t numChecked {0};
+	int numActive {0};
+	uint64_t challenges {0};
+	uint64_t bytesRead {0};
+	// time with at least one plot of the drive being checked
+	double busySeconds {0};
+	std::chrono::steady_clock::time_point busySince;
+	double getBusySeconds() const;
 };
 
 class JobCheckPlot : public Job {
@@ -73,9 +156,22 @@ public:
 	bool drawStatusWidget() override;
 	bool relaunchAfterFinish() override;
 	std::shared_ptr<Job> relaunch() override;
-	std::vector<std::shared_ptr<JobCheckPlotResult>> results;
+	// copy of the plots of the current run [thread-safe]
+	std::vector<std::shared_ptr<JobCheckPlotResult>> getResults();
 protected:
+	// set by initActivity() before the checks start
+	std::vector<std::shared_ptr<JobCheckPlotResult>> results;
+	std::mutex resultsMutex;
 	void initActivity() override;
+	// checks plots of any drive that has less than plotsPerDrive active checks, until none are left
+	void checkWorker(int plotsPerDrive, DiskProverOptions options);
+	void checkPlot(std::shared_ptr<JobCheckPlotResult> f, const DiskProverOptions& options, Verifier& verifier);
+	// drives by name, the scheduling state of the workers and the per drive statistics
+	std::map<std::string, JobCheckPlotDrive> drives;
+	std::mutex drivesMutex;
+	std::condition_variable drivesSignal;
+	std::chrono::steady_clock::time_point checkBegin;
+	std::chrono::steady_clock::time_point checkEnd;
 	JobStartRule startRule;
 	JobFinishRule finishRule;
 	JobCheckPlotParam param;
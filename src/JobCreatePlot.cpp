@@ -77,12 +77,14 @@ void JobCreatePlot::init()
 	this->phase2FinishEvent = std::make_shared<JobEvent>("phase2-finish", this->getOriginalTitle());
 	this->phase3FinishEvent = std::make_shared<JobEvent>("phase3-finish", this->getOriginalTitle());
 	this->phase4FinishEvent = std::make_shared<JobEvent>("phase4-finish", this->getOriginalTitle());
+	this->copyFinishEvent = std::make_shared<JobEvent>("copy-finish", this->getOriginalTitle());
 	this->events.push_back(this->startEvent);
 	this->events.push_back(this->finishEvent);
 	this->events.push_back(this->phase1FinishEvent);
 	this->events.push_back(this->phase2FinishEvent);
 	this->events.push_back(this->phase3FinishEvent);
 	this->events.push_back(this->phase4FinishEvent);
+	this->events.push_back(this->copyFinishEvent);
 }
 
 
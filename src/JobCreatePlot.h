@@ -44,6 +44,7 @@ public:
 	std::shared_ptr<JobEvent> phase2FinishEvent;
 	std::shared_ptr<JobEvent> phase3FinishEvent;
 	std::shared_ptr<JobEvent> phase4FinishEvent;
+	std::shared_ptr<JobEvent> copyFinishEvent;
 
 protected:
 	void init();
@@ -9,6 +9,7 @@
 #include "Keygen.hpp"
 #include "util.hpp"
 #include "main.hpp"
+#include "CopyQueue.h"
 
 #include "madmax/phase1.hpp"
 #include "madmax/phase2.hpp"
@@ -35,6 +36,13 @@ void JobCreatePlotMaxParam::loadDefault()
 		this->threads = 2;
 	}
 	this->temp2Path = "";
+	this->tempDirectIO = false;
+	this->temp2DirectIO = false;
+	this->ramBudget = 0;
+	this->checkpoint = false;
+	this->resumeFile.clear();
+	this->affinity.clear();
+	this->cpuWeight = 1;
 }
 
 void JobCreatePlotMaxParam::loadPreset()
@@ -98,6 +106,19 @@ bool JobCreatePlotMaxParam::isValid(std::vector<std::string>& errs) const
 		}
 	}
 
+	if (!this->affinity.empty()) {
+		try {
+			int numParts = 0;
+			if (!mad::affinity_t::parse_auto(this->affinity, numParts)) {
+				mad::affinity_t::parse(this->affinity);
+			}
+		}
+		catch (const std::exception& ex) {
+			errs.push_back(ex.what());
+			result = false;
+		}
+	}
+
 	if (this->farmKey.empty()) {
 		errs.push_back("farm public key must be specified");
 		result = false;
@@ -540,6 +561,69 @@ bool JobCreatePlotMaxParam::drawEditor()
 			}
 			result |= true;
 		}
+		ImGui::PopItemWidth();
+
+		ImGui::Text("Unbuffered");
+		ImGui::SameLine(120.0f);
+		result |= ImGui::Checkbox("Temp##tempDirectIO", &this->tempDirectIO);
+		ImGui::SameLine();
+		result |= ImGui::Checkbox("Temp2##temp2DirectIO", &this->temp2DirectIO);
+
+		ImGui::Text("RAM (MB)");
+		ImGui::SameLine(120.0f);
+		ImGui::PushItemWidth(fieldWidth-130.0f);
+		if (ImGui::InputInt("##ramBudget", &this->ramBudget, 1024, 16384)) {
+			if (this->ramBudget < 0) {
+				this->ramBudget = 0;
+			}
+			result |= true;
+		}
+		if (ImGui::IsItemHovered()) {
+			ImGui::BeginTooltip();
+			ImGui::Text("keep temp2 buckets and phase 2 tables in memory up to this size, 0 = disabled");
+			ImGui::EndTooltip();
+		}
+		ImGui::PopItemWidth();
+
+		ImGui::Text("Affinity");
+		ImGui::SameLine(120.0f);
+		ImGui::PushItemWidth(fieldWidth-130.0f);
+		result |= ImGui::InputText("##affinity", &this->affinity);
+		if (ImGui::IsItemHovered()) {
+			ImGui::BeginTooltip();
+			ImGui::Text("cpus to pin the plotting threads to, empty = any,");
+			ImGui::Text("auto:N = one of N equal parts of the machine, for N auto jobs at once,");
+			ImGui::Text("auto = split the machine among the running auto jobs, node:N = NUMA node N,");
+			ImGui::Text("or a cpu list like 0-7,16-23");
+			ImGui::EndTooltip();
+		}
+		ImGui::PopItemWidth();
+
+		ImGui::Text("CPU weight");
+		ImGui::SameLine(120.0f);
+		ImGui::PushItemWidth(fieldWidth-130.0f);
+		if (ImGui::InputInt("##cpuWeight", &this->cpuWeight, 1, 4)) {
+			if (this->cpuWeight < 1) {
+				this->cpuWeight = 1;
+			}
+			result |= true;
+		}
+		if (ImGui::IsItemHovered()) {
+			ImGui::BeginTooltip();
+			ImGui::Text("share of the CPU threads this job gets while other jobs compete for them");
+			ImGui::EndTooltip();
+		}
+		ImGui::PopItemWidth();
+
+		ImGui::Text("Checkpoint");
+		ImGui::SameLine(120.0f);
+		result |= ImGui::Checkbox("##checkpoint", &this->checkpoint);
+		if (ImGui::IsItemHovered()) {
+			ImGui::BeginTooltip();
+			ImGui::Text("save a checkpoint after each phase so the job can be resumed,");
+			ImGui::Text("needs more temp space since each phase keeps its input files");
+			ImGui::EndTooltip();
+		}
 
 		ImGui::Unindent(20.0f);
 	}
@@ -608,24 +692,110 @@ std::shared_ptr<Job> JobCreatePlotMax::relaunch()
 	if (!finishParam.repeatIndefinite && finishParam.repeatCount <= 0) {
 		startParam.startPaused = true;
 	}
+	JobCreatePlotMaxParam newParam = this->param;
+	newParam.resumeFile.clear();
 	auto newJob = std::make_shared<JobCreatePlotMax>(
 		this->getOriginalTitle()+"#"+systemClockToStr(std::chrono::system_clock::now()),
 		this->getOriginalTitle(),
-		this->param, 
+		newParam, 
 		startParam,
 		finishParam
 	);
 	return newJob;
 }
 
+bool JobCreatePlotMax::loadCheckpoint(mad::checkpoint_t& checkpoint, std::vector<std::string>& err)
+{
+	try {
+		checkpoint.load(s2ws(param.resumeFile));
+	}
+	catch (const std::exception& ex) {
+		err.push_back(std::string("!! ") + ex.what());
+		return false;
+	}
+	const auto destFile = checkpoint.extra.find("dest_file");
+	if (destFile == checkpoint.extra.end()) {
+		err.push_back("!! checkpoint has no destination file");
+		return false;
+	}
+	param.destFile = destFile->second;
+	param.destPath = std::filesystem::path(param.destFile).parent_path().string();
+	param.plot_name = ws2s(checkpoint.params.plot_name);
+	param.filename = param.plot_name + ".plot";
+	param.plot_id = checkpoint.params.id;
+	param.id = hexStr(std::vector<uint8_t>(param.plot_id.begin(), param.plot_id.end()));
+	param.memo_data = checkpoint.params.memo;
+	param.tempPath = ws2s(checkpoint.params.tempDir);
+	param.temp2Path = ws2s(checkpoint.params.tempDir2);
+	param.threads = checkpoint.params.num_threads;
+	param.buckets = 1 << checkpoint.params.log_num_buckets;
+	param.tempDirectIO = checkpoint.params.direct_io;
+	param.temp2DirectIO = checkpoint.params.direct_io_2;
+	param.checkpoint = true;
+	err.push_back("resuming " + param.plot_name + " after phase " + std::to_string(checkpoint.phase));
+	return true;
+}
+
+// parts of the machine taken by running jobs with auto affinity
+static std::mutex autoAffinityMutex;
+static std::vector<bool> autoAffinitySlots;
+
+std::shared_ptr<const mad::affinity_t> JobCreatePlotMax::acquireAffinity(int& autoSlot)
+{
+	autoSlot = -1;
+	int numParts = 0;
+	if (!mad::affinity_t::parse_auto(param.affinity, numParts)) {
+		return std::make_shared<mad::affinity_t>(mad::affinity_t::parse(param.affinity));
+	}
+	// The partition is fixed for the lifetime of the job, so with staggered starts only a
+	// configured count (auto:N) gives an even split. Otherwise one part for each running auto
+	// job, finished and queued jobs do not count.
+	int numRunning = 0;
+	for (auto job : JobManager::getInstance().getActiveJobs()) {
+		std::shared_ptr<JobCreatePlotMax> plotJob = std::dynamic_pointer_cast<JobCreatePlotMax>(job);
+		int jobParts = 0;
+		if (plotJob && (plotJob.get() == this || (plotJob->isRunning() && !plotJob->isFinished()))
+			&& mad::affinity_t::parse_auto(plotJob->param.affinity, jobParts)) {
+			numRunning++;
+		}
+	}
+	numParts = std::max(numParts, numRunning);
+	const std::lock_guard<std::mutex> lock(autoAffinityMutex);
+	autoSlot = 0;
+	while (autoSlot < int(autoAffinitySlots.size()) && autoAffinitySlots[autoSlot]) {
+		autoSlot++;
+	}
+	if (autoSlot == int(autoAffinitySlots.size())) {
+		autoAffinitySlots.push_back(true);
+	}
+	autoAffinitySlots[autoSlot] = true;
+	numParts = std::max(numParts, autoSlot + 1);
+	return std::make_shared<mad::affinity_t>(mad::affinity_t::get_partition(autoSlot, numParts));
+}
+
+void JobCreatePlotMax::releaseAffinity(int autoSlot)
+{
+	if (autoSlot >= 0) {
+		const std::lock_guard<std::mutex> lock(autoAffinityMutex);
+		autoAffinitySlots[autoSlot] = false;
+	}
+}
+
 void JobCreatePlotMax::initActivity()
 {
 	JobCreatePlot::initActivity();
 	if (this->activity) {
 		this->activity->mainRoutine = [=](JobActivityState*) {
 			std::vector<std::string> err;
-			bool result = param.updateDerivedParams(err);
-			result &= param.isValid(err);
+			mad::checkpoint_t checkpoint;
+			bool result = true;
+			if (param.resumeFile.empty()) {
+				result &= param.updateDerivedParams(err);
+				result &= param.isValid(err);
+			}
+			else {
+				result &= loadCheckpoint(checkpoint, err);
+			}
 
 			for (auto msg : err) {
 				std::cout << msg << std::endl;
@@ -633,23 +803,77 @@ void JobCreatePlotMax::initActivity()
 
 			if (result) {
 				const auto total_begin = get_wall_time_micros();
+				const int resumePhase = checkpoint.phase;
 				mad::phase1::input_t params;
-				params.id = param.plot_id;
-				params.memo = param.memo_data;
-				params.plot_name = s2ws(param.plot_name);
-				params.log_num_buckets = int(log2(param.buckets));
-				params.tempDir = s2ws(param.tempPath);
-				params.tempDir2 = s2ws(param.temp2Path);
-				params.num_threads = param.threads;
+				if (resumePhase > 0) {
+					params = checkpoint.params;
+				}
+				else {
+					params.id = param.plot_id;
+					params.memo = param.memo_data;
+					params.plot_name = s2ws(param.plot_name);
+					params.log_num_buckets = int(log2(param.buckets));
+					params.tempDir = s2ws(param.tempPath);
+					params.tempDir2 = s2ws(param.temp2Path);
+					params.num_threads = param.threads;
+					params.direct_io = param.tempDirectIO;
+					params.direct_io_2 = param.temp2DirectIO;
+					params.checkpoint = param.checkpoint;
+					checkpoint.extra["dest_file"] = param.destFile;
+				}
+				if (param.ramBudget > 0) {
+					params.ram_budget = std::make_shared<mad::ram_budget_t>(uint64_t(param.ramBudget) << 20);
+				}
+				checkpoint.params.ram_budget = params.ram_budget;
+				const std::wstring checkpointFile = mad::checkpoint_t::get_file_name(params.tempDir, params.plot_name);
 
 				mad::DiskPlotterContext context;
 				context.job = this->shared_from_this();
 
+				// pin this thread before anything is allocated, the pipeline threads follow it
+				// and buffers are first touched on the job's own NUMA node
+				int autoSlot = -1;
+				std::shared_ptr<const mad::affinity_t> affinity;
+				try {
+					affinity = acquireAffinity(autoSlot);
+				}
+				catch (const std::exception& ex) {
+					context.logErr(std::string("ignored cpu affinity: ") + ex.what());
+				}
+				// compute pools of this job take their threads from the shared executor
+				mad::CpuExecutor::set_thread(mad::CpuExecutor::get_instance().create_share(param.cpuWeight));
+				if (affinity && !affinity->empty()) {
+					if (mad::affinity_t::set_thread(affinity)) {
+						context.log("cpu affinity "+affinity->to_string());
+					}
+					else {
+						context.logErr("failed to set cpu affinity "+affinity->to_string());
+					}
+				}
+
 				context.log("plotname   "+param.plot_name);
 				context.log("target dir "+param.destPath);
 				context.log("temp dir   "+param.tempPath);
 				context.log("temp2 dir  "+param.temp2Path);
 				context.log("threads    "+std::to_string(param.threads));
+				if (param.ramBudget > 0) {
+					context.log("ram budget "+std::to_string(param.ramBudget)+" MB");
+				}
+				if (resumePhase > 0) {
+					context.log("resuming after phase "+std::to_string(resumePhase));
+				}
+
+				// saves the checkpoint of a completed phase, then drops the previous phase's files
+				const auto saveCheckpoint = [&](const auto& out) {
+					if (params.checkpoint) {
+						checkpoint.set(out);
+						checkpoint.save(checkpointFile);
+						if (checkpoint.phase > 1) {
+							checkpoint.remove_files(checkpoint.phase - 1);
+						}
+						context.log("Saved checkpoint " + ws2s(checkpointFile));
+					}
+				};
 
 				if (context.job->activity) {
 					//std::shared_ptr<JobCreatePlot> plottingJob = std::dynamic_pointer_cast<JobCreatePlot>(context.job);
@@ -674,51 +898,94 @@ void JobCreatePlotMax::initActivity()
 
 						context.getCurrentTask()->start();
 						mad::phase1::output_t out_1;
-						mad::phase1::Phase1 p1(&context);
-						p1.compute(params, out_1);
+						if (resumePhase < 1) {
+							mad::phase1::Phase1 p1(&context);
+							p1.compute(params, out_1);
+							saveCheckpoint(out_1);
+							plottingJob->phase1FinishEvent->trigger(context.job);
+						}
+						else if (resumePhase == 1) {
+							checkpoint.get(out_1);
+						}
 						context.popTask();
-						plottingJob->phase1FinishEvent->trigger(context.job);
 
 						context.getCurrentTask()->start();
 						mad::phase2::output_t out_2;
-						mad::phase2::compute(context, out_1, out_2);	
+						if (resumePhase < 2) {
+							mad::phase2::compute(context, out_1, out_2);
+							saveCheckpoint(out_2);
+							plottingJob->phase2FinishEvent->trigger(context.job);
+						}
+						else if (resumePhase == 2) {
+							checkpoint.get(out_2);
+						}
 						context.popTask();
-						plottingJob->phase2FinishEvent->trigger(context.job);
 
 						context.getCurrentTask()->start();
 						mad::phase3::output_t out_3;
-						mad::phase3::compute(context, out_2, out_3);
+						if (resumePhase < 3) {
+							mad::phase3::compute(context, out_2, out_3);
+							saveCheckpoint(out_3);
+							plottingJob->phase3FinishEvent->trigger(context.job);
+						}
+						else if (resumePhase == 3) {
+							checkpoint.get(out_3);
+						}
 						context.popTask();
-						plottingJob->phase3FinishEvent->trigger(context.job);
 
 						context.getCurrentTask()->start();
 						mad::phase4::output_t out_4;
-						mad::phase4::compute(context, out_3, out_4);
+						if (resumePhase < 4) {
+							mad::phase4::compute(context, out_3, out_4);
+							saveCheckpoint(out_4);
+							plottingJob->phase4FinishEvent->trigger(context.job);
+						}
+						else {
+							checkpoint.get(out_4);
+						}
 						context.popTask();
-						plottingJob->phase4FinishEvent->trigger(context.job);
 
 						context.log("Total plot creation time was "
 							+ std::to_string((get_wall_time_micros() - total_begin) / 1e6) + " sec");
 
-						context.getCurrentTask()->start();
-						if(param.tempPath != param.destPath)
-						{
-							context.log("Started copy to " + param.destFile);
-							const auto total_begin = get_wall_time_micros();
-							std::filesystem::copy(out_4.plot_file_name, param.destFile);
-							_wremove(out_4.plot_file_name.c_str());
-							const auto time = (get_wall_time_micros() - total_begin) / 1e6;	
-							context.log("Move to " + param.destFile +" finished, took " + std::to_string(time) +" sec ");
+						if (params.checkpoint) {
+							_wremove(checkpointFile.c_str());
+						}
+						// the copy runs in the background, the job finishes right away
+						std::shared_ptr<JobTaskItem> copyTask = context.popTask(false);
+						if (param.tempPath != param.destPath) {
+							CopyQueue::getInstance().setMaxConcurrent(MainApp::settings.copyThreads);
+							CopyQueue::getInstance().setBandwidthLimit(uint64_t(MainApp::settings.copyBandwidth) << 20);
+							std::shared_ptr<Job> job = context.job;
+							CopyQueue::getInstance().enqueue(out_4.plot_file_name, s2ws(param.destFile), job, copyTask,
+								[plottingJob, job](bool success) {
+									if (success) {
+										plottingJob->copyFinishEvent->trigger(job);
+									}
+								}
+							);
+						}
+						else {
+							copyTask->start();
+							copyTask->stop();
+							plottingJob->copyFinishEvent->trigger(context.job);
 						}
-						context.popTask();
 						plottingJob->finishEvent->trigger(context.job);
 					}
+					catch (const std::exception& ex) {
+						context.logErr(std::string("plot failed with: ") + ex.what());
+						if (params.checkpoint && checkpoint.phase > 0) {
+							context.logErr("can be resumed from " + ws2s(checkpointFile));
+						}
+					}
 					catch (...) {
 
 					}
 					
 					//this->activity->waitUntilFinish();
 				}
+				releaseAffinity(autoSlot);
+				mad::CpuExecutor::set_thread(nullptr);
 			}
 		};
 	}
@@ -787,6 +1054,31 @@ bool JobCreatePlotMaxFactory::drawEditor()
 	}
 	ImGui::PopItemWidth();
 
+	ImGui::Text("Checkpoint");
+	ImGui::SameLine(90.0f);
+	ImGui::PushItemWidth(fieldWidth-160.0f);
+	ImGui::InputText("##resumeFile", &this->resumeFile);
+	if (ImGui::IsItemHovered()) {
+		ImGui::BeginTooltip();
+		ImGui::Text("<temp>/<plot name>.checkpoint of an interrupted job");
+		ImGui::EndTooltip();
+	}
+	ImGui::PopItemWidth();
+
+	ImGui::SameLine();
+	ImGui::PushItemWidth(50.0f);
+	if (ImGui::Button("Resume Job")) {
+		if (!this->resumeFile.empty()) {
+			JobCreatePlotMaxParam resumeParam = this->param;
+			resumeParam.resumeFile = this->resumeFile;
+			std::string jobName = "resumeplot-"+std::to_string(JobCreatePlot::jobIdCounter);
+			JobManager::getInstance().addJob(std::make_shared<JobCreatePlotMax>(jobName, jobName, resumeParam));
+			JobCreatePlot::jobIdCounter++;
+			this->resumeFile.clear();
+		}
+	}
+	ImGui::PopItemWidth();
+
 
 	return result;
 }
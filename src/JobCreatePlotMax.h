@@ -2,6 +2,8 @@
 #define CHIAGEN_JOB_CREATEPLOT_MAX_H
 #include "JobCreatePlot.h"
 #include "gui.hpp"
+#include "madmax/checkpoint.h"
+#include "madmax/affinity.h"
 #include <filesystem>
 
 class JobCreatePlotMaxParam {
@@ -18,6 +20,13 @@ public:
 	int threads {2};
 	int buckets {256};
 	int readChunkSize {65536};
+	bool tempDirectIO {false};
+	bool temp2DirectIO {false};
+	int ramBudget {0};			// MB of temp2 buckets / phase 2 tables to keep in RAM
+	bool checkpoint {false};	// save a checkpoint after each phase, keeps more temp files around
+	std::string resumeFile;		// checkpoint to resume from, empty = new plot
+	std::string affinity;		// cpus to run on: "" = any, "auto", "auto:N", "node:N" or a list like "0-7,16-23"
+	int cpuWeight {1};			// share of the CPU threads when jobs compete for them
 	void loadDefault();
 	void loadPreset();
 	bool isValid(std::vector<std::string>& errs) const;
@@ -49,6 +58,9 @@ public:
 	virtual std::shared_ptr<Job> relaunch() override;
 protected:
 	virtual void initActivity() override;
+	bool loadCheckpoint(mad::checkpoint_t& checkpoint, std::vector<std::string>& err);
+	std::shared_ptr<const mad::affinity_t> acquireAffinity(int& autoSlot);
+	static void releaseAffinity(int autoSlot);
 	JobCreatePlotMaxParam param;
 };
 
@@ -59,6 +71,7 @@ public:
 	bool drawEditor() override;
 protected:
 	JobCreatePlotMaxParam param;
+	std::string resumeFile;
 	JobStartRuleParam startRuleParam;
 	JobFinishRuleParam finishRuleParam;
 };
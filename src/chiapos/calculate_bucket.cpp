@@ -79,6 +79,16 @@ void F1Calculator::CalculateBuckets(uint64_t first_x, uint64_t n, uint64_t* res)
     assert(n <= (1U << kBatchSizes));
 
     chacha8_get_keystream(&this->enc_ctx_, start, num_blocks, buf_);
+    if (k_ == 32) {
+        // y values are word aligned, batched big-endian extraction
+        for (uint64_t i = 0; i < n; i++) {
+            uint32_t tmp;
+            memcpy(&tmp, buf_ + start_bit / 8 + i * 4, 4);
+            const uint64_t x = first_x + i;
+            res[i] = (uint64_t(bswap_32(tmp)) << kExtraBits) | (x >> x_shift);
+        }
+        return;
+    }
     for (uint64_t x = first_x; x < first_x + n; x++) {
         uint64_t y = SliceInt64FromBytes(buf_, start_bit, k_);
 
@@ -90,18 +100,12 @@ void F1Calculator::CalculateBuckets(uint64_t first_x, uint64_t n, uint64_t* res)
 
 F1Calculator::~F1Calculator() { delete[] buf_; }
 
- bool FxCalculator::initialized = false;
-uint16_t FxCalculator::L_targets[2][kBC][kExtraBitsPow];
+static_assert(kBC == BC_MATCH_KBC && kExtraBitsPow == BC_MATCH_NUM_TARGETS, "BC group mismatch");
+
 FxCalculator::FxCalculator(uint8_t k, uint8_t table_index)
 {
     this->k_ = k;
     this->table_index_ = table_index;
-
-    this->rmap.resize(kBC);
-    if (!FxCalculator::initialized) {
-        FxCalculator::initialized = true;
-        FxCalculator::load_tables();
-    }
 }
 
 std::pair<Bits, Bits> FxCalculator::CalculateBucket(const Bits& y1, const Bits& L, const Bits& R)
@@ -150,56 +154,15 @@ int32_t FxCalculator::FindMatches(
     const std::vector<PlotEntry>& bucket_L,
     const std::vector<PlotEntry>& bucket_R,
     uint16_t* idx_L,
-    uint16_t* idx_R)
+    uint16_t* idx_R,
+    size_t max_matches)
 {
-    int32_t idx_count = 0;
-    uint16_t parity = (bucket_L[0].y / kBC) % 2;
-
-    for (size_t yl : rmap_clean) {
-        this->rmap[yl].count = 0;
-    }
-    rmap_clean.clear();
-
-    uint64_t remove = (bucket_R[0].y / kBC) * kBC;
-    for (size_t pos_R = 0; pos_R < bucket_R.size(); pos_R++) {
-        uint64_t r_y = bucket_R[pos_R].y - remove;
-
-        if (!rmap[r_y].count) {
-            rmap[r_y].pos = pos_R;
-        }
-        rmap[r_y].count++;
-        rmap_clean.push_back(r_y);
-    }
-
-    const uint64_t remove_y = remove - kBC;
-    for (size_t pos_L = 0; pos_L < bucket_L.size(); pos_L++) {
-        const uint64_t r = bucket_L[pos_L].y - remove_y;
-        for (uint8_t i = 0; i < kExtraBitsPow; i++) {
-            const uint16_t r_target = L_targets[parity][r][i];
-            if (idx_L != nullptr) {
-                for (size_t j = 0; j < rmap[r_target].count; j++) {
-                    idx_L[idx_count] = pos_L;
-                    idx_R[idx_count] = rmap[r_target].pos + j;
-                    idx_count++;
-                }
-            } else {
-                idx_count += rmap[r_target].count;
-            }
-        }
-    }
-    return idx_count;
-}
-
-void FxCalculator::load_tables()
-{
-    for (uint8_t parity = 0; parity < 2; parity++) {
-        for (uint16_t i = 0; i < kBC; i++) {
-            uint16_t indJ = i / kC;
-            for (uint16_t m = 0; m < kExtraBitsPow; m++) {
-                uint16_t yr =
-                    ((indJ + m) % kB) * kC + (((2 * m + parity) * (2 * m + parity) + i) % kC);
-                FxCalculator::L_targets[parity][i][m] = yr;
-            }
-        }
-    }
+    return matcher_.find_matches(
+        bucket_L.data(),
+        bucket_L.size(),
+        bucket_R.data(),
+        bucket_R.size(),
+        idx_L,
+        idx_R,
+        max_matches);
 }
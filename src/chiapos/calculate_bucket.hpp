@@ -26,6 +26,7 @@
 #include <vector>
 
 #include "b3/blake3.h"
+#include "bc_matcher.hpp"
 #include "bits.hpp"
 #include "chacha8.h"
 #include "pos_constants.hpp"
@@ -87,11 +88,6 @@ private:
     uint8_t *buf_{};
 };
 
-struct rmap_item {
-    uint16_t count : 4;
-    uint16_t pos : 12;
-};
-
 // Class to evaluate F2 .. F7.
 class FxCalculator {
 public:
@@ -114,25 +110,20 @@ public:
     //   (yr % kBC) / kC - (yl % kBC) / kC = m   (mod kB)  AND
     //   (yr % kBC) % kC - (yl % kBC) % kC = (2m + (yl/kBC) % 2)^2   (mod kC)
     //
-    // Instead of doing the naive algorithm, which is an O(kExtraBitsPow * N^2) comparisons on
-    // bucket length, we can store all the R values and lookup each of our 32 candidates to see if
-    // any R value matches. This function can be further optimized by removing the inner loop, and
-    // being more careful with memory allocation.
+    // The R values are stored in a map indexed by yr % kBC, the 64 candidates of each
+    // L value are then looked up with SIMD gathers (see BCMatcher).
+    // At most max_matches pairs are written, with idx_L == nullptr they are only counted.
     int32_t FindMatches(
         const std::vector<PlotEntry>& bucket_L,
         const std::vector<PlotEntry>& bucket_R,
         uint16_t *idx_L,
-        uint16_t *idx_R);
+        uint16_t *idx_R,
+        size_t max_matches = kBC);
 
 private:
     uint8_t k_{};
     uint8_t table_index_{};
-    std::vector<struct rmap_item> rmap;
-    std::vector<size_t> rmap_clean;
-
-	static void load_tables();
-	static uint16_t L_targets[2][kBC][kExtraBitsPow];
-	static bool initialized;
+    BCMatcher matcher_;
 };
 
 #endif  // SRC_CPP_CALCULATE_BUCKET_HPP_
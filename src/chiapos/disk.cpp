@@ -305,10 +305,9 @@ FilteredDisk::FilteredDisk(BufferedDisk underlying, bitfield filter, int entry_s
     : filter_(std::move(filter)), underlying_(std::move(underlying)), entry_size_(entry_size)
 {
     assert(entry_size_ > 0);
-    while (!filter_.get(last_idx_)) {
-        last_physical_ += entry_size_;
-        ++last_idx_;
-    }
+    index_.reset(new bitfield_index(filter_));
+    last_idx_ = index_->find_next(0);
+    last_physical_ = last_idx_ * entry_size_;
     assert(filter_.get(last_idx_));
     assert(last_physical_ == last_idx_ * entry_size_);
 }
@@ -322,25 +321,16 @@ uint8_t const* FilteredDisk::Read(uint64_t begin, uint64_t length)
     assert(last_physical_ == last_idx_ * entry_size_);
 
     if (begin > last_logical_) {
-        // last_idx_ et.al. always points to an entry we have (i.e. the bit
-        // is set). So when we advance from there, we always take at least
-        // one step on all counters.
-        last_logical_ += entry_size_;
-        last_physical_ += entry_size_;
-        ++last_idx_;
-
-        while (begin > last_logical_) {
-            if (filter_.get(last_idx_)) {
-                last_logical_ += entry_size_;
-            }
-            last_physical_ += entry_size_;
-            ++last_idx_;
-        }
-
-        while (!filter_.get(last_idx_)) {
-            last_physical_ += entry_size_;
-            ++last_idx_;
+        // last_idx_ always points to an entry we have (i.e. the bit is set).
+        // Stepping to the next entry is a short scan, larger jumps go
+        // through select() on the index.
+        if (begin - last_logical_ == uint64_t(entry_size_)) {
+            last_idx_ = index_->find_next(last_idx_ + 1);
+        } else {
+            last_idx_ = index_->select(begin / entry_size_);
         }
+        last_logical_ = begin;
+        last_physical_ = last_idx_ * entry_size_;
     }
 
     assert(filter_.get(last_idx_));
@@ -358,12 +348,15 @@ void FilteredDisk::Write(uint64_t begin, const uint8_t* memcache, uint64_t lengt
 void FilteredDisk::Truncate(uint64_t new_size)
 {
     underlying_.Truncate(new_size);
-    if (new_size == 0)
+    if (new_size == 0) {
+        index_.reset();
         filter_.free_memory();
+    }
 }
 
 void FilteredDisk::FreeMemory()
 {
+    index_.reset();
     filter_.free_memory();
     underlying_.FreeMemory();
 }
@@ -33,6 +33,7 @@ using namespace std::chrono_literals; // for operator""min;
 #include "bits.hpp"
 #include "util.hpp"
 #include "bitfield.hpp"
+#include "bitfield_index.hpp"
 #include "thread_pool.hpp"
 
 namespace fs = std::filesystem;
@@ -130,6 +131,8 @@ public:
 private:
     // only entries whose bit is set should be read
     bitfield filter_;
+    // maps logical entry indices to physical ones
+    std::unique_ptr<bitfield_index> index_;
     BufferedDisk underlying_;
     int entry_size_;
 
@@ -1,6 +1,7 @@
 #include "phases.hpp"
 #include "encoding.hpp"
 #include "bitfield_index.hpp"
+#include "bit_stream.hpp"
 
 PlotEntry GetLeftEntry(
 	uint8_t const table_index,
@@ -85,7 +86,7 @@ void* F1thread(DiskPlotterContext* context, int const index, uint8_t const k, co
 		for (uint32_t i = 0; i < right_writer_count; i++) {
 			context->globals.L_sort_manager->AddToCache(&(right_writer_buf[i * entry_size_bytes]));
 		}
-		context->getCurrentTask()->completedWorkItem++;
+		context->getCurrentTask()->completedWorkItem.add(1);
 	}
 
 	return 0;
@@ -114,14 +115,12 @@ void WriteParkToFile(
 	IntTo16Bytes(index, first_line_point);
 	index += EntrySizes::CalculateLinePointSize(k);
 
-	// We use ParkBits instead of Bits since it allows storing more data
-	ParkBits park_stubs_bits;
+	uint32_t stubs_size = EntrySizes::CalculateStubsSize(k);
+	bit_writer park_stubs_bits(index, stubs_size);
 	for (uint64_t stub : park_stubs) {
-		park_stubs_bits.AppendValue(stub, (k - kStubMinusBits));
+		park_stubs_bits.write(stub, k - kStubMinusBits);
 	}
-	uint32_t stubs_size = EntrySizes::CalculateStubsSize(k);
-	uint32_t stubs_valid_size = cdiv(park_stubs_bits.GetSize(), 8);
-	park_stubs_bits.ToBytes(index);
+	size_t stubs_valid_size = park_stubs_bits.flush();
 	memset(index + stubs_valid_size, 0, stubs_size - stubs_valid_size);
 	index += stubs_size;
 
@@ -129,7 +128,8 @@ void WriteParkToFile(
 	// be small, so we can compress them
 	double R = kRValues[table_index - 1];
 	uint8_t* deltas_start = index + 2;
-	size_t deltas_size = Encoding::ANSEncodeDeltas(tmCache, park_deltas, R, deltas_start);
+	size_t deltas_size = Encoding::ANSEncodeDeltas(tmCache, park_deltas, R, deltas_start,
+												   park_buffer_size - (deltas_start - park_buffer));
 
 	if (!deltas_size) {
 		// Uncompressed
@@ -191,7 +191,7 @@ void* phase1_thread(DiskPlotterContext* context,THREADDATA* ptd)
 	// will already be sorted by y
 	uint64_t totalstripes = (prevtableentries + context->globals.stripe_size - 1) / context->globals.stripe_size;
 	uint64_t threadstripes = (totalstripes + context->globals.num_threads - 1) / context->globals.num_threads;
-	context->getCurrentTask()->totalWorkItem += threadstripes;
+	context->getCurrentTask()->totalWorkItem.add(threadstripes);
 	for (uint64_t stripe = 0; stripe < threadstripes; stripe++) {
 		uint64_t pos = (stripe * context->globals.num_threads + ptd->index) * context->globals.stripe_size;
 		uint64_t const endpos = pos + context->globals.stripe_size + 1;  // one y value overlap
@@ -314,7 +314,7 @@ void* phase1_thread(DiskPlotterContext* context,THREADDATA* ptd)
 
 					if (!bucket_R.empty()) {
 						// Compute all matches between the two buckets and save indeces.
-						idx_count = f.FindMatches(bucket_L, bucket_R, idx_L, idx_R);
+						idx_count = f.FindMatches(bucket_L, bucket_R, idx_L, idx_R, 10000);
 						if (idx_count >= 10000) {
 							std::cout << "sanity check: idx_count exceeded 10000!" << std::endl;
 							exit(0);
@@ -569,7 +569,7 @@ void* phase1_thread(DiskPlotterContext* context,THREADDATA* ptd)
 
 		context->globals.matches += matches;
 		Sem::Post(ptd->mine);
-		context->getCurrentTask()->completedWorkItem++;
+		context->getCurrentTask()->completedWorkItem.add(1);
 	}
 
 	return 0;
@@ -625,7 +625,7 @@ std::vector<uint64_t> RunPhase1(
 	std::mutex sort_manager_mutex;
 
 	{
-		context->getCurrentTask()->totalWorkItem += (((uint64_t)1) << (k - kBatchSizes));
+		context->getCurrentTask()->totalWorkItem.add((((uint64_t)1) << (k - kBatchSizes)));
 		// Start of parallel execution
 		std::vector<std::thread> threads;
 		for (int i = 0; i < num_threads; i++) {
@@ -845,7 +845,7 @@ Phase2Results RunPhase2(
 
 		int64_t const table_size = table_sizes[table_index];
 		int16_t const entry_size = cdiv(k + kOffsetSize + (table_index == 7 ? k : 0), 8);
-		context->getCurrentTask()->totalWorkItem += table_size*2;
+		context->getCurrentTask()->totalWorkItem.add(table_size*2);
 		BufferedDisk disk(&tmp_1_disks[table_index], table_size * entry_size);
 
 		// read_index is the number of entries we've processed so far (in the
@@ -853,6 +853,7 @@ Phase2Results RunPhase2(
 		// for table 7
 
 		int64_t read_cursor = 0;
+		ProgressUpdater progress(context->getCurrentTask());
 		for (int64_t read_index = 0; read_index < table_size;
 			 ++read_index, read_cursor += entry_size) {
 			uint8_t const* entry = disk.Read(read_cursor, entry_size);
@@ -875,8 +876,9 @@ Phase2Results RunPhase2(
 			// mark the two matching entries as used (pos and pos+offset)
 			next_bitfield.set(entry_pos);
 			next_bitfield.set(entry_pos + entry_offset);
-			context->getCurrentTask()->completedWorkItem++;
+			++progress;
 		}
+		progress.flush();
 
 		std::cout << "scanned table " << table_index << std::endl;
 		scan_timer.PrintElapsed("scanned time = ");
@@ -963,8 +965,9 @@ Phase2Results RunPhase2(
 				sort_manager->AddToCache(bytes);
 			}
 			++write_counter;
-			context->getCurrentTask()->completedWorkItem++;
+			++progress;
 		}
+		progress.flush();
 
 		if (table_index != 7) {
 			sort_manager->FlushCache();
@@ -1159,8 +1162,9 @@ Phase3Results RunPhase3(
 		uint64_t cached_entry_pos = 0;
 		uint64_t cached_entry_offset = 0;
 
-		context->getCurrentTask()->totalWorkItem += 2*(kReadMinusWrite + end_of_table_pos);
+		context->getCurrentTask()->totalWorkItem.add(2*(kReadMinusWrite + end_of_table_pos));
 		// Similar algorithm as Backprop, to read both L and R tables simultaneously
+		ProgressUpdater pass_1_progress(context->getCurrentTask());
 		while (!end_of_right_table || (current_pos - end_of_table_pos <= kReadMinusWrite)) {
 			old_counters[current_pos % kReadMinusWrite] = 0;
 
@@ -1280,8 +1284,9 @@ Phase3Results RunPhase3(
 				}
 			}
 			current_pos += 1;
-			context->getCurrentTask()->completedWorkItem++;
+			++pass_1_progress;
 		}
+		pass_1_progress.flush();
 		computation_pass_1_timer.PrintElapsed("\tFirst computation pass time:");
 		context->popTask();
 		context->getCurrentTask()->start();
@@ -1345,6 +1350,7 @@ Phase3Results RunPhase3(
 		uint8_t const sort_key_shift = 128 - right_sort_key_size;
 		uint8_t const index_shift = sort_key_shift - (k + (table_index == 6 ? 1 : 0));
 		
+		ProgressUpdater pass_2_progress(context->getCurrentTask());
 		for (uint64_t index = 0; index < total_r_entries; index++) {
 			right_reader_entry_buf = R_sort_manager->ReadEntry(right_reader);
 			right_reader += right_entry_size_bytes;
@@ -1408,8 +1414,9 @@ Phase3Results RunPhase3(
 				park_stubs.push_back(stub);
 			}
 			last_line_point = line_point;
-			context->getCurrentTask()->completedWorkItem++;
+			++pass_2_progress;
 		}
+		pass_2_progress.flush();
 		R_sort_manager.reset();
 		L_sort_manager->FlushCache();
 
@@ -1524,7 +1531,8 @@ void RunPhase4(
 
 	// We read each table7 entry, which is sorted by f7, but we don't need f7 anymore. Instead,
 	// we will just store pos6, and the deltas in table C3, and checkpoints in tables C1 and C2.
-	context->getCurrentTask()->totalWorkItem += res.final_entries_written;
+	context->getCurrentTask()->totalWorkItem.add(res.final_entries_written);
+	ProgressUpdater progress(context->getCurrentTask());
 	for (uint64_t f7_position = 0; f7_position < res.final_entries_written; f7_position++) {
 		right_entry_buf = res.table7_sm->ReadEntry(plot_file_reader);
 
@@ -1575,8 +1583,9 @@ void RunPhase4(
 		//if (flags & SHOW_PROGRESS && f7_position % progress_update_increment == 0) {
 		//	progress(4, f7_position, res.final_entries_written);
 		//}
-		context->getCurrentTask()->completedWorkItem++;
+		++progress;
 	}
+	progress.flush();
 	Encoding::ANSFree(kC3R);
 	res.table7_sm.reset();
 
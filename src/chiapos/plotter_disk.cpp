@@ -389,6 +389,7 @@ void DiskPlotter::CreatePlotDisk(
         }
     } while (!bRenamed);
 	context.popTask();
+	plottingJob->copyFinishEvent->trigger(context.job);
 	plottingJob->finishEvent->trigger(context.job);
 }
 
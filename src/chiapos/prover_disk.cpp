@@ -1,79 +1,135 @@
 #include "prover_disk.hpp"
+#include "bit_stream.hpp"
 
-DiskProver::DiskProver(const std::wstring& filename)
+#include <cerrno>
+
+DiskProver::DiskProver(const std::wstring& filename, const DiskProverOptions& options)
+    : park_cache(options.park_cache_size)
 {
     struct plot_header header {
     };
     this->filename = filename;
 
-    std::ifstream disk_file(filename, std::ios::in | std::ios::binary);
-
-    if (!disk_file.is_open()) {
+#ifdef _WIN32
+    // Overlapped so that concurrent reads with explicit offsets are not serialized
+    file_handle = CreateFileW(
+        filename.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_RANDOM_ACCESS,
+        NULL);
+    LARGE_INTEGER size_info;
+    if (file_handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_handle, &size_info)) {
+        Close();
         throw std::invalid_argument("Invalid file ");
     }
-    // 19 bytes  - "Proof of Space Plot" (utf-8)
-    // 32 bytes  - unique plot id
-    // 1 byte    - k
-    // 2 bytes   - format description length
-    // x bytes   - format description
-    // 2 bytes   - memo length
-    // x bytes   - memo
-
-    SafeRead(disk_file, (uint8_t*)&header, sizeof(header));
-    if (memcmp(header.magic, "Proof of Space Plot", sizeof(header.magic)) != 0)
-        throw std::invalid_argument("Invalid plot header magic");
-
-    uint16_t fmt_desc_len = TwoBytesToInt(header.fmt_desc_len);
-
-    if (fmt_desc_len == kFormatDescription.size() &&
-        !memcmp(header.fmt_desc, kFormatDescription.c_str(), fmt_desc_len)) {
-        // OK
-    } else {
-        throw std::invalid_argument("Invalid plot file format");
+    file_size = size_info.QuadPart;
+#else
+    file_fd = open(ws2s(filename).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat stat_info;
+    if (file_fd < 0 || fstat(file_fd, &stat_info) != 0) {
+        Close();
+        throw std::invalid_argument("Invalid file ");
     }
+    file_size = stat_info.st_size;
+#ifdef POSIX_FADV_RANDOM
+    posix_fadvise(file_fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+#endif
+
+    try {
+        // 19 bytes  - "Proof of Space Plot" (utf-8)
+        // 32 bytes  - unique plot id
+        // 1 byte    - k
+        // 2 bytes   - format description length
+        // x bytes   - format description
+        // 2 bytes   - memo length
+        // x bytes   - memo
+
+        SafeRead(0, (uint8_t*)&header, sizeof(header));
+        if (memcmp(header.magic, "Proof of Space Plot", sizeof(header.magic)) != 0)
+            throw std::invalid_argument("Invalid plot header magic");
+
+        uint16_t fmt_desc_len = TwoBytesToInt(header.fmt_desc_len);
+
+        if (fmt_desc_len == kFormatDescription.size() &&
+            !memcmp(header.fmt_desc, kFormatDescription.c_str(), fmt_desc_len)) {
+            // OK
+        } else {
+            throw std::invalid_argument("Invalid plot file format");
+        }
 
-    memcpy(this->id, header.id, sizeof(header.id));
-    this->k = header.k;
-    SafeSeek(disk_file, offsetof(struct plot_header, fmt_desc) + fmt_desc_len);
-
-    uint8_t size_buf[2];
-    SafeRead(disk_file, size_buf, 2);
-    this->memo_size = TwoBytesToInt(size_buf);
-    this->memo = new uint8_t[this->memo_size];
-    SafeRead(disk_file, this->memo, this->memo_size);
-
-    this->table_begin_pointers = std::vector<uint64_t>(11, 0);
-    this->C2 = std::vector<uint64_t>();
-
-    uint8_t pointer_buf[8];
-    for (uint8_t i = 1; i < 11; i++) {
-        SafeRead(disk_file, pointer_buf, 8);
-        this->table_begin_pointers[i] = EightBytesToInt(pointer_buf);
-    }
+        memcpy(this->id, header.id, sizeof(header.id));
+        this->k = header.k;
+        uint64_t offset = offsetof(struct plot_header, fmt_desc) + fmt_desc_len;
+
+        uint8_t size_buf[2];
+        SafeRead(offset, size_buf, 2);
+        offset += 2;
+        this->memo_size = TwoBytesToInt(size_buf);
+        this->memo = new uint8_t[this->memo_size];
+        SafeRead(offset, this->memo, this->memo_size);
+        offset += this->memo_size;
+
+        this->table_begin_pointers = std::vector<uint64_t>(11, 0);
+        this->C2 = std::vector<uint64_t>();
+
+        uint8_t pointer_buf[8 * 10];
+        SafeRead(offset, pointer_buf, sizeof(pointer_buf));
+        for (uint8_t i = 1; i < 11; i++) {
+            this->table_begin_pointers[i] = EightBytesToInt(pointer_buf + (i - 1) * 8);
+        }
 
-    SafeSeek(disk_file, table_begin_pointers[9]);
+        uint8_t c2_size = (ByteAlign(k) / 8);
+        uint32_t c2_entries = (table_begin_pointers[10] - table_begin_pointers[9]) / c2_size;
+        if (c2_entries == 0 || c2_entries == 1) {
+            throw std::invalid_argument("Invalid C2 table size");
+        }
 
-    uint8_t c2_size = (ByteAlign(k) / 8);
-    uint32_t c2_entries = (table_begin_pointers[10] - table_begin_pointers[9]) / c2_size;
-    if (c2_entries == 0 || c2_entries == 1) {
-        throw std::invalid_argument("Invalid C2 table size");
-    }
+        // The list of C2 entries is small enough to keep in memory. When proving, we can
+        // read from disk the C1 and C3 entries.
+        std::vector<uint8_t> c2_buf(uint64_t(c2_entries - 1) * c2_size);
+        SafeRead(table_begin_pointers[9], c2_buf.data(), c2_buf.size());
+        for (uint32_t i = 0; i < c2_entries - 1; i++) {
+            this->C2.push_back(Bits(c2_buf.data() + i * c2_size, c2_size, c2_size * 8).Slice(0, k).GetValue());
+        }
 
-    // The list of C2 entries is small enough to keep in memory. When proving, we can
-    // read from disk the C1 and C3 entries.
-    auto* c2_buf = new uint8_t[c2_size];
-    for (uint32_t i = 0; i < c2_entries - 1; i++) {
-        SafeRead(disk_file, c2_buf, c2_size);
-        this->C2.push_back(Bits(c2_buf, c2_size, c2_size * 8).Slice(0, k).GetValue());
+        if (options.use_mmap) {
+#ifdef _WIN32
+            HANDLE mapping = CreateFileMappingW(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping != NULL) {
+                file_map = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);  // the view keeps the mapping alive
+            }
+            if (file_map == nullptr) {
+                throw std::runtime_error("mapping failed with error " + std::to_string(GetLastError()));
+            }
+#else
+            void* map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, file_fd, 0);
+            if (map == MAP_FAILED) {
+                throw std::runtime_error("mmap failed with errno " + std::to_string(errno));
+            }
+            madvise(map, file_size, MADV_RANDOM);
+            file_map = (const uint8_t*)map;
+#endif
+        }
+    } catch (...) {
+        delete[] this->memo;
+        Close();
+        throw;
     }
 
-    delete[] c2_buf;
+    // build all ANS decode tables up front, decoding never has to lock
+    tmCache.Prepare(kRValues, 6, TMemoCache::Tables::kDecode);
+    tmCache.Prepare(&kC3R, 1, TMemoCache::Tables::kDecode);
 }
 
 DiskProver::~DiskProver()
 {
-    std::lock_guard<std::mutex> l(_mtx);
     delete[] this->memo;
+    Close();
     for (int i = 0; i < 6; i++) {
         Encoding::ANSFree(kRValues[i]);
     }
@@ -90,208 +146,278 @@ std::wstring DiskProver::GetFilename() const noexcept { return filename; }
 
 uint8_t DiskProver::GetSize() const noexcept { return k; }
 
-std::vector<LargeBits> DiskProver::GetQualitiesForChallenge(const uint8_t* challenge)
-{
-    std::vector<LargeBits> qualities;
-
-    std::lock_guard<std::mutex> l(_mtx);
-
-    {
-        std::ifstream disk_file(filename, std::ios::in | std::ios::binary);
+uint64_t DiskProver::GetBytesRead() const noexcept { return bytes_read.load(std::memory_order_relaxed); }
 
-        if (!disk_file.is_open()) {
-            throw std::invalid_argument("Invalid file ");
-        }
-
-        // This tells us how many f7 outputs (and therefore proofs) we have for this
-        // challenge. The expected value is one proof.
-        std::vector<uint64_t> p7_entries = GetP7Entries(disk_file, challenge);
-
-        if (p7_entries.empty()) {
-            return std::vector<LargeBits>();
-        }
+std::vector<LargeBits> DiskProver::GetQualitiesForChallenge(const uint8_t* challenge) const
+{
+    return GetProofSession(challenge).GetQualities();
+}
 
-        // The last 5 bits of the challenge determine which route we take to get to
-        // our two x values in the leaves.
-        uint8_t last_5_bits = challenge[31] & 0x1f;
+LargeBits DiskProver::GetFullProof(const uint8_t* challenge, uint32_t index) const
+{
+    ProofSession session(this, challenge);
+    auto results = Prove({&session}, false, true, index);
+    if (results[0].error) {
+        std::rethrow_exception(results[0].error);
+    }
+    return results[0].proofs[0];
+}
 
-        for (uint64_t position : p7_entries) {
-            // This inner loop goes from table 6 to table 1, getting the two backpointers,
-            // and following one of them.
-            for (uint8_t table_index = 6; table_index > 1; table_index--) {
-                uint128_t line_point = ReadLinePoint(disk_file, table_index, position);
+ProofSession DiskProver::GetProofSession(const uint8_t* challenge) const
+{
+    ProofSession session(this, challenge);
+    auto results = Prove({&session}, true, false);
+    if (results[0].error) {
+        std::rethrow_exception(results[0].error);
+    }
+    return session;
+}
 
-                auto xy = Encoding::LinePointToSquare(line_point);
-                assert(xy.first >= xy.second);
+std::vector<DiskProver::ChallengeResult> DiskProver::GetQualitiesForChallenges(
+    const std::vector<const uint8_t*>& challenges,
+    bool full_proofs) const
+{
+    std::vector<ProofSession> sessions;
+    std::vector<ProofSession*> session_ptrs;
+    sessions.reserve(challenges.size());
+    for (const uint8_t* challenge : challenges) {
+        sessions.push_back(ProofSession(this, challenge));
+        session_ptrs.push_back(&sessions.back());
+    }
+    return Prove(session_ptrs, true, full_proofs);
+}
 
-                if (((last_5_bits >> (table_index - 2)) & 1) == 0) {
-                    position = xy.second;
-                } else {
-                    position = xy.first;
-                }
-            }
-            uint128_t new_line_point = ReadLinePoint(disk_file, 1, position);
-            auto x1x2 = Encoding::LinePointToSquare(new_line_point);
-
-            // The final two x values (which are stored in the same location) are hashed
-            std::vector<unsigned char> hash_input(32 + ByteAlign(2 * k) / 8, 0);
-            memcpy(hash_input.data(), challenge, 32);
-            (LargeBits(x1x2.second, k) + LargeBits(x1x2.first, k)).ToBytes(hash_input.data() + 32);
-            std::vector<unsigned char> hash(picosha2::k_digest_size);
-            picosha2::hash256(hash_input.begin(), hash_input.end(), hash.begin(), hash.end());
-            qualities.emplace_back(hash.data(), 32, 256);
-        }
-    }  // Scope for disk_file
-    return qualities;
+ProofSession::ProofSession(const DiskProver* prover, const uint8_t* challenge) : prover(prover)
+{
+    memcpy(this->challenge, challenge, sizeof(this->challenge));
 }
 
-LargeBits DiskProver::GetFullProof(const uint8_t* challenge, uint32_t index)
+LargeBits ProofSession::GetFullProof(uint32_t index)
 {
-    LargeBits full_proof;
+    auto results = prover->Prove({this}, false, true, index);
+    if (results[0].error) {
+        std::rethrow_exception(results[0].error);
+    }
+    return results[0].proofs[0];
+}
 
-    std::lock_guard<std::mutex> l(_mtx);
-    {
-        std::ifstream disk_file(filename, std::ios::in | std::ios::binary);
+void DiskProver::Close()
+{
+#ifdef _WIN32
+    if (file_map) {
+        UnmapViewOfFile(file_map);
+        file_map = nullptr;
+    }
+    if (file_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_handle);
+        file_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (file_map) {
+        munmap((void*)file_map, file_size);
+        file_map = nullptr;
+    }
+    if (file_fd >= 0) {
+        close(file_fd);
+        file_fd = -1;
+    }
+#endif
+}
 
-        if (!disk_file.is_open()) {
-            throw std::invalid_argument("Invalid file ");
+void DiskProver::SafeRead(uint64_t offset, uint8_t* target, uint64_t size) const
+{
+    uint64_t total = 0;
+    while (total < size) {
+        const uint64_t pos = offset + total;
+#ifdef _WIN32
+        // One event per thread, the handle is overlapped so the offset is taken from here
+        struct ReadEvent {
+            HANDLE handle = CreateEventW(NULL, TRUE, FALSE, NULL);
+            ~ReadEvent() { CloseHandle(handle); }
+        };
+        thread_local ReadEvent event;
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = DWORD(pos);
+        overlapped.OffsetHigh = DWORD(pos >> 32);
+        overlapped.hEvent = event.handle;
+        DWORD num_read = 0;
+        const DWORD num_bytes = DWORD(std::min<uint64_t>(size - total, 1 << 30));
+        if ((!ReadFile(file_handle, target + total, num_bytes, NULL, &overlapped) &&
+             GetLastError() != ERROR_IO_PENDING) ||
+            !GetOverlappedResult(file_handle, &overlapped, &num_read, TRUE)) {
+            num_read = 0;
         }
-
-        std::vector<uint64_t> p7_entries = GetP7Entries(disk_file, challenge);
-        if (p7_entries.empty() || index >= p7_entries.size()) {
-            throw std::logic_error("No proof of space for this challenge");
+        const int64_t ret = num_read;
+#else
+        const ssize_t ret = pread(file_fd, target + total, size - total, pos);
+        if (ret < 0 && errno == EINTR) {
+            continue;
         }
-
-        // Gets the 64 leaf x values, concatenated together into a k*64 bit string.
-        std::vector<Bits> xs = GetInputs(p7_entries[index], 6);
-
-        // Sorts them according to proof ordering, where
-        // f1(x0) m= f1(x1), f2(x0, x1) m= f2(x2, x3), etc. On disk, they are not stored in
-        // proof ordering, they're stored in plot ordering, due to the sorting in the Compress
-        // phase.
-        std::vector<LargeBits> xs_sorted = ReorderProof(xs);
-        for (const auto& x : xs_sorted) {
-            full_proof += x;
+#endif
+        if (ret <= 0) {
+            throw std::runtime_error(
+                "read failed for size " + std::to_string(size) + " at position " +
+                std::to_string(offset));
         }
-    }  // Scope for disk_file
-    return full_proof;
+        total += ret;
+    }
 }
 
-void DiskProver::SafeSeek(std::ifstream& disk_file, uint64_t seek_location)
+std::vector<std::vector<uint8_t>> DiskProver::ReadBatch(std::vector<ReadRequest>& requests) const
 {
-    disk_file.seekg(seek_location);
-
-    if (disk_file.fail()) {
-        std::cout << "goodbit, failbit, badbit, eofbit: "
-                  << (disk_file.rdstate() & std::ifstream::goodbit)
-                  << (disk_file.rdstate() & std::ifstream::failbit)
-                  << (disk_file.rdstate() & std::ifstream::badbit)
-                  << (disk_file.rdstate() & std::ifstream::eofbit) << std::endl;
-        throw std::runtime_error(
-            "badbit or failbit after seeking to " + std::to_string(seek_location));
+    std::vector<size_t> order;
+    for (size_t i = 0; i < requests.size(); i++) {
+        // The bit readers may look up to 7 bytes past a request, which the mapping only
+        // has before the end of the file. The last parks are read into a buffer instead.
+        if (file_map && requests[i].offset + requests[i].size + 7 <= file_size) {
+            requests[i].data = file_map + requests[i].offset;
+            bytes_read.fetch_add(requests[i].size, std::memory_order_relaxed);
+        } else {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&requests](size_t a, size_t b) {
+        return requests[a].offset < requests[b].offset;
+    });
+
+    std::vector<std::vector<uint8_t>> buffers;
+    for (size_t i = 0; i < order.size();) {
+        const uint64_t begin = requests[order[i]].offset;
+        uint64_t end = begin + requests[order[i]].size;
+        size_t last = i + 1;
+        while (last < order.size() && requests[order[last]].offset <= end + kMaxReadGap) {
+            end = std::max(end, requests[order[last]].offset + requests[order[last]].size);
+            last++;
+        }
+        buffers.emplace_back(end - begin + 7);
+        try {
+            SafeRead(begin, buffers.back().data(), end - begin);
+            bytes_read.fetch_add(end - begin, std::memory_order_relaxed);
+            for (size_t j = i; j < last; j++) {
+                requests[order[j]].data = buffers.back().data() + (requests[order[j]].offset - begin);
+            }
+        } catch (...) {
+            for (size_t j = i; j < last; j++) {
+                requests[order[j]].error = std::current_exception();
+            }
+        }
+        i = last;
     }
+    return buffers;
 }
 
-void DiskProver::SafeRead(std::ifstream& disk_file, uint8_t* target, uint64_t size)
+uint128_t DiskProver::DecodeLinePoint(const uint8_t* park, uint8_t table_index, uint64_t position) const
 {
-    int64_t pos = disk_file.tellg();
-    disk_file.read(reinterpret_cast<char*>(target), size);
-
-    if (disk_file.fail()) {
-        std::cout << "goodbit, failbit, badbit, eofbit: "
-                  << (disk_file.rdstate() & std::ifstream::goodbit)
-                  << (disk_file.rdstate() & std::ifstream::failbit)
-                  << (disk_file.rdstate() & std::ifstream::badbit)
-                  << (disk_file.rdstate() & std::ifstream::eofbit) << std::endl;
-        throw std::runtime_error(
-            "badbit or failbit after reading size " + std::to_string(size) + " at position " +
-            std::to_string(pos));
-    }
+    return DecodeLinePoints(park, table_index, uint32_t(position % kEntriesPerPark) + 1, nullptr);
 }
 
-uint128_t DiskProver::ReadLinePoint(
-    std::ifstream& disk_file,
+uint128_t DiskProver::DecodeLinePoints(
+    const uint8_t* park,
     uint8_t table_index,
-    uint64_t position)
+    uint32_t count,
+    uint128_t* out) const
 {
-    uint64_t park_index = position / kEntriesPerPark;
-    uint32_t park_size_bits = EntrySizes::CalculateParkSize(k, table_index) * 8;
-
-    SafeSeek(disk_file, table_begin_pointers[table_index] + (park_size_bits / 8) * park_index);
-
-    // This is the checkpoint at the beginning of the park
+    // A park is: line point checkpoint, EPP stubs, 2 byte size of the encoded deltas, deltas.
     uint16_t line_point_size = EntrySizes::CalculateLinePointSize(k);
-    auto* line_point_bin = new uint8_t[line_point_size + 7];
-    SafeRead(disk_file, line_point_bin, line_point_size);
-    uint128_t line_point = SliceInt128FromBytes(line_point_bin, 0, k * 2);
-
-    // Reads EPP stubs
     uint32_t stubs_size_bits = EntrySizes::CalculateStubsSize(k) * 8;
-    auto* stubs_bin = new uint8_t[stubs_size_bits / 8 + 7];
-    SafeRead(disk_file, stubs_bin, stubs_size_bits / 8);
-
-    // Reads EPP deltas
     uint32_t max_deltas_size_bits = EntrySizes::CalculateMaxDeltasSize(k, table_index) * 8;
-    auto* deltas_bin = new uint8_t[max_deltas_size_bits / 8];
+
+    // This is the checkpoint at the beginning of the park
+    uint128_t line_point = SliceInt128FromBytes(park, 0, k * 2);
+
+    const uint8_t* stubs_bin = park + line_point_size;
 
     // Reads the size of the encoded deltas object
     uint16_t encoded_deltas_size = 0;
-    SafeRead(disk_file, (uint8_t*)&encoded_deltas_size, sizeof(uint16_t));
+    memcpy(&encoded_deltas_size, stubs_bin + stubs_size_bits / 8, sizeof(uint16_t));
+    const uint8_t* deltas_bin = stubs_bin + stubs_size_bits / 8 + sizeof(uint16_t);
 
     if (encoded_deltas_size * 8 > max_deltas_size_bits) {
         throw std::invalid_argument(
             "Invalid size for deltas: " + std::to_string(encoded_deltas_size));
     }
 
-    std::vector<uint8_t> deltas;
+    uint8_t deltas[kEntriesPerPark];
+    uint32_t num_deltas = kEntriesPerPark - 1;
 
     if (0x8000 & encoded_deltas_size) {
         // Uncompressed
         encoded_deltas_size &= 0x7fff;
-        deltas.resize(encoded_deltas_size);
-        SafeRead(disk_file, deltas.data(), encoded_deltas_size);
+        if (encoded_deltas_size > sizeof(deltas)) {
+            throw std::invalid_argument(
+                "Invalid size for deltas: " + std::to_string(encoded_deltas_size));
+        }
+        num_deltas = encoded_deltas_size;
+        memcpy(deltas, deltas_bin, num_deltas);
     } else {
-        // Compressed
-        SafeRead(disk_file, deltas_bin, encoded_deltas_size);
-
         // Decodes the deltas
         double R = kRValues[table_index - 1];
-        deltas = Encoding::ANSDecodeDeltas(tmCache, deltas_bin, encoded_deltas_size, kEntriesPerPark - 1, R);
+        Encoding::ANSDecodeDeltas(
+            tmCache, deltas_bin, encoded_deltas_size, std::span<uint8_t>(deltas, num_deltas), R);
     }
 
-    uint32_t start_bit = 0;
+    bit_reader stubs(stubs_bin, stubs_size_bits / 8);
     uint8_t stub_size = k - kStubMinusBits;
     uint64_t sum_deltas = 0;
     uint64_t sum_stubs = 0;
-    for (uint32_t i = 0;
-         i < std::min((uint32_t)(position % kEntriesPerPark), (uint32_t)deltas.size());
-         i++) {
-        uint64_t stub = EightBytesToInt(stubs_bin + start_bit / 8);
-        stub <<= start_bit % 8;
-        stub >>= 64 - stub_size;
-
-        sum_stubs += stub;
-        start_bit += stub_size;
-        sum_deltas += deltas[i];
+    uint128_t final_line_point = line_point;
+    for (uint32_t i = 0; i < count; i++) {
+        // The entries past the deltas of a short last park repeat the last line point
+        if (i > 0 && i <= num_deltas) {
+            sum_stubs += stubs.read(stub_size);
+            sum_deltas += deltas[i - 1];
+            uint128_t big_delta = ((uint128_t)sum_deltas << stub_size) + sum_stubs;
+            final_line_point = line_point + big_delta;
+        }
+        if (out) {
+            out[i] = final_line_point;
+        }
     }
 
-    uint128_t big_delta = ((uint128_t)sum_deltas << stub_size) + sum_stubs;
-    uint128_t final_line_point = line_point + big_delta;
+    return final_line_point;
+}
 
-    delete[] line_point_bin;
-    delete[] stubs_bin;
-    delete[] deltas_bin;
+bool DiskProver::ParkCache::Find(
+    uint8_t table_index,
+    uint64_t park_index,
+    uint32_t index_in_park,
+    uint128_t& line_point)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = parks.find({table_index, park_index});
+    if (iter == parks.end()) {
+        return false;
+    }
+    lru.splice(lru.begin(), lru, iter->second.lru);
+    line_point = iter->second.line_points[index_in_park];
+    return true;
+}
 
-    return final_line_point;
+void DiskProver::ParkCache::Insert(
+    uint8_t table_index,
+    uint64_t park_index,
+    std::vector<uint128_t>&& line_points)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const Key key(table_index, park_index);
+    if (capacity == 0 || parks.count(key)) {
+        return;
+    }
+    while (parks.size() >= capacity) {
+        parks.erase(lru.back());
+        lru.pop_back();
+    }
+    lru.push_front(key);
+    parks[key] = Park{std::move(line_points), lru.begin()};
 }
 
 std::vector<uint64_t> DiskProver::GetP7Positions(
     uint64_t curr_f7,
     uint64_t f7,
     uint64_t curr_p7_pos,
-    uint8_t* bit_mask,
+    const uint8_t* bit_mask,
     uint16_t encoded_size,
-    uint64_t c1_index)
+    uint64_t c1_index) const
 {
     std::vector<uint8_t> deltas =
         Encoding::ANSDecodeDeltas(tmCache, bit_mask, encoded_size, kCheckpoint1Interval, kC3R);
@@ -325,162 +451,445 @@ std::vector<uint64_t> DiskProver::GetP7Positions(
     return p7_positions;
 }
 
-std::vector<uint64_t> DiskProver::GetP7Entries(std::ifstream& disk_file, const uint8_t* challenge)
+std::vector<DiskProver::ChallengeResult> DiskProver::Prove(
+    const std::vector<ProofSession*>& sessions,
+    bool qualities,
+    bool proofs,
+    int64_t proof_index) const
 {
-    if (C2.empty()) {
-        return std::vector<uint64_t>();
-    }
-    Bits challenge_bits = Bits(challenge, 256 / 8, 256);
+    struct ChallengeState {
+        bool active = true;
+        bool lookup = false;  // the P7 entries are not known yet
+        uint64_t f7 = 0;
+        int64_t c1_index = 0;
+        uint64_t c2_entry_f = 0;
+        uint64_t curr_f7 = 0;
+        bool double_entry = false;
+        std::vector<uint64_t> p7_positions;
+        std::vector<std::vector<Bits>> xs;  // per proof, the 64 x values in plot ordering
+    };
+    // Entry of the table being walked: a quality follows one back pointer, a proof both.
+    // slot is the index of the quality / proof, base the index of the first x below it.
+    struct TableEntry {
+        size_t owner;
+        size_t slot;
+        bool proof;
+        uint64_t position;
+        uint32_t base;
+    };
 
-    // The first k bits determine which f7 matches with the challenge.
-    const uint64_t f7 = challenge_bits.Slice(0, k).GetValue();
+    std::vector<ChallengeResult> results(sessions.size());
+    std::vector<ChallengeState> states(sessions.size());
+    std::vector<ReadRequest> requests;
+    std::vector<std::vector<uint8_t>> buffers;
 
-    int64_t c1_index = 0;
-    bool broke = false;
-    uint64_t c2_entry_f = 0;
-    // Goes through C2 entries until we find the correct C2 checkpoint. We read each entry,
-    // comparing it to our target (f7).
-    for (uint64_t c2_entry : C2) {
-        c2_entry_f = c2_entry;
-        if (f7 < c2_entry) {
-            // If we passed our target, go back by one.
-            c1_index -= kCheckpoint2Interval;
-            broke = true;
-            break;
+    auto fail = [&](size_t owner, std::exception_ptr error) {
+        if (states[owner].active) {
+            states[owner].active = false;
+            results[owner].error = error;
         }
-        c1_index += kCheckpoint2Interval;
-    }
-
-    if (c1_index < 0) {
-        return std::vector<uint64_t>();
-    }
-
-    if (!broke) {
-        // If we didn't break, go back by one, to get the final checkpoint.
-        c1_index -= kCheckpoint2Interval;
-    }
+    };
+    // The lookup found the P7 entries (none if state.p7_positions is empty)
+    auto lookup_done = [&](size_t owner) {
+        states[owner].lookup = false;
+        sessions[owner]->p7_entries.clear();
+        sessions[owner]->has_p7_entries = true;
+    };
+    // The steps up to P7 only run for the challenges that need them
+    auto needs_lookup = [&](size_t owner) {
+        return states[owner].active && states[owner].lookup;
+    };
+    auto add_read = [&](size_t owner, uint64_t offset, uint64_t size) {
+        requests.emplace_back();
+        requests.back().offset = offset;
+        requests.back().size = size;
+        requests.back().owner = owner;
+        return requests.size() - 1;
+    };
+    // Reads the requests of the current step, the challenges of failed reads drop out
+    auto read_step = [&]() {
+        buffers = ReadBatch(requests);
+        for (const auto& request : requests) {
+            if (request.error) {
+                fail(request.owner, request.error);
+            }
+        }
+    };
 
     uint32_t c1_entry_size = ByteAlign(k) / 8;
+    uint32_t c3_entry_size = EntrySizes::CalculateC3Size(k);
+    uint64_t p7_park_size_bytes = ByteAlign((k + 1) * kEntriesPerPark) / 8;
 
-    auto* c1_entry_bytes = new uint8_t[c1_entry_size];
-    SafeSeek(disk_file, table_begin_pointers[8] + c1_index * ByteAlign(k) / 8);
-
-    uint64_t curr_f7 = c2_entry_f;
-    uint64_t prev_f7 = c2_entry_f;
-    broke = false;
-    // Goes through C2 entries until we find the correct C1 checkpoint.
-    for (uint64_t start = 0; start < kCheckpoint1Interval; start++) {
-        SafeRead(disk_file, c1_entry_bytes, c1_entry_size);
-        Bits c1_entry = Bits(c1_entry_bytes, ByteAlign(k) / 8, ByteAlign(k));
-        uint64_t read_f7 = c1_entry.Slice(0, k).GetValue();
-
-        if (start != 0 && read_f7 == 0) {
-            // We have hit the end of the checkpoint list
-            break;
+    // C2 is in memory, it gives the C1 checkpoint to start from
+    for (size_t i = 0; i < sessions.size(); i++) {
+        auto& state = states[i];
+        state.lookup = !sessions[i]->has_p7_entries;
+        if (!state.lookup) {
+            continue;
+        }
+        if (C2.empty()) {
+            lookup_done(i);
+            continue;
+        }
+        Bits challenge_bits = Bits(sessions[i]->challenge, 256 / 8, 256);
+
+        // The first k bits determine which f7 matches with the challenge.
+        state.f7 = challenge_bits.Slice(0, k).GetValue();
+
+        int64_t c1_index = 0;
+        bool broke = false;
+        uint64_t c2_entry_f = 0;
+        // Goes through C2 entries until we find the correct C2 checkpoint. We read each entry,
+        // comparing it to our target (f7).
+        for (uint64_t c2_entry : C2) {
+            c2_entry_f = c2_entry;
+            if (state.f7 < c2_entry) {
+                // If we passed our target, go back by one.
+                c1_index -= kCheckpoint2Interval;
+                broke = true;
+                break;
+            }
+            c1_index += kCheckpoint2Interval;
         }
-        curr_f7 = read_f7;
 
-        if (f7 < curr_f7) {
-            // We have passed the number we are looking for, so go back by one
-            curr_f7 = prev_f7;
-            c1_index -= 1;
-            broke = true;
-            break;
+        if (c1_index < 0) {
+            lookup_done(i);
+            continue;
         }
 
-        c1_index += 1;
-        prev_f7 = curr_f7;
-    }
-    if (!broke) {
-        // We never broke, so go back by one.
-        c1_index -= 1;
+        if (!broke) {
+            // If we didn't break, go back by one, to get the final checkpoint.
+            c1_index -= kCheckpoint2Interval;
+        }
+        state.c1_index = c1_index;
+        state.c2_entry_f = c2_entry_f;
     }
 
-    uint32_t c3_entry_size = EntrySizes::CalculateC3Size(k);
-    auto* bit_mask = new uint8_t[c3_entry_size];
-
-    // Double entry means that our entries are in more than one checkpoint park.
-    bool double_entry = f7 == curr_f7 && c1_index > 0;
-
-    uint64_t next_f7;
-    uint8_t encoded_size_buf[2];
-    uint16_t encoded_size;
-    std::vector<uint64_t> p7_positions;
-    int64_t curr_p7_pos = c1_index * kCheckpoint1Interval;
+    // Reads all C1 entries of each C2 checkpoint at once, they are scanned for the C1 checkpoint.
+    requests.clear();
+    std::vector<size_t> c1_request(sessions.size());
+    for (size_t i = 0; i < sessions.size(); i++) {
+        if (needs_lookup(i)) {
+            const uint64_t c1_begin = table_begin_pointers[8] + states[i].c1_index * c1_entry_size;
+            const uint64_t c1_count = std::min<uint64_t>(
+                kCheckpoint1Interval,
+                c1_begin < file_size ? (file_size - c1_begin) / c1_entry_size : 0);
+            c1_request[i] = add_read(i, c1_begin, c1_count * c1_entry_size);
+        }
+    }
+    read_step();
 
-    if (double_entry) {
-        // In this case, we read the previous park as well as the current one
-        c1_index -= 1;
-        SafeSeek(disk_file, table_begin_pointers[8] + c1_index * ByteAlign(k) / 8);
-        SafeRead(disk_file, c1_entry_bytes, ByteAlign(k) / 8);
-        Bits c1_entry_bits = Bits(c1_entry_bytes, ByteAlign(k) / 8, ByteAlign(k));
-        next_f7 = curr_f7;
-        curr_f7 = c1_entry_bits.Slice(0, k).GetValue();
+    for (size_t i = 0; i < sessions.size(); i++) {
+        auto& state = states[i];
+        if (!needs_lookup(i)) {
+            continue;
+        }
+        try {
+            const auto& request = requests[c1_request[i]];
+            const uint64_t c1_count = request.size / c1_entry_size;
+            uint64_t curr_f7 = state.c2_entry_f;
+            uint64_t prev_f7 = state.c2_entry_f;
+            bool broke = false;
+            // Goes through C2 entries until we find the correct C1 checkpoint.
+            for (uint64_t start = 0; start < kCheckpoint1Interval; start++) {
+                if (start >= c1_count) {
+                    throw std::runtime_error(
+                        "read failed for size " + std::to_string(c1_entry_size) + " at position " +
+                        std::to_string(request.offset + start * c1_entry_size));
+                }
+                Bits c1_entry = Bits(request.data + start * c1_entry_size, ByteAlign(k) / 8, ByteAlign(k));
+                uint64_t read_f7 = c1_entry.Slice(0, k).GetValue();
 
-        SafeSeek(disk_file, table_begin_pointers[10] + c1_index * c3_entry_size);
+                if (start != 0 && read_f7 == 0) {
+                    // We have hit the end of the checkpoint list
+                    break;
+                }
+                curr_f7 = read_f7;
+
+                if (state.f7 < curr_f7) {
+                    // We have passed the number we are looking for, so go back by one
+                    curr_f7 = prev_f7;
+                    state.c1_index -= 1;
+                    broke = true;
+                    break;
+                }
 
-        SafeRead(disk_file, encoded_size_buf, 2);
-        encoded_size = Bits(encoded_size_buf, 2, 16).GetValue();
-        SafeRead(disk_file, bit_mask, c3_entry_size - 2);
+                state.c1_index += 1;
+                prev_f7 = curr_f7;
+            }
+            if (!broke) {
+                // We never broke, so go back by one.
+                state.c1_index -= 1;
+            }
+            state.curr_f7 = curr_f7;
 
-        p7_positions = GetP7Positions(curr_f7, f7, curr_p7_pos, bit_mask, encoded_size, c1_index);
+            // Double entry means that our entries are in more than one checkpoint park.
+            state.double_entry = state.f7 == curr_f7 && state.c1_index > 0;
+        } catch (...) {
+            fail(i, std::current_exception());
+        }
+    }
 
-        SafeRead(disk_file, encoded_size_buf, 2);
-        encoded_size = Bits(encoded_size_buf, 2, 16).GetValue();
-        SafeRead(disk_file, bit_mask, c3_entry_size - 2);
+    // Reads the C3 park(s), for a double entry also the previous park and its C1 checkpoint
+    requests.clear();
+    std::vector<size_t> c3_request(sessions.size());
+    std::vector<size_t> prev_c1_request(sessions.size());
+    for (size_t i = 0; i < sessions.size(); i++) {
+        const auto& state = states[i];
+        if (!needs_lookup(i)) {
+            continue;
+        }
+        if (state.double_entry) {
+            const int64_t c1_index = state.c1_index - 1;
+            prev_c1_request[i] = add_read(i, table_begin_pointers[8] + c1_index * c1_entry_size, c1_entry_size);
+            c3_request[i] = add_read(i, table_begin_pointers[10] + c1_index * c3_entry_size, 2 * c3_entry_size);
+        } else {
+            c3_request[i] = add_read(i, table_begin_pointers[10] + state.c1_index * c3_entry_size, c3_entry_size);
+        }
+    }
+    read_step();
 
-        c1_index++;
-        curr_p7_pos = c1_index * kCheckpoint1Interval;
-        auto second_positions =
-            GetP7Positions(next_f7, f7, curr_p7_pos, bit_mask, encoded_size, c1_index);
-        p7_positions.insert(p7_positions.end(), second_positions.begin(), second_positions.end());
+    for (size_t i = 0; i < sessions.size(); i++) {
+        auto& state = states[i];
+        if (!needs_lookup(i)) {
+            continue;
+        }
+        try {
+            const uint8_t* c3_park = requests[c3_request[i]].data;
+            int64_t c1_index = state.c1_index;
+            int64_t curr_p7_pos = c1_index * kCheckpoint1Interval;
+            uint16_t encoded_size;
+
+            if (state.double_entry) {
+                // In this case, we read the previous park as well as the current one
+                c1_index -= 1;
+                Bits c1_entry_bits = Bits(requests[prev_c1_request[i]].data, ByteAlign(k) / 8, ByteAlign(k));
+                uint64_t next_f7 = state.curr_f7;
+                uint64_t curr_f7 = c1_entry_bits.Slice(0, k).GetValue();
+
+                encoded_size = Bits(c3_park, 2, 16).GetValue();
+                state.p7_positions =
+                    GetP7Positions(curr_f7, state.f7, curr_p7_pos, c3_park + 2, encoded_size, c1_index);
+
+                encoded_size = Bits(c3_park + c3_entry_size, 2, 16).GetValue();
+
+                c1_index++;
+                curr_p7_pos = c1_index * kCheckpoint1Interval;
+                auto second_positions = GetP7Positions(
+                    next_f7, state.f7, curr_p7_pos, c3_park + c3_entry_size + 2, encoded_size, c1_index);
+                state.p7_positions.insert(
+                    state.p7_positions.end(), second_positions.begin(), second_positions.end());
+            } else {
+                encoded_size = Bits(c3_park, 2, 16).GetValue();
+                state.p7_positions = GetP7Positions(
+                    state.curr_f7, state.f7, curr_p7_pos, c3_park + 2, encoded_size, c1_index);
+            }
 
-    } else {
-        SafeSeek(disk_file, table_begin_pointers[10] + c1_index * c3_entry_size);
-        SafeRead(disk_file, encoded_size_buf, 2);
-        encoded_size = Bits(encoded_size_buf, 2, 16).GetValue();
-        SafeRead(disk_file, bit_mask, c3_entry_size - 2);
+            // p7_positions is a list of all the positions into table P7, where the output is
+            // equal to f7. If it's empty, no proofs are present for this f7.
+            if (state.p7_positions.empty()) {
+                lookup_done(i);
+            }
+        } catch (...) {
+            fail(i, std::current_exception());
+        }
+    }
 
-        p7_positions = GetP7Positions(curr_f7, f7, curr_p7_pos, bit_mask, encoded_size, c1_index);
+    // Given the p7 positions, which are all adjacent, we can read the pos6 values from table
+    // P7, all parks they span with one read.
+    requests.clear();
+    std::vector<size_t> p7_request(sessions.size());
+    for (size_t i = 0; i < sessions.size(); i++) {
+        const auto& state = states[i];
+        if (needs_lookup(i)) {
+            const uint64_t first_park = state.p7_positions.front() / kEntriesPerPark;
+            const uint64_t last_park = state.p7_positions.back() / kEntriesPerPark;
+            p7_request[i] = add_read(
+                i,
+                table_begin_pointers[7] + first_park * p7_park_size_bytes,
+                (last_park - first_park + 1) * p7_park_size_bytes);
+        }
     }
+    read_step();
+
+    std::vector<TableEntry> entries;
+    for (size_t i = 0; i < sessions.size(); i++) {
+        auto& state = states[i];
+        ProofSession& session = *sessions[i];
+        if (needs_lookup(i)) {
+            const auto& request = requests[p7_request[i]];
+            const uint64_t first_park = state.p7_positions.front() / kEntriesPerPark;
+            bit_reader p7_parks(request.data, request.size);
+            session.p7_entries.clear();
+            for (uint64_t p7_position : state.p7_positions) {
+                p7_parks.seek(
+                    (p7_position / kEntriesPerPark - first_park) * p7_park_size_bytes * 8 +
+                    (p7_position % kEntriesPerPark) * (k + 1));
+                session.p7_entries.push_back(p7_parks.read(k + 1));
+            }
+            session.has_p7_entries = true;
+            state.lookup = false;
+        }
+        if (!state.active) {
+            continue;
+        }
+        const std::vector<uint64_t>& p7_entries = session.p7_entries;
 
-    // p7_positions is a list of all the positions into table P7, where the output is equal to
-    // f7. If it's empty, no proofs are present for this f7.
-    if (p7_positions.empty()) {
-        delete[] bit_mask;
-        delete[] c1_entry_bytes;
-        return std::vector<uint64_t>();
+        if (qualities) {
+            session.qualities.assign(p7_entries.size(), LargeBits());
+            for (size_t j = 0; j < p7_entries.size(); j++) {
+                entries.push_back({i, j, false, p7_entries[j], 0});
+            }
+        }
+        if (proofs) {
+            size_t first = 0;
+            size_t count = p7_entries.size();
+            if (proof_index >= 0) {
+                if ((uint64_t)proof_index >= p7_entries.size()) {
+                    fail(i, std::make_exception_ptr(
+                                std::logic_error("No proof of space for this challenge")));
+                    continue;
+                }
+                first = proof_index;
+                count = 1;
+            }
+            results[i].proofs.resize(count);
+            state.xs.assign(count, std::vector<Bits>(64));
+            for (size_t j = 0; j < count; j++) {
+                entries.push_back({i, j, true, p7_entries[first + j], 0});
+            }
+        }
     }
 
-    uint64_t p7_park_size_bytes = ByteAlign((k + 1) * kEntriesPerPark) / 8;
+    // Goes from table 6 to table 1, reading the line point of every entry, which gives the
+    // two back pointers into the next table. Entries in the same park share one read.
+    for (uint8_t table_index = 6; table_index >= 1; table_index--) {
+        const uint32_t park_size = EntrySizes::CalculateParkSize(k, table_index);
+        requests.clear();
+        std::vector<size_t> entry_request(entries.size(), SIZE_MAX);
+        for (size_t e = 0; e < entries.size(); e++) {
+            const auto& entry = entries[e];
+            auto& line_points = sessions[entry.owner]->line_points;
+            if (line_points.count({table_index, entry.position})) {
+                continue;  // read by an earlier lookup of this session
+            }
+            uint128_t line_point = 0;
+            if (park_cache.Enabled() &&
+                park_cache.Find(
+                    table_index,
+                    entry.position / kEntriesPerPark,
+                    entry.position % kEntriesPerPark,
+                    line_point)) {
+                line_points.emplace(std::make_pair(table_index, entry.position), line_point);
+                continue;
+            }
+            // The park size does not count the 2 byte size of the deltas, there is always
+            // a following table to read it from.
+            entry_request[e] = add_read(
+                entry.owner,
+                table_begin_pointers[table_index] + uint64_t(park_size) * (entry.position / kEntriesPerPark),
+                park_size + sizeof(uint16_t));
+        }
+        read_step();
+
+        std::vector<TableEntry> next_entries;
+        for (size_t e = 0; e < entries.size(); e++) {
+            const auto& entry = entries[e];
+            auto& state = states[entry.owner];
+            if (!state.active) {
+                continue;
+            }
+            try {
+                // entries of the same session can share a line point (quality and proof)
+                auto& line_points = sessions[entry.owner]->line_points;
+                auto cached = line_points.find({table_index, entry.position});
+                if (cached == line_points.end()) {
+                    const uint8_t* park = requests[entry_request[e]].data;
+                    uint128_t line_point = 0;
+                    if (park_cache.Enabled() &&
+                        park_cache.Find(
+                            table_index,
+                            entry.position / kEntriesPerPark,
+                            entry.position % kEntriesPerPark,
+                            line_point)) {
+                        // decoded for an earlier entry of this step
+                    } else if (park_cache.Enabled()) {
+                        // Decoding the whole park costs about the same as decoding up to the entry
+                        std::vector<uint128_t> park_points(kEntriesPerPark);
+                        DecodeLinePoints(park, table_index, kEntriesPerPark, park_points.data());
+                        line_point = park_points[entry.position % kEntriesPerPark];
+                        park_cache.Insert(table_index, entry.position / kEntriesPerPark, std::move(park_points));
+                    } else {
+                        line_point = DecodeLinePoint(park, table_index, entry.position);
+                    }
+                    cached = line_points.emplace(std::make_pair(table_index, entry.position), line_point).first;
+                }
+                uint128_t line_point = cached->second;
+                auto xy = Encoding::LinePointToSquare(line_point);
 
-    std::vector<uint64_t> p7_entries;
+                if (entry.proof) {
+                    if (table_index > 1) {
+                        const uint32_t half = 1 << (table_index - 1);
+                        next_entries.push_back({entry.owner, entry.slot, true, xy.second, entry.base});
+                        next_entries.push_back({entry.owner, entry.slot, true, xy.first, entry.base + half});
+                    } else {
+                        // For table P1, the line point represents two concatenated x values.
+                        state.xs[entry.slot][entry.base] = Bits(xy.second, k);     // y
+                        state.xs[entry.slot][entry.base + 1] = Bits(xy.first, k);  // x
+                    }
+                } else if (table_index > 1) {
+                    assert(xy.first >= xy.second);
+
+                    // The last 5 bits of the challenge determine which route we take to get to
+                    // our two x values in the leaves.
+                    uint8_t last_5_bits = sessions[entry.owner]->challenge[31] & 0x1f;
+                    if (((last_5_bits >> (table_index - 2)) & 1) == 0) {
+                        next_entries.push_back({entry.owner, entry.slot, false, xy.second, 0});
+                    } else {
+                        next_entries.push_back({entry.owner, entry.slot, false, xy.first, 0});
+                    }
+                } else {
+                    // The final two x values (which are stored in the same location) are hashed
+                    std::vector<unsigned char> hash_input(32 + ByteAlign(2 * k) / 8, 0);
+                    memcpy(hash_input.data(), sessions[entry.owner]->challenge, 32);
+                    (LargeBits(xy.second, k) + LargeBits(xy.first, k)).ToBytes(hash_input.data() + 32);
+                    std::vector<unsigned char> hash(picosha2::k_digest_size);
+                    picosha2::hash256(hash_input.begin(), hash_input.end(), hash.begin(), hash.end());
+                    sessions[entry.owner]->qualities[entry.slot] = LargeBits(hash.data(), 32, 256);
+                }
+            } catch (...) {
+                fail(entry.owner, std::current_exception());
+            }
+        }
+        entries.swap(next_entries);
+    }
 
-    // Given the p7 positions, which are all adjacent, we can read the pos6 values from table
-    // P7.
-    auto* p7_park_buf = new uint8_t[p7_park_size_bytes];
-    uint64_t park_index = (p7_positions[0] == 0 ? 0 : p7_positions[0]) / kEntriesPerPark;
-    SafeSeek(disk_file, table_begin_pointers[7] + park_index * p7_park_size_bytes);
-    SafeRead(disk_file, p7_park_buf, p7_park_size_bytes);
-    ParkBits p7_park(p7_park_buf, p7_park_size_bytes, p7_park_size_bytes * 8);
-    for (uint64_t i = 0; i < p7_positions[p7_positions.size() - 1] - p7_positions[0] + 1; i++) {
-        uint64_t new_park_index = (p7_positions[i]) / kEntriesPerPark;
-        if (new_park_index > park_index) {
-            SafeSeek(disk_file, table_begin_pointers[7] + new_park_index * p7_park_size_bytes);
-            SafeRead(disk_file, p7_park_buf, p7_park_size_bytes);
-            p7_park = ParkBits(p7_park_buf, p7_park_size_bytes, p7_park_size_bytes * 8);
-        }
-        uint32_t start_bit_index = (p7_positions[i] % kEntriesPerPark) * (k + 1);
-
-        uint64_t p7_int = p7_park.Slice(start_bit_index, start_bit_index + k + 1).GetValue();
-        p7_entries.push_back(p7_int);
-    }
-
-    delete[] bit_mask;
-    delete[] c1_entry_bytes;
-    delete[] p7_park_buf;
-
-    return p7_entries;
+    for (size_t i = 0; i < sessions.size(); i++) {
+        auto& state = states[i];
+        if (state.active && qualities) {
+            results[i].qualities = sessions[i]->qualities;
+        }
+        if (state.active && proofs) {
+            try {
+                // Sorts them according to proof ordering, where
+                // f1(x0) m= f1(x1), f2(x0, x1) m= f2(x2, x3), etc. On disk, they are not stored in
+                // proof ordering, they're stored in plot ordering, due to the sorting in the Compress
+                // phase.
+                for (size_t j = 0; j < state.xs.size(); j++) {
+                    for (const auto& x : ReorderProof(state.xs[j])) {
+                        results[i].proofs[j] += x;
+                    }
+                }
+            } catch (...) {
+                fail(i, std::current_exception());
+            }
+        }
+        if (results[i].error) {
+            results[i].qualities.clear();
+            results[i].proofs.clear();
+        }
+    }
+    return results;
 }
 
 std::vector<LargeBits> DiskProver::ReorderProof(const std::vector<Bits>& xs_input) const
@@ -541,36 +950,3 @@ std::vector<LargeBits> DiskProver::ReorderProof(const std::vector<Bits>& xs_inpu
     }
     return ordered_proof;
 }
-
-std::vector<Bits> DiskProver::GetInputs(uint64_t position, uint8_t depth)
-{
-    // Create individual file handles to allow parallel processing
-    std::ifstream disk_file(filename, std::ios::in | std::ios::binary);
-    uint128_t line_point = ReadLinePoint(disk_file, depth, position);
-    std::pair<uint64_t, uint64_t> xy = Encoding::LinePointToSquare(line_point);
-
-    if (depth == 1) {
-        // For table P1, the line point represents two concatenated x values.
-        std::vector<Bits> ret;
-        ret.emplace_back(xy.second, k);  // y
-        ret.emplace_back(xy.first, k);   // x
-        return ret;
-    } else {
-        auto left_fut = std::async(
-            std::launch::async,
-            &DiskProver::GetInputs,
-            this,
-            (uint64_t)xy.second,
-            (uint8_t)(depth - 1));
-        auto right_fut = std::async(
-            std::launch::async,
-            &DiskProver::GetInputs,
-            this,
-            (uint64_t)xy.first,
-            (uint8_t)(depth - 1));
-        std::vector<Bits> left = left_fut.get();    // y
-        std::vector<Bits> right = right_fut.get();  // x
-        left.insert(left.end(), right.begin(), right.end());
-        return left;
-    }
-}
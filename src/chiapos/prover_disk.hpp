@@ -15,15 +15,25 @@
 #ifndef CHIAPOS_SRC_CPP_PROVER_DISK_HPP_
 #define CHIAPOS_SRC_CPP_PROVER_DISK_HPP_
 
-#ifndef _WIN32
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 #include <stdio.h>
 
 #include <algorithm>  // std::min
-#include <fstream>
+#include <atomic>
+#include <exception>
 #include <future>
 #include <iostream>
+#include <list>
+#include <map>
 #include <mutex>
 #include <string>
 #include <utility>
@@ -43,53 +53,172 @@ struct plot_header {
     uint8_t fmt_desc[50];
 };
 
+class DiskProver;
+
+struct DiskProverOptions {
+    // Reads through a mapping of the whole file instead of positional reads, the parks are
+    // decoded straight from the page cache. An I/O error while touching the mapping is not
+    // reported as an exception (SIGBUS / EXCEPTION_IN_PAGE_ERROR), so this is meant for
+    // local SSDs.
+    bool use_mmap = false;
+    // Number of decoded parks (32 KiB each) kept in an LRU shared by all lookups of the
+    // prover, 0 disables it. Pays off when the same parks are visited again, like repeated
+    // checks of a plot.
+    size_t park_cache_size = 0;
+};
+
+// The lookup of one challenge, returned by DiskProver::GetProofSession. It keeps the P7 entries
+// and the line points it has decoded, so fetching full proofs afterwards only reads the parks
+// that the quality lookup did not touch. Not thread-safe (use one session per thread), and it
+// must not outlive its prover.
+class ProofSession {
+public:
+    const std::vector<LargeBits>& GetQualities() const noexcept { return qualities; }
+
+    // Same as DiskProver::GetFullProof for the challenge of this session.
+    LargeBits GetFullProof(uint32_t index);
+
+private:
+    friend class DiskProver;
+
+    explicit ProofSession(const DiskProver* prover, const uint8_t* challenge);
+
+    const DiskProver* prover;
+    uint8_t challenge[32];
+    bool has_p7_entries = false;
+    std::vector<uint64_t> p7_entries;  // positions into table 6, one per quality
+    std::vector<LargeBits> qualities;
+    std::map<std::pair<uint8_t, uint64_t>, uint128_t> line_points;  // (table, position)
+};
+
 // The DiskProver, given a correctly formatted plot file, can efficiently generate valid proofs
-// of space, for a given challenge.
+// of space, for a given challenge. The file stays open for the lifetime of the prover and is
+// only accessed with positional reads (or through a read-only mapping), the only shared mutable
+// state after construction is the optional park cache, which has its own lock, so any number of
+// threads can prove from the same instance at once.
 class DiskProver {
 public:
     // The constructor opens the file, and reads the contents of the file header. The table pointers
     // will be used to find and seek to all seven tables, at the time of proving.
-    explicit DiskProver(const std::wstring& filename);
+    explicit DiskProver(const std::wstring& filename, const DiskProverOptions& options = {});
 
     ~DiskProver();
+    DiskProver(const DiskProver&) = delete;
+    DiskProver& operator=(const DiskProver&) = delete;
     void GetMemo(uint8_t* buffer);
     uint32_t GetMemoSize() const noexcept;
     void GetId(uint8_t* buffer);
     std::wstring GetFilename() const noexcept;
     uint8_t GetSize() const noexcept;
+    // Bytes read (or touched in the mapping) by all lookups so far. [thread-safe]
+    uint64_t GetBytesRead() const noexcept;
 
     // Given a challenge, returns a quality string, which is sha256(challenge + 2 adjecent x
     // values), from the 64 value proof. Note that this is more efficient than fetching all 64 x
-    // values, which are in different parts of the disk.
-    std::vector<LargeBits> GetQualitiesForChallenge(const uint8_t* challenge);
+    // values, which are in different parts of the disk. [thread-safe]
+    std::vector<LargeBits> GetQualitiesForChallenge(const uint8_t* challenge) const;
 
     // Given a challenge, and an index, returns a proof of space. This assumes GetQualities was
     // called, and there are actually proofs present. The index represents which proof to fetch,
-    // if there are multiple.
-    LargeBits GetFullProof(const uint8_t* challenge, uint32_t index);
+    // if there are multiple. [thread-safe]
+    LargeBits GetFullProof(const uint8_t* challenge, uint32_t index) const;
+
+    // Looks up the qualities of a challenge like GetQualitiesForChallenge, and keeps what it
+    // read for the full proofs. [thread-safe]
+    ProofSession GetProofSession(const uint8_t* challenge) const;
+
+    struct ChallengeResult {
+        std::vector<LargeBits> qualities;
+        std::vector<LargeBits> proofs;  // proofs[i] belongs to qualities[i], only if requested
+        std::exception_ptr error;       // set if this challenge failed, the others are not affected
+    };
+
+    // Batch version of GetQualitiesForChallenge, and of GetFullProof for every index if
+    // full_proofs is set. The challenges (32 bytes each) advance together one table at a time,
+    // the reads of every step are sorted by file offset and reads that hit the same park or
+    // lie close together are merged, so a batch costs a few sweeps over the disk instead of
+    // one chain of random seeks per challenge. [thread-safe]
+    std::vector<ChallengeResult> GetQualitiesForChallenges(
+        const std::vector<const uint8_t*>& challenges,
+        bool full_proofs = false) const;
 
 private:
-	TMemoCache tmCache;
-    mutable std::mutex _mtx;
+    friend class ProofSession;
+
+    mutable TMemoCache tmCache;  // lock-free once prepared
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+#else
+    int file_fd = -1;
+#endif
+    uint64_t file_size = 0;
+    const uint8_t* file_map = nullptr;  // whole file, only with DiskProverOptions::use_mmap
+    mutable std::atomic<uint64_t> bytes_read{0};
     std::wstring filename;
     uint32_t memo_size;
-    uint8_t* memo;
+    uint8_t* memo = nullptr;
     uint8_t id[kIdLen]{};  // Unique plot id
     uint8_t k;
     std::vector<uint64_t> table_begin_pointers;
     std::vector<uint64_t> C2;
 
-    // Using this method instead of simply seeking will prevent segfaults that would arise when
-    // continuing the process of looking up qualities.
-    static void SafeSeek(std::ifstream& disk_file, uint64_t seek_location);
+    // Reads of one batch step closer than this are merged into one read
+    static constexpr uint64_t kMaxReadGap = 64 * 1024;
+
+    // One positional read of a batch step, owner is the index of the challenge it belongs to.
+    struct ReadRequest {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        size_t owner = 0;
+        const uint8_t* data = nullptr;  // set by ReadBatch, unless error is set
+        std::exception_ptr error;
+    };
+
+    // Bounded LRU of decoded parks, keyed by (table, park index). [thread-safe]
+    class ParkCache {
+    public:
+        explicit ParkCache(size_t capacity) : capacity(capacity) {}
+
+        bool Enabled() const noexcept { return capacity > 0; }
+
+        // Gets the line point at index_in_park of a cached park, and marks the park as used.
+        bool Find(uint8_t table_index, uint64_t park_index, uint32_t index_in_park, uint128_t& line_point);
+
+        void Insert(uint8_t table_index, uint64_t park_index, std::vector<uint128_t>&& line_points);
 
-    static void SafeRead(std::ifstream& disk_file, uint8_t* target, uint64_t size);
+    private:
+        typedef std::pair<uint8_t, uint64_t> Key;
+        struct Park {
+            std::vector<uint128_t> line_points;
+            std::list<Key>::iterator lru;
+        };
+        std::mutex mutex;
+        const size_t capacity;
+        std::list<Key> lru;  // most recently used first
+        std::map<Key, Park> parks;
+    };
 
-    // Reads exactly one line point (pair of two k bit back-pointers) from the given table.
-    // The entry at index "position" is read. First, the park index is calculated, then
-    // the park is read, and finally, entry deltas are added up to the position that we
-    // are looking for.
-    uint128_t ReadLinePoint(std::ifstream& disk_file, uint8_t table_index, uint64_t position);
+    mutable ParkCache park_cache;
+
+    void Close();
+
+    // Reads exactly size bytes at the given file offset, throws if the file is shorter.
+    // Does not move any file pointer, so concurrent calls do not interfere.
+    void SafeRead(uint64_t offset, uint8_t* target, uint64_t size) const;
+
+    // Reads all requests in file order, overlapping or close requests with a single read.
+    // The requests point into the returned buffers, which are padded for the bit readers,
+    // or into the mapping if the file is mapped.
+    std::vector<std::vector<uint8_t>> ReadBatch(std::vector<ReadRequest>& requests) const;
+
+    // Gets exactly one line point (pair of two k bit back-pointers) of the given table
+    // from its park, which must be followed by at least 2 + 7 readable bytes. The entry
+    // at index "position" is decoded: the entry deltas are added up to the position that
+    // we are looking for.
+    uint128_t DecodeLinePoint(const uint8_t* park, uint8_t table_index, uint64_t position) const;
+
+    // Decodes the first count line points of a park into out (if not null), returns the last one.
+    uint128_t DecodeLinePoints(const uint8_t* park, uint8_t table_index, uint32_t count, uint128_t* out) const;
 
     // Gets the P7 positions of the target f7 entries. Uses the C3 encoded bitmask read from disk.
     // A C3 park is a list of deltas between p7 entries, ANS encoded.
@@ -97,12 +226,20 @@ private:
         uint64_t curr_f7,
         uint64_t f7,
         uint64_t curr_p7_pos,
-        uint8_t* bit_mask,
+        const uint8_t* bit_mask,
         uint16_t encoded_size,
-        uint64_t c1_index);
+        uint64_t c1_index) const;
 
-    // Returns P7 table entries (which are positions into table P6), for a given challenge
-    std::vector<uint64_t> GetP7Entries(std::ifstream& disk_file, const uint8_t* challenge);
+    // Walks the tables for all challenges: C2 -> C1 -> C3 -> P7 gives the P7 entries (which
+    // are positions into table P6), then tables 6 to 1 are followed back to the x values.
+    // Qualities follow one back pointer per table, proofs both. With proof_index >= 0 only
+    // that proof is fetched, it is an error if it does not exist. The sessions keep the P7
+    // entries and line points, steps a session already did are skipped.
+    std::vector<ChallengeResult> Prove(
+        const std::vector<ProofSession*>& sessions,
+        bool qualities,
+        bool proofs,
+        int64_t proof_index = -1) const;
 
     // Changes a proof of space (64 k bit x values) from plot ordering to proof ordering.
     // Proof ordering: x1..x64 s.t.
@@ -119,12 +256,6 @@ private:
     //     For all comparisons up to f7
     //     Where a < b is defined as:  max(b) > max(a) where a and b are lists of k bit elements
     std::vector<LargeBits> ReorderProof(const std::vector<Bits>& xs_input) const;
-
-    // Recursive function to go through the tables on disk, backpropagating and fetching
-    // all of the leaves (x values). For example, for depth=5, it fetches the position-th
-    // entry in table 5, reading the two back pointers from the line point, and then
-    // recursively calling GetInputs for table 4.
-    std::vector<Bits> GetInputs(uint64_t position, uint8_t depth);
 };
 
 #endif  // SRC_CPP_PROVER_DISK_HPP_
@@ -32,6 +32,7 @@
 #include "Keygen.hpp"
 #include "JobCreatePlotRef.h"
 #include "JobCreatePlotMax.h"
+#include "CopyQueue.h"
 
 using std::string;
 using std::wstring;
@@ -78,8 +79,11 @@ int cli_create(
 	return 1;
 }
 
-int cli_check(uint32_t iterations, std::wstring filename) {
-	DiskProver prover(filename);
+int cli_check(uint32_t iterations, std::wstring filename, bool use_mmap, uint32_t park_cache_size) {
+	DiskProverOptions options;
+	options.use_mmap = use_mmap;
+	options.park_cache_size = park_cache_size;
+	DiskProver prover(filename, options);
 	Verifier verifier = Verifier();
 
 	uint32_t success = 0;
@@ -87,18 +91,32 @@ int cli_check(uint32_t iterations, std::wstring filename) {
 	prover.GetId(id_bytes);
 	uint8_t k = prover.GetSize();
 
+	// all challenges go to the prover as one batch, so their reads are sorted and merged
+	vector<vector<unsigned char>> hashes;
+	vector<const uint8_t*> challenges;
 	for (uint32_t num = 0; num < iterations; num++) {
 		vector<unsigned char> hash_input = intToBytes(num, 4);
 		hash_input.insert(hash_input.end(), &id_bytes[0], &id_bytes[32]);
 
 		vector<unsigned char> hash(picosha2::k_digest_size);
 		picosha2::hash256(hash_input.begin(), hash_input.end(), hash.begin(), hash.end());
+		hashes.push_back(hash);
+	}
+	for (const auto& hash : hashes) {
+		challenges.push_back(hash.data());
+	}
+	auto results = prover.GetQualitiesForChallenges(challenges, true);
 
+	for (uint32_t num = 0; num < iterations; num++) {
+		const vector<unsigned char>& hash = hashes[num];
 		try {
-			vector<LargeBits> qualities = prover.GetQualitiesForChallenge(hash.data());
+			if (results[num].error) {
+				std::rethrow_exception(results[num].error);
+			}
+			const vector<LargeBits>& qualities = results[num].qualities;
 
 			for (uint32_t i = 0; i < qualities.size(); i++) {
-				LargeBits proof = prover.GetFullProof(hash.data(), i);
+				const LargeBits& proof = results[num].proofs[i];
 				uint8_t *proof_data = new uint8_t[proof.GetSize() / 8];
 				proof.ToBytes(proof_data);
 				cout << "i: " << num << std::endl;
@@ -180,11 +198,13 @@ int cli_proof(std::string challenge, std::wstring filename) {
 
 	DiskProver prover(filename);
 	try {
-		vector<LargeBits> qualities = prover.GetQualitiesForChallenge(challenge_bytes);
+		// the session reuses the parks the quality lookup read for the proofs
+		ProofSession session = prover.GetProofSession(challenge_bytes);
+		const vector<LargeBits>& qualities = session.GetQualities();
 		for (uint32_t i = 0; i < qualities.size(); i++) {
 			uint8_t k = prover.GetSize();
 			uint8_t *proof_data = new uint8_t[8 * (size_t)k];
-			LargeBits proof = prover.GetFullProof(challenge_bytes, i);
+			LargeBits proof = session.GetFullProof(i);
 			proof.ToBytes(proof_data);
 			cout << "Proof: 0x" << HexStr(proof_data, (size_t)k * 8) << endl;
 			delete[] proof_data;
@@ -212,7 +232,12 @@ int cli_create_mad(
 	std::filesystem::path tempdir, 
 	std::filesystem::path tempdir2, 
 	uint32_t num_buckets, 
-	uint8_t num_threads)
+	uint8_t num_threads,
+	bool temp_direct_io,
+	bool temp2_direct_io,
+	uint32_t ram_budget_mb,
+	bool checkpoint,
+	std::string affinity)
 {
 	JobCreatePlotMaxParam param;
 	param.destPath = finaldir.string();
@@ -224,11 +249,35 @@ int cli_create_mad(
 	param.poolContract = pool_contract;
 	param.threads = num_threads;
 	param.buckets = num_buckets;
+	param.tempDirectIO = temp_direct_io;
+	param.temp2DirectIO = temp2_direct_io;
+	param.ramBudget = ram_budget_mb;
+	param.checkpoint = checkpoint;
+	param.affinity = affinity;
+
+	std::shared_ptr<JobCreatePlotMax> job = std::make_shared<JobCreatePlotMax>("cli","cli",param);
+	job->start(true);
+	if(job->activity) {
+		job->activity->waitUntilFinish();
+	}
+	// the final copy runs after the job has finished
+	CopyQueue::getInstance().waitIdle();
+	return 1;
+}
+
+int cli_resume_mad(std::filesystem::path checkpoint_file, uint32_t ram_budget_mb, std::string affinity)
+{
+	JobCreatePlotMaxParam param;
+	param.resumeFile = checkpoint_file.string();
+	param.ramBudget = ram_budget_mb;
+	param.affinity = affinity;
 
 	std::shared_ptr<JobCreatePlotMax> job = std::make_shared<JobCreatePlotMax>("cli","cli",param);
 	job->start(true);
 	if(job->activity) {
 		job->activity->waitUntilFinish();
 	}
+	// the final copy runs after the job has finished
+	CopyQueue::getInstance().waitIdle();
 	return 1;
 }
@@ -20,7 +20,7 @@ int cli_create(
 	uint32_t bufferSz = 4608,
 	bool nobitfield = false
 );
-int cli_check(uint32_t iterations, std::wstring filename);
+int cli_check(uint32_t iterations, std::wstring filename, bool use_mmap = false, uint32_t park_cache_size = 0);
 int cli_verify(std::string id, std::string proof, std::string challenge);
 int cli_proof(std::string challenge, std::wstring filename);
 int cli_create_mad(
@@ -32,7 +32,13 @@ int cli_create_mad(
 	std::filesystem::path tempdir = std::filesystem::path(),
 	std::filesystem::path tempdir2 = std::filesystem::path(), 
 	uint32_t num_buckets = 128,
-	uint8_t num_threads = 2
+	uint8_t num_threads = 2,
+	bool temp_direct_io = false,
+	bool temp2_direct_io = false,
+	uint32_t ram_budget_mb = 0,
+	bool checkpoint = false,
+	std::string affinity = ""
 );
+int cli_resume_mad(std::filesystem::path checkpoint_file, uint32_t ram_budget_mb = 0, std::string affinity = "");
 
 #endif
\ No newline at end of file
@@ -603,3 +603,10 @@ void blake3_hasher_finalize_seek(const blake3_hasher *self, uint64_t seek,
   }
   output_root_bytes(&output, seek, out, out_len);
 }
+
+void blake3_hash_many_short(const uint8_t *const *inputs, size_t num_inputs,
+                            size_t input_len, uint8_t *out) {
+  assert(input_len <= BLAKE3_BLOCK_LEN);
+  blake3_hash_many_block(inputs, num_inputs, (uint8_t)input_len, IV,
+                         CHUNK_START | CHUNK_END | ROOT, out);
+}
@@ -52,6 +52,13 @@ void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
 void blake3_hasher_finalize_seek(const blake3_hasher *self, uint64_t seek,
                                  uint8_t *out, size_t out_len);
 
+// Hashes num_inputs messages of input_len <= BLAKE3_BLOCK_LEN bytes each,
+// using all SIMD lanes, BLAKE3_OUT_LEN bytes per message are written to out.
+// Every input must be readable for BLAKE3_BLOCK_LEN bytes and zero padded
+// after input_len.
+void blake3_hash_many_short(const uint8_t *const *inputs, size_t num_inputs,
+                            size_t input_len, uint8_t *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1130,6 +1130,56 @@ void blake3_hash16_avx512(const uint8_t *const *inputs, size_t blocks,
   _mm256_mask_storeu_epi32(&out[15 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[15]));
 }
 
+// Single block of block_len bytes per input, no counter. Every input must be
+// readable for BLAKE3_BLOCK_LEN bytes and zero padded after block_len.
+void blake3_hash16_block_avx512(const uint8_t *const *inputs,
+                                uint8_t block_len, const uint32_t key[8],
+                                uint8_t flags, uint8_t *out) {
+  __m512i msg_vecs[16];
+  transpose_msg_vecs16(inputs, 0, msg_vecs);
+
+  __m512i v[16] = {
+      set1_512(key[0]), set1_512(key[1]), set1_512(key[2]),    set1_512(key[3]),
+      set1_512(key[4]), set1_512(key[5]), set1_512(key[6]),    set1_512(key[7]),
+      set1_512(IV[0]),  set1_512(IV[1]),  set1_512(IV[2]),     set1_512(IV[3]),
+      set1_512(0),      set1_512(0),      set1_512(block_len), set1_512(flags),
+  };
+  round_fn16(v, msg_vecs, 0);
+  round_fn16(v, msg_vecs, 1);
+  round_fn16(v, msg_vecs, 2);
+  round_fn16(v, msg_vecs, 3);
+  round_fn16(v, msg_vecs, 4);
+  round_fn16(v, msg_vecs, 5);
+  round_fn16(v, msg_vecs, 6);
+
+  // see blake3_hash16_avx512()
+  __m512i padded[16] = {
+      xor_512(v[0], v[8]),  xor_512(v[1], v[9]),
+      xor_512(v[2], v[10]), xor_512(v[3], v[11]),
+      xor_512(v[4], v[12]), xor_512(v[5], v[13]),
+      xor_512(v[6], v[14]), xor_512(v[7], v[15]),
+      set1_512(0), set1_512(0), set1_512(0), set1_512(0),
+      set1_512(0), set1_512(0), set1_512(0), set1_512(0),
+  };
+  transpose_vecs_512(padded);
+  _mm256_mask_storeu_epi32(&out[0 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[0]));
+  _mm256_mask_storeu_epi32(&out[1 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[1]));
+  _mm256_mask_storeu_epi32(&out[2 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[2]));
+  _mm256_mask_storeu_epi32(&out[3 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[3]));
+  _mm256_mask_storeu_epi32(&out[4 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[4]));
+  _mm256_mask_storeu_epi32(&out[5 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[5]));
+  _mm256_mask_storeu_epi32(&out[6 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[6]));
+  _mm256_mask_storeu_epi32(&out[7 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[7]));
+  _mm256_mask_storeu_epi32(&out[8 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[8]));
+  _mm256_mask_storeu_epi32(&out[9 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[9]));
+  _mm256_mask_storeu_epi32(&out[10 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[10]));
+  _mm256_mask_storeu_epi32(&out[11 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[11]));
+  _mm256_mask_storeu_epi32(&out[12 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[12]));
+  _mm256_mask_storeu_epi32(&out[13 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[13]));
+  _mm256_mask_storeu_epi32(&out[14 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[14]));
+  _mm256_mask_storeu_epi32(&out[15 * sizeof(__m256i)], (__mmask8)-1, _mm512_castsi512_si256(padded[15]));
+}
+
 /*
  * ----------------------------------------------------------------------------
  * hash_many_avx512
@@ -1202,3 +1252,24 @@ void blake3_hash_many_avx512(const uint8_t *const *inputs, size_t num_inputs,
     out = &out[BLAKE3_OUT_LEN];
   }
 }
+
+void blake3_hash_many_block_avx512(const uint8_t *const *inputs,
+                                   size_t num_inputs, uint8_t block_len,
+                                   const uint32_t key[8], uint8_t flags,
+                                   uint8_t *out) {
+  while (num_inputs >= 16) {
+    blake3_hash16_block_avx512(inputs, block_len, key, flags, out);
+    inputs += 16;
+    num_inputs -= 16;
+    out = &out[16 * BLAKE3_OUT_LEN];
+  }
+  while (num_inputs > 0) {
+    uint32_t cv[8];
+    memcpy(cv, key, BLAKE3_KEY_LEN);
+    blake3_compress_in_place_avx512(cv, inputs[0], block_len, 0, flags);
+    memcpy(out, cv, BLAKE3_OUT_LEN);
+    inputs += 1;
+    num_inputs -= 1;
+    out = &out[BLAKE3_OUT_LEN];
+  }
+}
@@ -243,6 +243,43 @@ void blake3_hash_many(const uint8_t *const *inputs, size_t num_inputs,
                             out);
 }
 
+void blake3_hash_many_block(const uint8_t *const *inputs, size_t num_inputs,
+                            uint8_t block_len, const uint32_t key[8],
+                            uint8_t flags, uint8_t *out) {
+#if defined(IS_X86)
+  const enum cpu_feature features = get_cpu_features();
+  MAYBE_UNUSED(features);
+#if !defined(BLAKE3_NO_AVX512)
+  if ((features & (AVX512F|AVX512VL)) == (AVX512F|AVX512VL)) {
+    blake3_hash_many_block_avx512(inputs, num_inputs, block_len, key, flags,
+                                  out);
+    return;
+  }
+#endif
+#if !defined(BLAKE3_NO_AVX2)
+  if (features & AVX2) {
+    blake3_hash_many_block_avx2(inputs, num_inputs, block_len, key, flags, out);
+    return;
+  }
+#endif
+#if !defined(BLAKE3_NO_SSE41)
+  if (features & SSE41) {
+    blake3_hash_many_block_sse41(inputs, num_inputs, block_len, key, flags,
+                                 out);
+    return;
+  }
+#endif
+#if !defined(BLAKE3_NO_SSE2)
+  if (features & SSE2) {
+    blake3_hash_many_block_sse2(inputs, num_inputs, block_len, key, flags, out);
+    return;
+  }
+#endif
+#endif
+  blake3_hash_many_block_portable(inputs, num_inputs, block_len, key, flags,
+                                  out);
+}
+
 // The dynamically detected SIMD degree of the current platform.
 size_t blake3_simd_degree(void) {
 #if defined(IS_X86)
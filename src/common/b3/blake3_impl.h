@@ -180,6 +180,11 @@ void blake3_hash_many(const uint8_t *const *inputs, size_t num_inputs,
                       bool increment_counter, uint8_t flags,
                       uint8_t flags_start, uint8_t flags_end, uint8_t *out);
 
+// Hashes num_inputs independent single blocks of block_len bytes each.
+void blake3_hash_many_block(const uint8_t *const *inputs, size_t num_inputs,
+                            uint8_t block_len, const uint32_t key[8],
+                            uint8_t flags, uint8_t *out);
+
 size_t blake3_simd_degree(void);
 
 
@@ -199,6 +204,10 @@ void blake3_hash_many_portable(const uint8_t *const *inputs, size_t num_inputs,
                                uint64_t counter, bool increment_counter,
                                uint8_t flags, uint8_t flags_start,
                                uint8_t flags_end, uint8_t *out);
+void blake3_hash_many_block_portable(const uint8_t *const *inputs,
+                                     size_t num_inputs, uint8_t block_len,
+                                     const uint32_t key[8], uint8_t flags,
+                                     uint8_t *out);
 
 #if defined(IS_X86)
 #if !defined(BLAKE3_NO_SSE2)
@@ -215,6 +224,10 @@ void blake3_hash_many_sse2(const uint8_t *const *inputs, size_t num_inputs,
                            uint64_t counter, bool increment_counter,
                            uint8_t flags, uint8_t flags_start,
                            uint8_t flags_end, uint8_t *out);
+void blake3_hash_many_block_sse2(const uint8_t *const *inputs,
+                                 size_t num_inputs, uint8_t block_len,
+                                 const uint32_t key[8], uint8_t flags,
+                                 uint8_t *out);
 #endif
 #if !defined(BLAKE3_NO_SSE41)
 void blake3_compress_in_place_sse41(uint32_t cv[8],
@@ -230,6 +243,10 @@ void blake3_hash_many_sse41(const uint8_t *const *inputs, size_t num_inputs,
                             uint64_t counter, bool increment_counter,
                             uint8_t flags, uint8_t flags_start,
                             uint8_t flags_end, uint8_t *out);
+void blake3_hash_many_block_sse41(const uint8_t *const *inputs,
+                                  size_t num_inputs, uint8_t block_len,
+                                  const uint32_t key[8], uint8_t flags,
+                                  uint8_t *out);
 #endif
 #if !defined(BLAKE3_NO_AVX2)
 void blake3_hash_many_avx2(const uint8_t *const *inputs, size_t num_inputs,
@@ -237,6 +254,10 @@ void blake3_hash_many_avx2(const uint8_t *const *inputs, size_t num_inputs,
                            uint64_t counter, bool increment_counter,
                            uint8_t flags, uint8_t flags_start,
                            uint8_t flags_end, uint8_t *out);
+void blake3_hash_many_block_avx2(const uint8_t *const *inputs,
+                                 size_t num_inputs, uint8_t block_len,
+                                 const uint32_t key[8], uint8_t flags,
+                                 uint8_t *out);
 #endif
 #if !defined(BLAKE3_NO_AVX512)
 void blake3_compress_in_place_avx512(uint32_t cv[8],
@@ -254,6 +275,10 @@ void blake3_hash_many_avx512(const uint8_t *const *inputs, size_t num_inputs,
                              uint64_t counter, bool increment_counter,
                              uint8_t flags, uint8_t flags_start,
                              uint8_t flags_end, uint8_t *out);
+void blake3_hash_many_block_avx512(const uint8_t *const *inputs,
+                                   size_t num_inputs, uint8_t block_len,
+                                   const uint32_t key[8], uint8_t flags,
+                                   uint8_t *out);
 #endif
 #endif
 
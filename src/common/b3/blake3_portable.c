@@ -158,3 +158,18 @@ void blake3_hash_many_portable(const uint8_t *const *inputs, size_t num_inputs,
     out = &out[BLAKE3_OUT_LEN];
   }
 }
+
+void blake3_hash_many_block_portable(const uint8_t *const *inputs,
+                                     size_t num_inputs, uint8_t block_len,
+                                     const uint32_t key[8], uint8_t flags,
+                                     uint8_t *out) {
+  while (num_inputs > 0) {
+    uint32_t cv[8];
+    memcpy(cv, key, BLAKE3_KEY_LEN);
+    blake3_compress_in_place_portable(cv, inputs[0], block_len, 0, flags);
+    store_cv_words(out, cv);
+    inputs += 1;
+    num_inputs -= 1;
+    out = &out[BLAKE3_OUT_LEN];
+  }
+}
@@ -511,6 +511,44 @@ void blake3_hash4_sse41(const uint8_t *const *inputs, size_t blocks,
   storeu(h_vecs[7], &out[7 * sizeof(__m128i)]);
 }
 
+// Single block of block_len bytes per input, no counter. Every input must be
+// readable for BLAKE3_BLOCK_LEN bytes and zero padded after block_len.
+void blake3_hash4_block_sse41(const uint8_t *const *inputs, uint8_t block_len,
+                           const uint32_t key[8], uint8_t flags, uint8_t *out) {
+  __m128i msg_vecs[16];
+  transpose_msg_vecs(inputs, 0, msg_vecs);
+
+  __m128i v[16] = {
+      set1(key[0]), set1(key[1]), set1(key[2]),    set1(key[3]),
+      set1(key[4]), set1(key[5]), set1(key[6]),    set1(key[7]),
+      set1(IV[0]),  set1(IV[1]),  set1(IV[2]),     set1(IV[3]),
+      set1(0),      set1(0),      set1(block_len), set1(flags),
+  };
+  round_fn(v, msg_vecs, 0);
+  round_fn(v, msg_vecs, 1);
+  round_fn(v, msg_vecs, 2);
+  round_fn(v, msg_vecs, 3);
+  round_fn(v, msg_vecs, 4);
+  round_fn(v, msg_vecs, 5);
+  round_fn(v, msg_vecs, 6);
+  __m128i h_vecs[8] = {
+      xorv(v[0], v[8]),  xorv(v[1], v[9]),  xorv(v[2], v[10]),
+      xorv(v[3], v[11]), xorv(v[4], v[12]), xorv(v[5], v[13]),
+      xorv(v[6], v[14]), xorv(v[7], v[15]),
+  };
+
+  transpose_vecs(&h_vecs[0]);
+  transpose_vecs(&h_vecs[4]);
+  storeu(h_vecs[0], &out[0 * sizeof(__m128i)]);
+  storeu(h_vecs[4], &out[1 * sizeof(__m128i)]);
+  storeu(h_vecs[1], &out[2 * sizeof(__m128i)]);
+  storeu(h_vecs[5], &out[3 * sizeof(__m128i)]);
+  storeu(h_vecs[2], &out[4 * sizeof(__m128i)]);
+  storeu(h_vecs[6], &out[5 * sizeof(__m128i)]);
+  storeu(h_vecs[3], &out[6 * sizeof(__m128i)]);
+  storeu(h_vecs[7], &out[7 * sizeof(__m128i)]);
+}
+
 INLINE void hash_one_sse41(const uint8_t *input, size_t blocks,
                            const uint32_t key[8], uint64_t counter,
                            uint8_t flags, uint8_t flags_start,
@@ -557,3 +595,24 @@ void blake3_hash_many_sse41(const uint8_t *const *inputs, size_t num_inputs,
     out = &out[BLAKE3_OUT_LEN];
   }
 }
+
+void blake3_hash_many_block_sse41(const uint8_t *const *inputs,
+                                  size_t num_inputs, uint8_t block_len,
+                                  const uint32_t key[8], uint8_t flags,
+                                  uint8_t *out) {
+  while (num_inputs >= DEGREE) {
+    blake3_hash4_block_sse41(inputs, block_len, key, flags, out);
+    inputs += DEGREE;
+    num_inputs -= DEGREE;
+    out = &out[DEGREE * BLAKE3_OUT_LEN];
+  }
+  while (num_inputs > 0) {
+    uint32_t cv[8];
+    memcpy(cv, key, BLAKE3_KEY_LEN);
+    blake3_compress_in_place_sse41(cv, inputs[0], block_len, 0, flags);
+    memcpy(out, cv, BLAKE3_OUT_LEN);
+    inputs += 1;
+    num_inputs -= 1;
+    out = &out[BLAKE3_OUT_LEN];
+  }
+}
@@ -0,0 +1,77 @@
+#include "bc_match_impl.h"
+
+uint16_t g_bc_match_targets[2][BC_MATCH_KBC][BC_MATCH_NUM_TARGETS];
+
+static volatile int g_bc_match_initialized = 0;
+
+void bc_match_init(void)
+{
+    if (g_bc_match_initialized) {
+        return;
+    }
+    for (int parity = 0; parity < 2; parity++) {
+        for (int i = 0; i < BC_MATCH_KBC; i++) {
+            const int indJ = i / BC_MATCH_KC;
+            for (int m = 0; m < BC_MATCH_NUM_TARGETS; m++) {
+                const int yr = ((indJ + m) % BC_MATCH_KB) * BC_MATCH_KC +
+                               (((2 * m + parity) * (2 * m + parity) + i) % BC_MATCH_KC);
+                g_bc_match_targets[parity][i][m] = (uint16_t)yr;
+            }
+        }
+    }
+    g_bc_match_initialized = 1;
+}
+
+const uint16_t *bc_match_targets(int parity, uint16_t r)
+{
+    return g_bc_match_targets[parity][r];
+}
+
+static size_t bc_match_probe_portable(
+    const uint32_t *rmap,
+    const uint16_t *L_r,
+    size_t num_L,
+    int parity,
+    uint16_t *idx_L,
+    uint16_t *idx_R,
+    size_t max_matches)
+{
+    size_t count = 0;
+    for (size_t pos_L = 0; pos_L < num_L; pos_L++) {
+        const uint16_t *targets = g_bc_match_targets[parity][L_r[pos_L]];
+        for (int i = 0; i < BC_MATCH_NUM_TARGETS; i++) {
+            const uint32_t entry = rmap[targets[i]];
+            const uint32_t num = entry >> 16;
+            if (!num) {
+                continue;
+            }
+            if (!idx_L) {
+                count += num;
+                continue;
+            }
+            for (uint32_t j = 0; j < num && count < max_matches; j++) {
+                idx_L[count] = (uint16_t)pos_L;
+                idx_R[count] = (uint16_t)((entry & 0xFFFF) + j);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+size_t bc_match_probe(
+    const uint32_t *rmap,
+    const uint16_t *L_r,
+    size_t num_L,
+    int parity,
+    uint16_t *idx_L,
+    uint16_t *idx_R,
+    size_t max_matches)
+{
+#if defined(CPU_FEATURES_X86)
+    if (cpu_get_features() & CPU_AVX2) {
+        return bc_match_probe_avx2(rmap, L_r, num_L, parity, idx_L, idx_R, max_matches);
+    }
+#endif
+    return bc_match_probe_portable(rmap, L_r, num_L, parity, idx_L, idx_R, max_matches);
+}
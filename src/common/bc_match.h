@@ -0,0 +1,47 @@
+#ifndef CHIAPOS_SRC_BC_MATCH_H_
+#define CHIAPOS_SRC_BC_MATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BC_MATCH_KB 119
+#define BC_MATCH_KC 127
+#define BC_MATCH_KBC (BC_MATCH_KB * BC_MATCH_KC)
+#define BC_MATCH_NUM_TARGETS 64
+
+/*
+ * rmap[y % kBC] of the right BC group:
+ * low 16 bits = index of the first entry with this y, high 16 bits = number of entries.
+ */
+#define BC_MATCH_RMAP_ENTRY(pos, count) ((uint32_t)(pos) | ((uint32_t)(count) << 16))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Builds the shared L_targets table, must be called once before bc_match_probe(). */
+void bc_match_init(void);
+
+/* The 64 candidate positions in the right group for left position r. */
+const uint16_t *bc_match_targets(int parity, uint16_t r);
+
+/*
+ * Probes the targets of each left entry L_r[i] (= y % kBC) against rmap.
+ * Writes up to max_matches (left, right) index pairs to idx_L / idx_R and
+ * returns the number written, in the same order as the reference algorithm.
+ * With idx_L == NULL the matches are only counted.
+ */
+size_t bc_match_probe(
+    const uint32_t *rmap,
+    const uint16_t *L_r,
+    size_t num_L,
+    int parity,
+    uint16_t *idx_L,
+    uint16_t *idx_R,
+    size_t max_matches);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CHIAPOS_SRC_BC_MATCH_H_
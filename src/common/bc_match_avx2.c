@@ -0,0 +1,50 @@
+#include "bc_match_impl.h"
+
+#include <immintrin.h>
+
+/*
+ * Eight targets per step: widen to 32-bit indices, gather their rmap entries
+ * and only fall back to scalar code for the (rare) lanes with a match.
+ */
+size_t bc_match_probe_avx2(
+    const uint32_t *rmap,
+    const uint16_t *L_r,
+    size_t num_L,
+    int parity,
+    uint16_t *idx_L,
+    uint16_t *idx_R,
+    size_t max_matches)
+{
+    const __m256i empty = _mm256_set1_epi32(0xFFFF);
+    size_t count = 0;
+
+    for (size_t pos_L = 0; pos_L < num_L; pos_L++) {
+        const uint16_t *targets = g_bc_match_targets[parity][L_r[pos_L]];
+
+        for (int i = 0; i < BC_MATCH_NUM_TARGETS; i += 8) {
+            const __m256i index =
+                _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(targets + i)));
+            const __m256i entry = _mm256_i32gather_epi32((const int *)rmap, index, 4);
+            // count > 0  <=>  entry > 0xFFFF (count never reaches 0x8000)
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(entry, empty)));
+
+            for (int k = 0; mask; ++k, mask >>= 1) {
+                if (!(mask & 1)) {
+                    continue;
+                }
+                const uint32_t e = rmap[targets[i + k]];
+                const uint32_t num = e >> 16;
+                if (!idx_L) {
+                    count += num;
+                    continue;
+                }
+                for (uint32_t j = 0; j < num && count < max_matches; j++) {
+                    idx_L[count] = (uint16_t)pos_L;
+                    idx_R[count] = (uint16_t)((e & 0xFFFF) + j);
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,20 @@
+#ifndef CHIAPOS_SRC_BC_MATCH_IMPL_H_
+#define CHIAPOS_SRC_BC_MATCH_IMPL_H_
+
+#include "bc_match.h"
+#include "cpu_features.h"
+
+extern uint16_t g_bc_match_targets[2][BC_MATCH_KBC][BC_MATCH_NUM_TARGETS];
+
+#if defined(CPU_FEATURES_X86)
+size_t bc_match_probe_avx2(
+    const uint32_t *rmap,
+    const uint16_t *L_r,
+    size_t num_L,
+    int parity,
+    uint16_t *idx_L,
+    uint16_t *idx_R,
+    size_t max_matches);
+#endif
+
+#endif  // CHIAPOS_SRC_BC_MATCH_IMPL_H_
@@ -0,0 +1,73 @@
+#ifndef INCLUDE_CHIA_BC_MATCHER_HPP_
+#define INCLUDE_CHIA_BC_MATCHER_HPP_
+
+#include "bc_match.h"
+
+#include <vector>
+#include <cstdint>
+
+// Matches the entries of two adjacent BC groups, see FxCalculator::FindMatches().
+// Owns its scratch space, so one instance per worker thread avoids any allocation
+// once the largest group has been seen.
+class BCMatcher
+{
+public:
+    BCMatcher()
+        : rmap_(BC_MATCH_KBC)
+    {
+        static const bool initialized = (bc_match_init(), true);
+        (void)initialized;
+    }
+
+    // Disable copying
+    BCMatcher(const BCMatcher&) = delete;
+
+    // Writes up to max_matches index pairs to idx_L / idx_R and returns their number,
+    // with idx_L == nullptr the matches are only counted.
+    template <typename T>
+    size_t find_matches(
+        const T* bucket_L,
+        const size_t num_L,
+        const T* bucket_R,
+        const size_t num_R,
+        uint16_t* idx_L,
+        uint16_t* idx_R,
+        const size_t max_matches)
+    {
+        if (!num_L || !num_R) {
+            return 0;
+        }
+        const int parity = (bucket_L[0].y / BC_MATCH_KBC) % 2;
+
+        const uint64_t offset = (bucket_R[0].y / BC_MATCH_KBC) * BC_MATCH_KBC;
+        for (size_t pos_R = 0; pos_R < num_R; pos_R++) {
+            uint32_t& entry = rmap_[bucket_R[pos_R].y - offset];
+            if (!entry) {
+                entry = BC_MATCH_RMAP_ENTRY(pos_R, 0);
+            }
+            entry += BC_MATCH_RMAP_ENTRY(0, 1);
+        }
+
+        if (L_r_.size() < num_L) {
+            L_r_.resize(num_L);
+        }
+        const uint64_t offset_y = offset - BC_MATCH_KBC;
+        for (size_t pos_L = 0; pos_L < num_L; pos_L++) {
+            L_r_[pos_L] = uint16_t(bucket_L[pos_L].y - offset_y);
+        }
+
+        const size_t count =
+            bc_match_probe(rmap_.data(), L_r_.data(), num_L, parity, idx_L, idx_R, max_matches);
+
+        for (size_t pos_R = 0; pos_R < num_R; pos_R++) {
+            rmap_[bucket_R[pos_R].y - offset] = 0;
+        }
+        return count;
+    }
+
+private:
+    std::vector<uint32_t> rmap_;
+    std::vector<uint16_t> L_r_;
+};
+
+#endif  // INCLUDE_CHIA_BC_MATCHER_HPP_
@@ -0,0 +1,129 @@
+// Copyright 2020 Chia Network Inc
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//    http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "util.hpp"
+
+// Streaming big-endian bit writer, the output is identical to appending the values
+// to a ParkBits and calling ToBytes(), but without the intermediate bit arrays.
+// Bits are collected in a 64-bit accumulator which is stored once it is full, so
+// the hot path is a shift and an or per value.
+// Call flush() to write out the last partial word (zero padded to a full byte).
+struct bit_writer
+{
+    bit_writer(uint8_t* out, size_t num_bytes) : out_(out), end_(out + num_bytes) {}
+
+    // Appends the lowest num_bits of value, num_bits <= 64.
+    void write(uint64_t value, int const num_bits)
+    {
+        if (num_bits <= 0) {
+            return;
+        }
+        value &= ~uint64_t(0) >> (64 - num_bits);
+        int const fill = fill_ + num_bits;
+        if (fill < 64) {
+            acc_ |= value << (64 - fill);
+            fill_ = fill;
+            return;
+        }
+        int const spill = fill - 64;
+        acc_ |= value >> spill;
+        store(8);
+        acc_ = spill ? value << (64 - spill) : 0;
+        fill_ = spill;
+    }
+
+    // Writes out the remaining bits, returns the total number of bytes written.
+    size_t flush()
+    {
+        if (fill_) {
+            store(cdiv(fill_, 8));
+            acc_ = 0;
+            fill_ = 0;
+        }
+        return num_bytes_;
+    }
+
+    // Number of bits written so far, including the ones not yet flushed.
+    uint64_t num_bits() const { return uint64_t(num_bytes_) * 8 + fill_; }
+
+private:
+    void store(size_t const num_bytes)
+    {
+        if (out_ + num_bytes > end_) {
+            throw std::logic_error("bit_writer overflow");
+        }
+        uint64_t const tmp = bswap_64(acc_);
+        memcpy(out_, &tmp, num_bytes);
+        out_ += num_bytes;
+        num_bytes_ += num_bytes;
+    }
+
+    uint8_t* out_;
+    uint8_t* const end_;
+    uint64_t acc_ = 0;
+    int fill_ = 0;  // valid high bits in acc_
+    size_t num_bytes_ = 0;
+};
+
+// Random access reader for bit_writer / ParkBits output.
+// Every read is one unaligned 64-bit load (plus one byte if the value straddles it),
+// reading past the end returns zero bits.
+struct bit_reader
+{
+    bit_reader(uint8_t const* data, size_t num_bytes) : data_(data), num_bytes_(num_bytes) {}
+
+    // Reads the next num_bits as an unsigned integer, num_bits <= 64.
+    uint64_t read(int const num_bits)
+    {
+        if (num_bits <= 0) {
+            return 0;
+        }
+        uint64_t const byte = pos_ / 8;
+        int const shift = pos_ % 8;
+        uint64_t value = (load(byte) << shift) >> (64 - num_bits);
+        int const extra = num_bits + shift - 64;
+        if (extra > 0 && byte + 8 < num_bytes_) {
+            value |= uint64_t(data_[byte + 8]) >> (8 - extra);
+        }
+        pos_ += num_bits;
+        return value;
+    }
+
+    void skip(uint64_t const num_bits) { pos_ += num_bits; }
+
+    void seek(uint64_t const bit) { pos_ = bit; }
+
+    uint64_t position() const { return pos_; }
+
+private:
+    uint64_t load(uint64_t const byte) const
+    {
+        uint64_t tmp = 0;
+        if (byte + 8 <= num_bytes_) {
+            memcpy(&tmp, data_ + byte, 8);
+        } else if (byte < num_bytes_) {
+            memcpy(&tmp, data_ + byte, num_bytes_ - byte);
+        }
+        return bswap_64(tmp);
+    }
+
+    uint8_t const* data_;
+    size_t const num_bytes_;
+    uint64_t pos_ = 0;
+};
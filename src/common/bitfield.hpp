@@ -52,6 +52,9 @@ struct bitfield
 
     int64_t size() const { return size_ * 64; }
 
+    // raw 64-bit words, stays valid across moves of this object
+    std::atomic<uint64_t> const* data() const { return buffer_.get(); }
+
     void swap(bitfield& rhs)
     {
         using std::swap;
@@ -15,49 +15,174 @@
 #pragma once
 
 #include <algorithm>
+#include <thread>
+#include <vector>
 #include "bitfield.hpp"
 
+// rank9 style rank / select index.
+// For every block of kBlockBits bits one 16 byte entry holds the number of set
+// bits before the block, followed by seven 9-bit counts of the set bits before
+// word 1..7 within the block. A rank is one entry plus one bitfield word.
+// For a bitfield of size 2^32, this means a 128 MiB index.
+// The index refers to the bitfield's words, not the bitfield object, so it stays
+// valid when the bitfield is moved, but not once its memory is freed.
 struct bitfield_index
 {
-    // Cache the number of set bits every kIndexBucket bits.
-    // For a bitfield of size 2^32, this means a 32 MiB index
-    static constexpr int64_t kIndexBucket = 1024;
+    static constexpr int64_t kBlockWords = 8;
+    static constexpr int64_t kBlockBits = kBlockWords * 64;
 
-    bitfield_index(bitfield const& b) : bitfield_(b)
+    bitfield_index(bitfield const& b, int num_threads = std::thread::hardware_concurrency())
+        : words_(b.data()), num_words_(b.size() / 64)
     {
-        uint64_t counter = 0;
-        index_.reserve(bitfield_.size() / kIndexBucket);
+        int64_t const num_blocks = (num_words_ + kBlockWords - 1) / kBlockWords;
+
+        // one sentinel entry at the end holds the total count
+        index_.resize(num_blocks + 1);
+
+        num_threads = std::max(std::min<int64_t>(num_threads, num_blocks / 4096), int64_t(1));
+
+        auto const build = [this](int64_t const begin, int64_t const end) {
+            for (int64_t block = begin; block < end; ++block) {
+                uint64_t sum = 0;
+                uint64_t counts = 0;
+                for (int64_t i = 0; i < kBlockWords; ++i) {
+                    if (i > 0) {
+                        counts |= sum << (9 * (i - 1));
+                    }
+                    sum += PopCount(word(block * kBlockWords + i));
+                }
+                index_[block].base = sum;
+                index_[block].counts = counts;
+            }
+        };
+        if (num_threads > 1) {
+            std::vector<std::thread> threads;
+            int64_t const chunk = (num_blocks + num_threads - 1) / num_threads;
+            for (int64_t begin = 0; begin < num_blocks; begin += chunk) {
+                threads.emplace_back(build, begin, std::min(begin + chunk, num_blocks));
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        } else {
+            build(0, num_blocks);
+        }
 
-        for (int64_t idx = 0; idx < int64_t(bitfield_.size()); idx += kIndexBucket) {
-            index_.push_back(counter);
-            int64_t const left = std::min(int64_t(bitfield_.size()) - idx, kIndexBucket);
-            counter += bitfield_.count(idx, idx + left);
+        // convert block sums into prefix counts
+        uint64_t counter = 0;
+        for (auto& entry : index_) {
+            uint64_t const sum = entry.base;
+            entry.base = counter;
+            counter += sum;
         }
     }
 
-    std::pair<uint64_t, uint64_t> lookup(uint64_t pos, uint64_t offset) const
+    // number of set bits before pos
+    uint64_t rank(uint64_t pos) const
     {
-        uint64_t const bucket = pos / kIndexBucket;
+        assert(pos <= uint64_t(num_words_) * 64);
 
-        assert(bucket < index_.size());
-        assert(pos < uint64_t(bitfield_.size()));
-        assert(pos + offset < uint64_t(bitfield_.size()));
-        assert(bitfield_.get(pos) && bitfield_.get(pos + offset));
+        entry_t const& entry = index_[pos / kBlockBits];
+        uint64_t const i = (pos / 64) % kBlockWords;
+        uint64_t ret = entry.base;
+        if (i > 0) {
+            ret += (entry.counts >> (9 * (i - 1))) & 0x1FF;
+        }
+        int const tail = pos % 64;
+        if (tail > 0) {
+            ret += PopCount(word(pos / 64) & ((uint64_t(1) << tail) - 1));
+        }
+        return ret;
+    }
 
-        uint64_t const base = index_[bucket];
+    // total number of set bits
+    uint64_t count() const { return index_.back().base; }
 
-        int64_t const aligned_pos = pos & ~uint64_t(63);
+    // position of the set bit with the given rank (0 based)
+    uint64_t select(uint64_t rank) const
+    {
+        assert(rank < count());
+
+        // last block which starts with at most rank set bits before it
+        auto const iter = std::upper_bound(
+            index_.begin(), index_.end(), rank,
+            [](uint64_t value, entry_t const& entry) { return value < entry.base; });
+        int64_t const block = (iter - index_.begin()) - 1;
+
+        entry_t const& entry = index_[block];
+        rank -= entry.base;
+
+        int64_t i = kBlockWords - 1;
+        for (; i > 0; --i) {
+            uint64_t const before = (entry.counts >> (9 * (i - 1))) & 0x1FF;
+            if (before <= rank) {
+                rank -= before;
+                break;
+            }
+        }
+        int64_t const word_index = block * kBlockWords + i;
+        uint64_t w = word(word_index);
+        for (; rank > 0; --rank) {
+            w &= w - 1;
+        }
+        return word_index * 64 + CountTrailingZeros(w);
+    }
 
-        uint64_t const aligned_pos_count = bitfield_.count(bucket * kIndexBucket, aligned_pos);
-        uint64_t const offset_count = aligned_pos_count + bitfield_.count(aligned_pos, pos + offset);
-        uint64_t const pos_count = aligned_pos_count + bitfield_.count(aligned_pos, pos);
+    // position of the first set bit at or after pos, or size() if there is none
+    uint64_t find_next(uint64_t pos) const
+    {
+        int64_t word_index = pos / 64;
+        if (word_index >= num_words_) {
+            return num_words_ * 64;
+        }
+        uint64_t w = word(word_index) & (~uint64_t(0) << (pos % 64));
+        while (w == 0) {
+            if (++word_index == num_words_) {
+                return num_words_ * 64;
+            }
+            w = word(word_index);
+        }
+        return word_index * 64 + CountTrailingZeros(w);
+    }
+
+    std::pair<uint64_t, uint64_t> lookup(uint64_t pos, uint64_t offset) const
+    {
+        assert(pos < uint64_t(num_words_) * 64);
+        assert(pos + offset < uint64_t(num_words_) * 64);
+
+        uint64_t const pos_count = rank(pos);
+        uint64_t const offset_count = rank(pos + offset);
 
         assert(offset_count >= pos_count);
 
-        return { base + pos_count, offset_count - pos_count };
+        return { pos_count, offset_count - pos_count };
     }
+
 private:
-    bitfield const& bitfield_;
-    std::vector<uint64_t> index_;
-};
+    struct alignas(16) entry_t
+    {
+        uint64_t base = 0;
+        uint64_t counts = 0;
+    };
 
+    uint64_t word(int64_t const index) const
+    {
+        return index < num_words_ ? words_[index].load(std::memory_order_relaxed) : 0;
+    }
+
+    static int CountTrailingZeros(uint64_t const w)
+    {
+        assert(w != 0);
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, w);
+        return int(index);
+#else
+        return __builtin_ctzll(w);
+#endif
+    }
+
+    std::atomic<uint64_t> const* words_;
+    int64_t num_words_;
+    std::vector<entry_t> index_;
+};
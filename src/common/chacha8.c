@@ -1,4 +1,6 @@
 #include "chacha8.h"
+#include "chacha8_impl.h"
+#include "cpu_features.h"
 
 #include <string.h>
 #if defined(_MSC_VER)
@@ -93,7 +95,7 @@ typedef struct {
     x.o += j.o; \
     x.p += j.p
 
-void chacha8_get_keystream(
+static void chacha8_get_keystream_portable(
     const struct chacha8_ctx *ctx,
     uint64_t pos,
     uint64_t n_blocks,
@@ -139,7 +141,7 @@ _BLOCK_LOOP:
     c = PLUS(c, d);              \
     b = ROTATE(XOR(b, c), 7)
 
-void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n_blocks, uint8_t *c)
+static void chacha8_get_keystream_portable(const struct chacha8_ctx *x, uint64_t pos, uint64_t n_blocks, uint8_t *c)
 {
     uint32_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
     uint32_t j0, j1, j2, j3, j4, j5, j6, j7, j8, j9, j10, j11, j12, j13, j14, j15;
@@ -233,4 +235,34 @@ void chacha8_get_keystream(const struct chacha8_ctx *x, uint64_t pos, uint32_t n
     }
 }
 
-#endif
\ No newline at end of file
+#endif
+
+/*
+ * Generates n_blocks consecutive keystream blocks starting at block pos.
+ * The bulk is computed several blocks at a time with the widest SIMD kernel
+ * available, the remainder with the portable implementation.
+ */
+void chacha8_get_keystream(
+    const struct chacha8_ctx *x,
+    uint64_t pos,
+    uint64_t n_blocks,
+    uint8_t *c)
+{
+#if defined(CHACHA8_X86)
+    const int features = cpu_get_features();
+    uint64_t done = 0;
+    if (features & CPU_AVX512F) {
+        done = chacha8_get_keystream_avx512(x, pos, n_blocks, c);
+    } else if (features & CPU_AVX2) {
+        done = chacha8_get_keystream_avx2(x, pos, n_blocks, c);
+    } else if (features & CPU_SSE2) {
+        done = chacha8_get_keystream_sse2(x, pos, n_blocks, c);
+    }
+    pos += done;
+    n_blocks -= done;
+    c += done * 64;
+#endif
+    if (n_blocks) {
+        chacha8_get_keystream_portable(x, pos, n_blocks, c);
+    }
+}
@@ -0,0 +1,121 @@
+#include "chacha8_impl.h"
+
+#include <immintrin.h>
+
+#define DEGREE 8
+
+CHACHA8_INLINE __m256i set1(uint32_t x) { return _mm256_set1_epi32((int32_t)x); }
+
+CHACHA8_INLINE __m256i rot16(__m256i x)
+{
+    return _mm256_shuffle_epi8(
+        x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                           13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+
+CHACHA8_INLINE __m256i rot12(__m256i x)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, 12), _mm256_srli_epi32(x, 32 - 12));
+}
+
+CHACHA8_INLINE __m256i rot8(__m256i x)
+{
+    return _mm256_shuffle_epi8(
+        x, _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                           14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3));
+}
+
+CHACHA8_INLINE __m256i rot7(__m256i x)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(x, 7), _mm256_srli_epi32(x, 32 - 7));
+}
+
+#define QROUND(a, b, c, d)                                      \
+    a = _mm256_add_epi32(a, b); d = rot16(_mm256_xor_si256(d, a)); \
+    c = _mm256_add_epi32(c, d); b = rot12(_mm256_xor_si256(b, c)); \
+    a = _mm256_add_epi32(a, b); d = rot8(_mm256_xor_si256(d, a));  \
+    c = _mm256_add_epi32(c, d); b = rot7(_mm256_xor_si256(b, c))
+
+CHACHA8_INLINE void transpose_vecs(__m256i vecs[8])
+{
+    // Interleave 32-bit lanes, then 64-bit lanes, then 128-bit lanes.
+    __m256i ab_0145 = _mm256_unpacklo_epi32(vecs[0], vecs[1]);
+    __m256i ab_2367 = _mm256_unpackhi_epi32(vecs[0], vecs[1]);
+    __m256i cd_0145 = _mm256_unpacklo_epi32(vecs[2], vecs[3]);
+    __m256i cd_2367 = _mm256_unpackhi_epi32(vecs[2], vecs[3]);
+    __m256i ef_0145 = _mm256_unpacklo_epi32(vecs[4], vecs[5]);
+    __m256i ef_2367 = _mm256_unpackhi_epi32(vecs[4], vecs[5]);
+    __m256i gh_0145 = _mm256_unpacklo_epi32(vecs[6], vecs[7]);
+    __m256i gh_2367 = _mm256_unpackhi_epi32(vecs[6], vecs[7]);
+
+    __m256i abcd_04 = _mm256_unpacklo_epi64(ab_0145, cd_0145);
+    __m256i abcd_15 = _mm256_unpackhi_epi64(ab_0145, cd_0145);
+    __m256i abcd_26 = _mm256_unpacklo_epi64(ab_2367, cd_2367);
+    __m256i abcd_37 = _mm256_unpackhi_epi64(ab_2367, cd_2367);
+    __m256i efgh_04 = _mm256_unpacklo_epi64(ef_0145, gh_0145);
+    __m256i efgh_15 = _mm256_unpackhi_epi64(ef_0145, gh_0145);
+    __m256i efgh_26 = _mm256_unpacklo_epi64(ef_2367, gh_2367);
+    __m256i efgh_37 = _mm256_unpackhi_epi64(ef_2367, gh_2367);
+
+    vecs[0] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x20);
+    vecs[1] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x20);
+    vecs[2] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x20);
+    vecs[3] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x20);
+    vecs[4] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x31);
+    vecs[5] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x31);
+    vecs[6] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x31);
+    vecs[7] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x31);
+}
+
+uint64_t chacha8_get_keystream_avx2(
+    const struct chacha8_ctx *x,
+    uint64_t pos,
+    uint64_t n_blocks,
+    uint8_t *c)
+{
+    uint64_t done = 0;
+    for (; n_blocks - done >= DEGREE; done += DEGREE) {
+        __m256i j[16];
+        __m256i v[16];
+        uint32_t lo[DEGREE], hi[DEGREE];
+        int i;
+
+        for (i = 0; i < DEGREE; ++i) {
+            const uint64_t p = pos + done + i;
+            lo[i] = (uint32_t)p;
+            hi[i] = (uint32_t)(p >> 32);
+        }
+        for (i = 0; i < 16; ++i) {
+            j[i] = set1(x->input[i]);
+        }
+        j[12] = _mm256_loadu_si256((const __m256i *)lo);
+        j[13] = _mm256_loadu_si256((const __m256i *)hi);
+
+        for (i = 0; i < 16; ++i) {
+            v[i] = j[i];
+        }
+        for (i = 0; i < 4; ++i) {
+            QROUND(v[0], v[4], v[8], v[12]);
+            QROUND(v[1], v[5], v[9], v[13]);
+            QROUND(v[2], v[6], v[10], v[14]);
+            QROUND(v[3], v[7], v[11], v[15]);
+            QROUND(v[0], v[5], v[10], v[15]);
+            QROUND(v[1], v[6], v[11], v[12]);
+            QROUND(v[2], v[7], v[8], v[13]);
+            QROUND(v[3], v[4], v[9], v[14]);
+        }
+        for (i = 0; i < 16; ++i) {
+            v[i] = _mm256_add_epi32(v[i], j[i]);
+        }
+        transpose_vecs(&v[0]);
+        transpose_vecs(&v[8]);
+
+        // v[b] = words [0, 8) and v[8 + b] = words [8, 16) of block b
+        for (i = 0; i < DEGREE; ++i) {
+            uint8_t *out = c + (done + i) * 64;
+            _mm256_storeu_si256((__m256i *)(out + 0), v[i]);
+            _mm256_storeu_si256((__m256i *)(out + 32), v[8 + i]);
+        }
+    }
+    return done;
+}
@@ -0,0 +1,139 @@
+#include "chacha8_impl.h"
+
+#include <immintrin.h>
+
+#define DEGREE 16
+
+CHACHA8_INLINE __m512i set1(uint32_t x) { return _mm512_set1_epi32((int32_t)x); }
+
+#define QROUND(a, b, c, d)                                                 \
+    a = _mm512_add_epi32(a, b); d = _mm512_rol_epi32(_mm512_xor_si512(d, a), 16); \
+    c = _mm512_add_epi32(c, d); b = _mm512_rol_epi32(_mm512_xor_si512(b, c), 12); \
+    a = _mm512_add_epi32(a, b); d = _mm512_rol_epi32(_mm512_xor_si512(d, a), 8);  \
+    c = _mm512_add_epi32(c, d); b = _mm512_rol_epi32(_mm512_xor_si512(b, c), 7)
+
+// lanes a0/a2/b0/b2 and a1/a3/b1/b3
+#define unpack_lo_128(a, b) _mm512_shuffle_i32x4(a, b, 0x88)
+#define unpack_hi_128(a, b) _mm512_shuffle_i32x4(a, b, 0xdd)
+
+CHACHA8_INLINE void transpose_vecs(__m512i vecs[16])
+{
+    // Interleave 32-bit lanes, then 64-bit lanes, then 128-bit lanes twice.
+    __m512i ab_0 = _mm512_unpacklo_epi32(vecs[0], vecs[1]);
+    __m512i ab_2 = _mm512_unpackhi_epi32(vecs[0], vecs[1]);
+    __m512i cd_0 = _mm512_unpacklo_epi32(vecs[2], vecs[3]);
+    __m512i cd_2 = _mm512_unpackhi_epi32(vecs[2], vecs[3]);
+    __m512i ef_0 = _mm512_unpacklo_epi32(vecs[4], vecs[5]);
+    __m512i ef_2 = _mm512_unpackhi_epi32(vecs[4], vecs[5]);
+    __m512i gh_0 = _mm512_unpacklo_epi32(vecs[6], vecs[7]);
+    __m512i gh_2 = _mm512_unpackhi_epi32(vecs[6], vecs[7]);
+    __m512i ij_0 = _mm512_unpacklo_epi32(vecs[8], vecs[9]);
+    __m512i ij_2 = _mm512_unpackhi_epi32(vecs[8], vecs[9]);
+    __m512i kl_0 = _mm512_unpacklo_epi32(vecs[10], vecs[11]);
+    __m512i kl_2 = _mm512_unpackhi_epi32(vecs[10], vecs[11]);
+    __m512i mn_0 = _mm512_unpacklo_epi32(vecs[12], vecs[13]);
+    __m512i mn_2 = _mm512_unpackhi_epi32(vecs[12], vecs[13]);
+    __m512i op_0 = _mm512_unpacklo_epi32(vecs[14], vecs[15]);
+    __m512i op_2 = _mm512_unpackhi_epi32(vecs[14], vecs[15]);
+
+    __m512i abcd_0 = _mm512_unpacklo_epi64(ab_0, cd_0);
+    __m512i abcd_1 = _mm512_unpackhi_epi64(ab_0, cd_0);
+    __m512i abcd_2 = _mm512_unpacklo_epi64(ab_2, cd_2);
+    __m512i abcd_3 = _mm512_unpackhi_epi64(ab_2, cd_2);
+    __m512i efgh_0 = _mm512_unpacklo_epi64(ef_0, gh_0);
+    __m512i efgh_1 = _mm512_unpackhi_epi64(ef_0, gh_0);
+    __m512i efgh_2 = _mm512_unpacklo_epi64(ef_2, gh_2);
+    __m512i efgh_3 = _mm512_unpackhi_epi64(ef_2, gh_2);
+    __m512i ijkl_0 = _mm512_unpacklo_epi64(ij_0, kl_0);
+    __m512i ijkl_1 = _mm512_unpackhi_epi64(ij_0, kl_0);
+    __m512i ijkl_2 = _mm512_unpacklo_epi64(ij_2, kl_2);
+    __m512i ijkl_3 = _mm512_unpackhi_epi64(ij_2, kl_2);
+    __m512i mnop_0 = _mm512_unpacklo_epi64(mn_0, op_0);
+    __m512i mnop_1 = _mm512_unpackhi_epi64(mn_0, op_0);
+    __m512i mnop_2 = _mm512_unpacklo_epi64(mn_2, op_2);
+    __m512i mnop_3 = _mm512_unpackhi_epi64(mn_2, op_2);
+
+    __m512i abcdefgh_0 = unpack_lo_128(abcd_0, efgh_0);
+    __m512i abcdefgh_1 = unpack_lo_128(abcd_1, efgh_1);
+    __m512i abcdefgh_2 = unpack_lo_128(abcd_2, efgh_2);
+    __m512i abcdefgh_3 = unpack_lo_128(abcd_3, efgh_3);
+    __m512i abcdefgh_4 = unpack_hi_128(abcd_0, efgh_0);
+    __m512i abcdefgh_5 = unpack_hi_128(abcd_1, efgh_1);
+    __m512i abcdefgh_6 = unpack_hi_128(abcd_2, efgh_2);
+    __m512i abcdefgh_7 = unpack_hi_128(abcd_3, efgh_3);
+    __m512i ijklmnop_0 = unpack_lo_128(ijkl_0, mnop_0);
+    __m512i ijklmnop_1 = unpack_lo_128(ijkl_1, mnop_1);
+    __m512i ijklmnop_2 = unpack_lo_128(ijkl_2, mnop_2);
+    __m512i ijklmnop_3 = unpack_lo_128(ijkl_3, mnop_3);
+    __m512i ijklmnop_4 = unpack_hi_128(ijkl_0, mnop_0);
+    __m512i ijklmnop_5 = unpack_hi_128(ijkl_1, mnop_1);
+    __m512i ijklmnop_6 = unpack_hi_128(ijkl_2, mnop_2);
+    __m512i ijklmnop_7 = unpack_hi_128(ijkl_3, mnop_3);
+
+    vecs[0] = unpack_lo_128(abcdefgh_0, ijklmnop_0);
+    vecs[1] = unpack_lo_128(abcdefgh_1, ijklmnop_1);
+    vecs[2] = unpack_lo_128(abcdefgh_2, ijklmnop_2);
+    vecs[3] = unpack_lo_128(abcdefgh_3, ijklmnop_3);
+    vecs[4] = unpack_lo_128(abcdefgh_4, ijklmnop_4);
+    vecs[5] = unpack_lo_128(abcdefgh_5, ijklmnop_5);
+    vecs[6] = unpack_lo_128(abcdefgh_6, ijklmnop_6);
+    vecs[7] = unpack_lo_128(abcdefgh_7, ijklmnop_7);
+    vecs[8] = unpack_hi_128(abcdefgh_0, ijklmnop_0);
+    vecs[9] = unpack_hi_128(abcdefgh_1, ijklmnop_1);
+    vecs[10] = unpack_hi_128(abcdefgh_2, ijklmnop_2);
+    vecs[11] = unpack_hi_128(abcdefgh_3, ijklmnop_3);
+    vecs[12] = unpack_hi_128(abcdefgh_4, ijklmnop_4);
+    vecs[13] = unpack_hi_128(abcdefgh_5, ijklmnop_5);
+    vecs[14] = unpack_hi_128(abcdefgh_6, ijklmnop_6);
+    vecs[15] = unpack_hi_128(abcdefgh_7, ijklmnop_7);
+}
+
+uint64_t chacha8_get_keystream_avx512(
+    const struct chacha8_ctx *x,
+    uint64_t pos,
+    uint64_t n_blocks,
+    uint8_t *c)
+{
+    uint64_t done = 0;
+    for (; n_blocks - done >= DEGREE; done += DEGREE) {
+        __m512i j[16];
+        __m512i v[16];
+        uint32_t lo[DEGREE], hi[DEGREE];
+        int i;
+
+        for (i = 0; i < DEGREE; ++i) {
+            const uint64_t p = pos + done + i;
+            lo[i] = (uint32_t)p;
+            hi[i] = (uint32_t)(p >> 32);
+        }
+        for (i = 0; i < 16; ++i) {
+            j[i] = set1(x->input[i]);
+        }
+        j[12] = _mm512_loadu_si512((const void *)lo);
+        j[13] = _mm512_loadu_si512((const void *)hi);
+
+        for (i = 0; i < 16; ++i) {
+            v[i] = j[i];
+        }
+        for (i = 0; i < 4; ++i) {
+            QROUND(v[0], v[4], v[8], v[12]);
+            QROUND(v[1], v[5], v[9], v[13]);
+            QROUND(v[2], v[6], v[10], v[14]);
+            QROUND(v[3], v[7], v[11], v[15]);
+            QROUND(v[0], v[5], v[10], v[15]);
+            QROUND(v[1], v[6], v[11], v[12]);
+            QROUND(v[2], v[7], v[8], v[13]);
+            QROUND(v[3], v[4], v[9], v[14]);
+        }
+        for (i = 0; i < 16; ++i) {
+            v[i] = _mm512_add_epi32(v[i], j[i]);
+        }
+        transpose_vecs(v);
+
+        // v[b] = block b
+        for (i = 0; i < DEGREE; ++i) {
+            _mm512_storeu_si512((void *)(c + (done + i) * 64), v[i]);
+        }
+    }
+    return done;
+}
@@ -0,0 +1,33 @@
+#ifndef CHIAPOS_SRC_CHACHA8_IMPL_H_
+#define CHIAPOS_SRC_CHACHA8_IMPL_H_
+
+#include "chacha8.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CHACHA8_X86
+#endif
+
+#if defined(_MSC_VER)
+#define CHACHA8_INLINE static __forceinline
+#else
+#define CHACHA8_INLINE static inline __attribute__((always_inline))
+#endif
+
+/*
+ * Multi-block kernels, each one computes DEGREE keystream blocks at once
+ * and returns the number of blocks written (a multiple of DEGREE),
+ * the remainder is left to the caller.
+ */
+#if defined(CHACHA8_X86)
+uint64_t chacha8_get_keystream_sse2(
+    const struct chacha8_ctx *x, uint64_t pos, uint64_t n_blocks, uint8_t *c);
+uint64_t chacha8_get_keystream_avx2(
+    const struct chacha8_ctx *x, uint64_t pos, uint64_t n_blocks, uint8_t *c);
+uint64_t chacha8_get_keystream_avx512(
+    const struct chacha8_ctx *x, uint64_t pos, uint64_t n_blocks, uint8_t *c);
+#endif
+
+#endif  // CHIAPOS_SRC_CHACHA8_IMPL_H_
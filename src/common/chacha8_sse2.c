@@ -0,0 +1,85 @@
+#include "chacha8_impl.h"
+
+#include <immintrin.h>
+
+#define DEGREE 4
+
+CHACHA8_INLINE __m128i set1(uint32_t x) { return _mm_set1_epi32((int32_t)x); }
+
+#define ROTL(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+#define QROUND(a, b, c, d)                                \
+    a = _mm_add_epi32(a, b); d = ROTL(_mm_xor_si128(d, a), 16); \
+    c = _mm_add_epi32(c, d); b = ROTL(_mm_xor_si128(b, c), 12); \
+    a = _mm_add_epi32(a, b); d = ROTL(_mm_xor_si128(d, a), 8);  \
+    c = _mm_add_epi32(c, d); b = ROTL(_mm_xor_si128(b, c), 7)
+
+CHACHA8_INLINE void transpose_vecs(__m128i vecs[4])
+{
+    __m128i ab_01 = _mm_unpacklo_epi32(vecs[0], vecs[1]);
+    __m128i ab_23 = _mm_unpackhi_epi32(vecs[0], vecs[1]);
+    __m128i cd_01 = _mm_unpacklo_epi32(vecs[2], vecs[3]);
+    __m128i cd_23 = _mm_unpackhi_epi32(vecs[2], vecs[3]);
+
+    vecs[0] = _mm_unpacklo_epi64(ab_01, cd_01);
+    vecs[1] = _mm_unpackhi_epi64(ab_01, cd_01);
+    vecs[2] = _mm_unpacklo_epi64(ab_23, cd_23);
+    vecs[3] = _mm_unpackhi_epi64(ab_23, cd_23);
+}
+
+uint64_t chacha8_get_keystream_sse2(
+    const struct chacha8_ctx *x,
+    uint64_t pos,
+    uint64_t n_blocks,
+    uint8_t *c)
+{
+    uint64_t done = 0;
+    for (; n_blocks - done >= DEGREE; done += DEGREE) {
+        __m128i j[16];
+        __m128i v[16];
+        uint32_t lo[DEGREE], hi[DEGREE];
+        int i;
+
+        for (i = 0; i < DEGREE; ++i) {
+            const uint64_t p = pos + done + i;
+            lo[i] = (uint32_t)p;
+            hi[i] = (uint32_t)(p >> 32);
+        }
+        for (i = 0; i < 16; ++i) {
+            j[i] = set1(x->input[i]);
+        }
+        j[12] = _mm_loadu_si128((const __m128i *)lo);
+        j[13] = _mm_loadu_si128((const __m128i *)hi);
+
+        for (i = 0; i < 16; ++i) {
+            v[i] = j[i];
+        }
+        for (i = 0; i < 4; ++i) {
+            QROUND(v[0], v[4], v[8], v[12]);
+            QROUND(v[1], v[5], v[9], v[13]);
+            QROUND(v[2], v[6], v[10], v[14]);
+            QROUND(v[3], v[7], v[11], v[15]);
+            QROUND(v[0], v[5], v[10], v[15]);
+            QROUND(v[1], v[6], v[11], v[12]);
+            QROUND(v[2], v[7], v[8], v[13]);
+            QROUND(v[3], v[4], v[9], v[14]);
+        }
+        for (i = 0; i < 16; ++i) {
+            v[i] = _mm_add_epi32(v[i], j[i]);
+        }
+        transpose_vecs(&v[0]);
+        transpose_vecs(&v[4]);
+        transpose_vecs(&v[8]);
+        transpose_vecs(&v[12]);
+
+        // v[4 * w + b] = words [4 * w, 4 * w + 4) of block b
+        for (i = 0; i < DEGREE; ++i) {
+            uint8_t *out = c + (done + i) * 64;
+            _mm_storeu_si128((__m128i *)(out + 0), v[i]);
+            _mm_storeu_si128((__m128i *)(out + 16), v[4 + i]);
+            _mm_storeu_si128((__m128i *)(out + 32), v[8 + i]);
+            _mm_storeu_si128((__m128i *)(out + 48), v[12 + i]);
+        }
+    }
+    return done;
+}
@@ -0,0 +1,70 @@
+#include "cpu_features.h"
+
+#include <stdint.h>
+
+#if defined(CPU_FEATURES_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#define CPU_UNDEFINED (1 << 30)
+
+static volatile int g_cpu_features = CPU_UNDEFINED;
+
+static uint64_t cpu_xgetbv(void)
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax = 0, edx = 0;
+    __asm__ __volatile__("xgetbv\n" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static void cpu_cpuidex(uint32_t out[4], uint32_t id, uint32_t sid)
+{
+#if defined(_MSC_VER)
+    __cpuidex((int *)out, id, sid);
+#else
+    __cpuid_count(id, sid, out[0], out[1], out[2], out[3]);
+#endif
+}
+
+int cpu_get_features(void)
+{
+    int features = g_cpu_features;
+    if (features != CPU_UNDEFINED) {
+        return features;
+    }
+    uint32_t regs[4] = {0};
+    features = 0;
+    cpu_cpuidex(regs, 0, 0);
+    const uint32_t max_id = regs[0];
+    cpu_cpuidex(regs, 1, 0);
+    if (regs[3] & (1UL << 26)) {
+        features |= CPU_SSE2;
+    }
+    if (regs[2] & (1UL << 27)) {  // OSXSAVE
+        const uint64_t mask = cpu_xgetbv();
+        if ((mask & 6) == 6 && max_id >= 7) {  // SSE and AVX states
+            cpu_cpuidex(regs, 7, 0);
+            if (regs[1] & (1UL << 5)) {
+                features |= CPU_AVX2;
+            }
+            if ((mask & 224) == 224 && (regs[1] & (1UL << 16))) {  // Opmask, ZMM_Hi256, Hi16_Zmm
+                features |= CPU_AVX512F;
+            }
+        }
+    }
+    g_cpu_features = features;
+    return features;
+}
+
+#else
+
+int cpu_get_features(void) { return 0; }
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef CHIAPOS_SRC_CPU_FEATURES_H_
+#define CHIAPOS_SRC_CPU_FEATURES_H_
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_FEATURES_X86
+#endif
+
+enum cpu_feature_flags {
+    CPU_SSE2 = 1 << 0,
+    CPU_AVX2 = 1 << 1,
+    CPU_AVX512F = 1 << 2
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instruction set extensions usable by SIMD kernels, detected once via cpuid/xgetbv. */
+int cpu_get_features(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CHIAPOS_SRC_CPU_FEATURES_H_
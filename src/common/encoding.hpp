@@ -15,9 +15,11 @@
 #ifndef COMMON_SRC_CPP_ENCODING_HPP_
 #define COMMON_SRC_CPP_ENCODING_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <map>
 #include <queue>
+#include <span>
 #include <string>
 #include <utility>
 #include <vector>
@@ -32,61 +34,112 @@
 
 #include <mutex>
 
+// FSE encode / decode tables per R value.
+// Each table is built once (on first use, or up front with Prepare()) and never changes
+// afterwards, so lookups are a lock-free scan over a handful of entries and the tables can
+// be shared by any number of threads. Encode and decode tables are built separately, a
+// plotter only ever needs the first and a prover the second.
 class TMemoCache {
 public:
-    ~TMemoCache() 
+    TMemoCache() = default;
+
+    TMemoCache(const TMemoCache&) = delete;
+    TMemoCache& operator=(const TMemoCache&) = delete;
+
+    ~TMemoCache()
     {
-        // Clean up global entries on destruction
-        std::map<double, FSE_CTable *>::iterator itc;
-        for (itc = CT_MEMO.begin(); itc != CT_MEMO.end(); itc++) {
-            FSE_freeCTable(itc->second);
-        }
-        std::map<double, FSE_DTable *>::iterator itd;
-        for (itd = DT_MEMO.begin(); itd != DT_MEMO.end(); itd++) {
-            FSE_freeDTable(itd->second);
+        const size_t num_entries = num_entries_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < num_entries; i++) {
+            FSE_freeCTable(entries_[i].ct.load(std::memory_order_relaxed));
+            FSE_freeDTable(entries_[i].dt.load(std::memory_order_relaxed));
         }
     }
 
-    bool CTExists(double R)
-    {
-        std::lock_guard<std::mutex> l(memoMutex);
-        return (CT_MEMO.find(R) != CT_MEMO.end());
-    }
+    enum class Tables { kEncode, kDecode };
 
-    bool DTExists(double R)
+    // Builds the tables of one kind for R[0..n-1], so that later lookups never have to.
+    void Prepare(const double* R, size_t n, Tables tables)
     {
-        std::lock_guard<std::mutex> l(memoMutex);
-        return (DT_MEMO.find(R) != DT_MEMO.end());
-    }   
-
-    void CTAssign(double R, FSE_CTable *ct)
-    {
-        std::lock_guard<std::mutex> l(memoMutex);
-        CT_MEMO[R] = ct;
+        for (size_t i = 0; i < n; i++) {
+            if (tables == Tables::kEncode) {
+                CTGet(R[i]);
+            } else {
+                DTGet(R[i]);
+            }
+        }
     }
 
-    void DTAssign(double R, FSE_DTable *dt)
+    const FSE_CTable* CTGet(double R)
     {
-        std::lock_guard<std::mutex> l(memoMutex);
-        DT_MEMO[R] = dt;
+        Entry& entry = Get(R);
+        FSE_CTable* ct = entry.ct.load(std::memory_order_acquire);
+        if (ct == nullptr) {
+            std::lock_guard<std::mutex> l(memoMutex);
+            ct = entry.ct.load(std::memory_order_relaxed);
+            if (ct == nullptr) {
+                ct = BuildCTable(R);
+                entry.ct.store(ct, std::memory_order_release);
+            }
+        }
+        return ct;
     }
 
-    FSE_CTable *CTGet(double R)
+    const FSE_DTable* DTGet(double R)
     {
-        std::lock_guard<std::mutex> l(memoMutex);
-        return CT_MEMO[R];
+        Entry& entry = Get(R);
+        FSE_DTable* dt = entry.dt.load(std::memory_order_acquire);
+        if (dt == nullptr) {
+            std::lock_guard<std::mutex> l(memoMutex);
+            dt = entry.dt.load(std::memory_order_relaxed);
+            if (dt == nullptr) {
+                dt = BuildDTable(R);
+                entry.dt.store(dt, std::memory_order_release);
+            }
+        }
+        return dt;
     }
 
-    FSE_DTable *DTGet(double R)
+private:
+    struct Entry {
+        double R = 0;
+        std::atomic<FSE_CTable*> ct{nullptr};
+        std::atomic<FSE_DTable*> dt{nullptr};
+    };
+
+    static constexpr size_t kMaxEntries = 16;
+    static constexpr size_t kTableLog = 14;
+
+    // The entry of R, added without tables if there is none yet
+    Entry& Get(double R)
     {
+        size_t num_entries = num_entries_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < num_entries; i++) {
+            if (entries_[i].R == R) {
+                return entries_[i];
+            }
+        }
         std::lock_guard<std::mutex> l(memoMutex);
-        return DT_MEMO[R];
+        num_entries = num_entries_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < num_entries; i++) {
+            if (entries_[i].R == R) {
+                return entries_[i];
+            }
+        }
+        if (num_entries >= kMaxEntries) {
+            throw InvalidStateException("Too many ANS R values");
+        }
+        entries_[num_entries].R = R;
+        num_entries_.store(num_entries + 1, std::memory_order_release);
+        return entries_[num_entries];
     }
 
-private:
-    mutable std::mutex memoMutex; // Mutex to ensure map thread safety
-    std::map<double, FSE_CTable *> CT_MEMO;
-    std::map<double, FSE_DTable *> DT_MEMO;
+    static std::vector<short> NormalizedCount(double R);
+    static FSE_CTable* BuildCTable(double R);
+    static FSE_DTable* BuildDTable(double R);
+
+    Entry entries_[kMaxEntries];
+    std::atomic<size_t> num_entries_{0};   // R of the entries below is immutable
+    std::mutex memoMutex;                  // only taken to add an entry or a table
 };
 
 class Encoding {
@@ -177,26 +230,25 @@ public:
         return ans;
     }
 
-    static size_t ANSEncodeDeltas(TMemoCache& tmCache, std::vector<unsigned char> deltas, double R, uint8_t *out)
+    // Compresses deltas into out[0..out_size-1], returns 0 if they don't fit.
+    static size_t ANSEncodeDeltas(
+        TMemoCache& tmCache,
+        std::span<const uint8_t> deltas,
+        double R,
+        uint8_t* out,
+        size_t out_size)
     {
-        if (!tmCache.CTExists(R)) {
-            std::vector<short> nCount = Encoding::CreateNormalizedCount(R);
-            size_t maxSymbolValue = nCount.size() - 1;
-            size_t tableLog = 14;
-
-            if (maxSymbolValue > 255)
-                throw std::invalid_argument("maxSymbolValue > 255");
-            FSE_CTable *ct = FSE_createCTable(maxSymbolValue, tableLog);
-            size_t err = FSE_buildCTable(ct, nCount.data(), maxSymbolValue, tableLog);
-            if (FSE_isError(err)) {
-                throw InvalidStateException(FSE_getErrorName(err));
-            }
-            tmCache.CTAssign(R, ct);
+        const size_t num_bytes =
+            FSE_compress_usingCTable(out, out_size, deltas.data(), deltas.size(), tmCache.CTGet(R));
+        if (FSE_isError(num_bytes)) {
+            throw InvalidStateException(FSE_getErrorName(num_bytes));
         }
+        return num_bytes;
+    }
 
-        FSE_CTable *ct = tmCache.CTGet(R);
-        return FSE_compress_usingCTable(
-            out, deltas.size() * 8, static_cast<void *>(deltas.data()), deltas.size(), ct);
+    static size_t ANSEncodeDeltas(TMemoCache& tmCache, std::span<const uint8_t> deltas, double R, uint8_t *out)
+    {
+        return ANSEncodeDeltas(tmCache, deltas, R, out, deltas.size() * 8);
     }
 
     static void ANSFree(double R)
@@ -204,42 +256,75 @@ public:
         // Cache all entries, only free on close
     }
 
-    static std::vector<uint8_t> ANSDecodeDeltas(
-		TMemoCache& tmCache,
+    // Decodes up to out.size() deltas into out, the rest of out is zeroed (a short last park).
+    static void ANSDecodeDeltas(
+        TMemoCache& tmCache,
         const uint8_t *inp,
         size_t inp_size,
-        int numDeltas,
+        std::span<uint8_t> out,
         double R)
     {
-        if (!tmCache.DTExists(R)) {
-            std::vector<short> nCount = Encoding::CreateNormalizedCount(R);
-            size_t maxSymbolValue = nCount.size() - 1;
-            size_t tableLog = 14;
-
-            FSE_DTable *dt = FSE_createDTable(tableLog);
-            size_t err = FSE_buildDTable(dt, nCount.data(), maxSymbolValue, tableLog);
-            if (FSE_isError(err)) {
-                throw InvalidStateException(FSE_getErrorName(err));
-            }
-            tmCache.DTAssign(R, dt);
-        }
-
-        FSE_DTable *dt = tmCache.DTGet(R);
-
-        std::vector<uint8_t> deltas(numDeltas);
-        size_t err = FSE_decompress_usingDTable(&deltas[0], numDeltas, inp, inp_size, dt);
+        size_t err = FSE_decompress_usingDTable(out.data(), out.size(), inp, inp_size, tmCache.DTGet(R));
 
         if (FSE_isError(err)) {
             throw InvalidStateException(FSE_getErrorName(err));
         }
+        std::fill(out.begin() + std::min(err, out.size()), out.end(), 0);
 
-        for (uint32_t i = 0; i < deltas.size(); i++) {
-            if (deltas[i] == 0xff) {
+        for (uint8_t delta : out) {
+            if (delta == 0xff) {
                 throw InvalidStateException("Bad delta detected");
             }
         }
+    }
+
+    static std::vector<uint8_t> ANSDecodeDeltas(
+		TMemoCache& tmCache,
+        const uint8_t *inp,
+        size_t inp_size,
+        int numDeltas,
+        double R)
+    {
+        std::vector<uint8_t> deltas(numDeltas);
+        ANSDecodeDeltas(tmCache, inp, inp_size, deltas, R);
         return deltas;
     }
 };
 
+inline std::vector<short> TMemoCache::NormalizedCount(double R)
+{
+    std::vector<short> nCount = Encoding::CreateNormalizedCount(R);
+    if (nCount.size() - 1 > 255)
+        throw std::invalid_argument("maxSymbolValue > 255");
+    return nCount;
+}
+
+inline FSE_CTable* TMemoCache::BuildCTable(double R)
+{
+    std::vector<short> nCount = NormalizedCount(R);
+    size_t maxSymbolValue = nCount.size() - 1;
+
+    FSE_CTable* ct = FSE_createCTable(maxSymbolValue, kTableLog);
+    size_t err = FSE_buildCTable(ct, nCount.data(), maxSymbolValue, kTableLog);
+    if (FSE_isError(err)) {
+        FSE_freeCTable(ct);
+        throw InvalidStateException(FSE_getErrorName(err));
+    }
+    return ct;
+}
+
+inline FSE_DTable* TMemoCache::BuildDTable(double R)
+{
+    std::vector<short> nCount = NormalizedCount(R);
+    size_t maxSymbolValue = nCount.size() - 1;
+
+    FSE_DTable* dt = FSE_createDTable(kTableLog);
+    size_t err = FSE_buildDTable(dt, nCount.data(), maxSymbolValue, kTableLog);
+    if (FSE_isError(err)) {
+        FSE_freeDTable(dt);
+        throw InvalidStateException(FSE_getErrorName(err));
+    }
+    return dt;
+}
+
 #endif  // SRC_CPP_ENCODING_HPP_
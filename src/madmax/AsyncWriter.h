@@ -0,0 +1,404 @@
+/*
+ * AsyncWriter.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_ASYNCWRITER_H_
+#define INCLUDE_CHIA_ASYNCWRITER_H_
+
+#include "settings.h"
+#include "util.hpp"
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mad {
+
+class AsyncFile;
+
+/*
+ * Pool of I/O threads doing positional writes of aligned buffers.
+ * Buffers of the default size are recycled, submit() blocks once g_write_queue_depth
+ * buffers are in flight, which throttles producers to the speed of the disk.
+ * Besides the buffers in flight and max_pending pooled ones, memory use is one
+ * staging buffer per open AsyncFile.
+ */
+class AsyncWriter {
+public:
+	struct request_t {
+		AsyncFile* file = nullptr;
+		uint64_t offset = 0;
+		uint8_t* buffer = nullptr;
+		size_t buffer_size = 0;
+		size_t num_bytes = 0;
+	};
+
+	AsyncWriter(const int num_threads, const size_t buffer_size, const size_t max_pending)
+		:	buffer_size(buffer_size), max_pending(max_pending)
+	{
+		if(num_threads < 1) {
+			throw std::logic_error("num_threads < 1");
+		}
+		for(int i = 0; i < num_threads; ++i) {
+			threads.emplace_back(&AsyncWriter::loop, this);
+		}
+	}
+
+	~AsyncWriter() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			do_run = false;
+		}
+		signal.notify_all();
+		for(auto& thread : threads) {
+			thread.join();
+		}
+		for(auto buffer : free_list) {
+			free_aligned(buffer);
+		}
+	}
+
+	AsyncWriter(AsyncWriter&) = delete;
+	AsyncWriter& operator=(AsyncWriter&) = delete;
+
+	static AsyncWriter& get_instance() {
+		static AsyncWriter instance(g_write_threads, g_write_buffer_size, g_write_queue_depth);
+		return instance;
+	}
+
+	size_t get_buffer_size() const {
+		return buffer_size;
+	}
+
+	// returns a buffer of num_bytes, aligned to g_write_alignment [thread-safe]
+	uint8_t* alloc_buffer(const size_t num_bytes) {
+		if(num_bytes == buffer_size) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if(!free_list.empty()) {
+				auto buffer = free_list.back();
+				free_list.pop_back();
+				return buffer;
+			}
+		}
+		return alloc_aligned(num_bytes);
+	}
+
+	// num_bytes as passed to alloc_buffer() [thread-safe]
+	void free_buffer(uint8_t* buffer, const size_t num_bytes) {
+		if(!buffer) {
+			return;
+		}
+		if(num_bytes != buffer_size) {
+			free_aligned(buffer);
+			return;
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		if(free_list.size() < max_pending) {
+			free_list.push_back(buffer);
+		} else {
+			lock.unlock();
+			free_aligned(buffer);
+		}
+	}
+
+	// takes ownership of request.buffer, blocks while the queue is full [thread-safe]
+	void submit(const request_t& request) {
+		std::unique_lock<std::mutex> lock(mutex);
+		while(do_run && num_pending >= max_pending) {
+			signal_done.wait(lock);
+		}
+		num_pending++;
+		queue.push_back(request);
+		lock.unlock();
+		signal.notify_one();
+	}
+
+	static uint8_t* alloc_aligned(const size_t num_bytes) {
+#ifdef _WIN32
+		auto buffer = (uint8_t*)_aligned_malloc(num_bytes, g_write_alignment);
+#else
+		void* buffer = nullptr;
+		if(posix_memalign(&buffer, g_write_alignment, num_bytes)) {
+			buffer = nullptr;
+		}
+#endif
+		if(!buffer) {
+			throw std::bad_alloc();
+		}
+		return (uint8_t*)buffer;
+	}
+
+	static void free_aligned(uint8_t* buffer) {
+#ifdef _WIN32
+		_aligned_free(buffer);
+#else
+		free(buffer);
+#endif
+	}
+
+private:
+	void loop();
+
+private:
+	const size_t buffer_size;
+	const size_t max_pending;
+
+	bool do_run = true;
+	size_t num_pending = 0;
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::condition_variable signal_done;
+	std::deque<request_t> queue;
+	std::vector<uint8_t*> free_list;
+	std::vector<std::thread> threads;
+
+};
+
+/*
+ * Append-only file written through AsyncWriter, staged in buffers of buffer_size bytes
+ * (0 = AsyncWriter::get_buffer_size(), must be a multiple of g_write_alignment).
+ * With direct_io the page cache is bypassed (O_DIRECT / FILE_FLAG_NO_BUFFERING),
+ * the tail is padded to g_write_alignment and truncated again in close().
+ */
+class AsyncFile {
+public:
+	AsyncFile(const std::wstring& file_name, const bool direct_io = false, const size_t buffer_size = 0,
+			  AsyncWriter* writer = &AsyncWriter::get_instance())
+		:	direct_io(direct_io), writer(writer),
+			buffer_size(buffer_size ? buffer_size : writer->get_buffer_size())
+	{
+		if(this->buffer_size % g_write_alignment) {
+			throw std::logic_error("buffer_size % g_write_alignment != 0");
+		}
+#ifdef _WIN32
+		handle = CreateFileW(file_name.c_str(), GENERIC_WRITE,
+				FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS,
+				FILE_ATTRIBUTE_NORMAL | (direct_io ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+		if(handle == INVALID_HANDLE_VALUE) {
+			throw std::runtime_error("CreateFile() failed");
+		}
+#else
+		int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+		if(direct_io) {
+			flags |= O_DIRECT;
+		}
+#endif
+		fd = ::open(ws2s(file_name).c_str(), flags, 0644);
+		if(fd < 0) {
+			throw std::runtime_error("open() failed");
+		}
+#endif
+	}
+
+	~AsyncFile() {
+		try {
+			close();
+		} catch(...) {
+			// ignore
+		}
+	}
+
+	AsyncFile(AsyncFile&) = delete;
+	AsyncFile& operator=(AsyncFile&) = delete;
+
+	// thread-safe
+	void write(const void* data, size_t num_bytes) {
+		auto src = (const uint8_t*)data;
+		std::lock_guard<std::mutex> lock(mutex);
+		check_error();
+		if(!is_open) {
+			throw std::logic_error("file closed");
+		}
+		while(num_bytes) {
+			if(!buffer) {
+				buffer = writer->alloc_buffer(buffer_size);
+				buffer_fill = 0;
+			}
+			const size_t count = std::min(num_bytes, buffer_size - buffer_fill);
+			memcpy(buffer + buffer_fill, src, count);
+			buffer_fill += count;
+			src += count;
+			num_bytes -= count;
+			if(buffer_fill == buffer_size) {
+				submit_buffer(buffer_size);
+			}
+		}
+	}
+
+	// total bytes written so far [thread-safe]
+	uint64_t get_size() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return offset + buffer_fill;
+	}
+
+	// writes out the tail, waits for all pending writes and closes the file [thread-safe]
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!is_open) {
+			return;
+		}
+		is_open = false;
+		const uint64_t file_size = offset + buffer_fill;
+		if(buffer_fill) {
+			size_t num_bytes = buffer_fill;
+			if(direct_io) {
+				num_bytes = cdiv(num_bytes, int(g_write_alignment)) * g_write_alignment;
+				memset(buffer + buffer_fill, 0, num_bytes - buffer_fill);
+			}
+			submit_buffer(num_bytes);
+		} else if(buffer) {
+			writer->free_buffer(buffer, buffer_size);
+			buffer = nullptr;
+		}
+		std::unique_lock<std::mutex> done_lock(done_mutex);
+		while(num_pending) {
+			signal.wait(done_lock);
+		}
+		const bool is_padded = direct_io && (file_size % g_write_alignment);
+#ifdef _WIN32
+		if(is_padded) {
+			FILE_END_OF_FILE_INFO info = {};
+			info.EndOfFile.QuadPart = file_size;
+			if(!SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info))) {
+				error = "SetFileInformationByHandle() failed";
+			}
+		}
+		CloseHandle(handle);
+		handle = INVALID_HANDLE_VALUE;
+#else
+		if(is_padded) {
+			if(::ftruncate(fd, file_size)) {
+				error = "ftruncate() failed";
+			}
+		}
+		::close(fd);
+		fd = -1;
+#endif
+		if(!error.empty()) {
+			throw std::runtime_error(error);
+		}
+	}
+
+	// called by AsyncWriter threads
+	void write_at(const uint64_t offset, const uint8_t* data, const size_t num_bytes) {
+		std::string what;
+#ifdef _WIN32
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = DWORD(offset);
+		overlapped.OffsetHigh = DWORD(offset >> 32);
+		DWORD num_written = 0;
+		if(!WriteFile(handle, data, DWORD(num_bytes), &num_written, &overlapped)
+			|| num_written != num_bytes)
+		{
+			what = "WriteFile() failed";
+		}
+#else
+		size_t total = 0;
+		while(total < num_bytes) {
+			const auto ret = ::pwrite(fd, data + total, num_bytes - total, offset + total);
+			if(ret <= 0) {
+				what = "pwrite() failed";
+				break;
+			}
+			total += ret;
+		}
+#endif
+		std::lock_guard<std::mutex> lock(done_mutex);
+		if(!what.empty() && error.empty()) {
+			error = what;
+		}
+		num_pending--;
+		signal.notify_all();
+	}
+
+private:
+	// mutex must be locked
+	void submit_buffer(const size_t num_bytes) {
+		AsyncWriter::request_t request;
+		request.file = this;
+		request.offset = offset;
+		request.buffer = buffer;
+		request.buffer_size = buffer_size;
+		request.num_bytes = num_bytes;
+		{
+			std::lock_guard<std::mutex> lock(done_mutex);
+			num_pending++;
+		}
+		offset += buffer_fill;
+		buffer = nullptr;
+		buffer_fill = 0;
+		writer->submit(request);
+	}
+
+	void check_error() const {
+		std::lock_guard<std::mutex> lock(done_mutex);
+		if(!error.empty()) {
+			throw std::runtime_error(error);
+		}
+	}
+
+private:
+	const bool direct_io = false;
+	AsyncWriter* const writer = nullptr;
+	const size_t buffer_size = 0;
+
+#ifdef _WIN32
+	HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+	int fd = -1;
+#endif
+	bool is_open = true;
+	uint64_t offset = 0;			// file offset of buffer[0]
+	uint8_t* buffer = nullptr;
+	size_t buffer_fill = 0;
+	mutable std::mutex mutex;
+
+	// completion state, shared with the AsyncWriter threads
+	size_t num_pending = 0;
+	std::string error;
+	mutable std::mutex done_mutex;
+	std::condition_variable signal;
+
+};
+
+inline
+void AsyncWriter::loop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true) {
+		while(do_run && queue.empty()) {
+			signal.wait(lock);
+		}
+		if(queue.empty()) {
+			break;
+		}
+		const auto request = queue.front();
+		queue.pop_front();
+		lock.unlock();
+
+		request.file->write_at(request.offset, request.buffer, request.num_bytes);
+		free_buffer(request.buffer, request.buffer_size);
+
+		lock.lock();
+		num_pending--;
+		signal_done.notify_all();
+	}
+}
+
+} // mad
+
+#endif /* INCLUDE_CHIA_ASYNCWRITER_H_ */
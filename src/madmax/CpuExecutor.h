@@ -0,0 +1,159 @@
+/*
+ * CpuExecutor.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_CPUEXECUTOR_H_
+#define INCLUDE_CHIA_CPUEXECUTOR_H_
+
+#include <set>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <condition_variable>
+
+namespace mad {
+
+/*
+ * Limits how many CPU-bound work items run at once over all jobs, so concurrent jobs
+ * do not oversubscribe the cores. Every job has a share with a weight, when items of
+ * several jobs are waiting the free slot goes to the job with the least running items
+ * per weight. A job in an I/O-bound phase submits few items and leaves its slots to the
+ * others. Only ThreadPools created with cpu_bound = true take slots, their workers must
+ * not block on other pools while holding one.
+ */
+class CpuExecutor {
+public:
+	struct share_t {
+		int weight = 1;
+		int num_running = 0;		// protected by CpuExecutor::mutex
+		int num_waiting = 0;		// protected by CpuExecutor::mutex
+	};
+
+	// RAII slot, does nothing without a share or if this thread already holds a slot
+	class slot_t {
+	public:
+		explicit slot_t(share_t* share) {
+			if(share && !holds_slot()) {
+				get_instance().acquire(share);
+				this->share = share;
+				holds_slot() = true;
+			}
+		}
+		~slot_t() {
+			if(share) {
+				holds_slot() = false;
+				get_instance().release(share);
+			}
+		}
+		slot_t(slot_t&) = delete;
+		slot_t& operator=(slot_t&) = delete;
+	private:
+		share_t* share = nullptr;
+	};
+
+	static CpuExecutor& get_instance() {
+		static CpuExecutor instance;
+		return instance;
+	}
+
+	// 0 = one per hardware thread [thread-safe]
+	void set_num_slots(const int count) {
+		std::lock_guard<std::mutex> lock(mutex);
+		num_slots = count > 0 ? count : std::max<int>(std::thread::hardware_concurrency(), 1);
+		signal.notify_all();
+	}
+
+	int get_num_slots() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return num_slots;
+	}
+
+	// one per job, weight < 1 counts as 1 [thread-safe]
+	std::shared_ptr<share_t> create_share(const int weight) {
+		auto share = new share_t();
+		share->weight = std::max(weight, 1);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			shares.insert(share);
+		}
+		return std::shared_ptr<share_t>(share, [this](share_t* share) {
+			std::lock_guard<std::mutex> lock(mutex);
+			shares.erase(share);
+			delete share;
+			signal.notify_all();
+		});
+	}
+
+	// the share of the current thread's job, set by the job thread and inherited by Thread / ThreadPool
+	static void set_thread(std::shared_ptr<share_t> share) {
+		thread_share() = share;
+	}
+
+	static std::shared_ptr<share_t> get_thread() {
+		return thread_share();
+	}
+
+	// blocks until share may run one more item [thread-safe]
+	void acquire(share_t* share) {
+		std::unique_lock<std::mutex> lock(mutex);
+		share->num_waiting++;
+		while(num_running >= num_slots || !is_next(share)) {
+			signal.wait(lock);
+		}
+		share->num_waiting--;
+		share->num_running++;
+		num_running++;
+		signal.notify_all();	// the order of the other waiting shares changed
+	}
+
+	// [thread-safe]
+	void release(share_t* share) {
+		std::lock_guard<std::mutex> lock(mutex);
+		share->num_running--;
+		num_running--;
+		signal.notify_all();
+	}
+
+private:
+	CpuExecutor() {
+		num_slots = std::max<int>(std::thread::hardware_concurrency(), 1);
+	}
+
+	// mutex must be locked, true if no other waiting share has less running items per weight
+	bool is_next(const share_t* share) const {
+		for(const auto other : shares) {
+			if(other != share && other->num_waiting > 0
+				&& int64_t(other->num_running) * share->weight < int64_t(share->num_running) * other->weight)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static std::shared_ptr<share_t>& thread_share() {
+		thread_local std::shared_ptr<share_t> share;
+		return share;
+	}
+
+	static bool& holds_slot() {
+		thread_local bool value = false;
+		return value;
+	}
+
+private:
+	mutable std::mutex mutex;
+	std::condition_variable signal;
+	std::set<share_t*> shares;
+	int num_slots = 1;
+	int num_running = 0;
+
+};
+
+} // mad
+
+#endif /* INCLUDE_CHIA_CPUEXECUTOR_H_ */
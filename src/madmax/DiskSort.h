@@ -10,30 +10,147 @@
 
 #include "buffer.h"
 #include "ThreadPool.h"
+#include "AsyncWriter.h"
 
 #include <vector>
 #include <string>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 #include <cstdio>
 #include <cstddef>
+#include <cstring>
 #include <memory>
 #include <functional>
 
 namespace mad {
+	// Little-endian bit packer for a single bucket file record (max 56 bytes).
+	struct record_writer_t {
+		uint8_t buf[64] = {};
+		size_t bit = 0;
+	
+		void write(uint64_t value, int num_bits) {
+			while(num_bits > 0) {
+				const int count = std::min(num_bits, 56);
+				const uint64_t part = value & ((uint64_t(1) << count) - 1);
+				uint64_t tmp;
+				memcpy(&tmp, buf + bit / 8, 8);
+				tmp |= part << (bit % 8);
+				memcpy(buf + bit / 8, &tmp, 8);
+				bit += count;
+				value >>= count;
+				num_bits -= count;
+			}
+		}
+	};
+
+	struct record_reader_t {
+		uint8_t buf[64] = {};
+		size_t bit = 0;
+	
+		record_reader_t(const uint8_t* record, const size_t num_bytes) {
+			memcpy(buf, record, num_bytes);
+		}
+		uint64_t read(int num_bits) {
+			uint64_t value = 0;
+			int shift = 0;
+			while(num_bits > 0) {
+				const int count = std::min(num_bits, 56);
+				uint64_t tmp;
+				memcpy(&tmp, buf + bit / 8, 8);
+				value |= ((tmp >> (bit % 8)) & ((uint64_t(1) << count) - 1)) << shift;
+				bit += count;
+				shift += count;
+				num_bits -= count;
+			}
+			return value;
+		}
+	};
+
+	/*
+	 * Bucket file encoding for entries of type T sorted by Key.
+	 * The default stores T::write() as is. A specialization with is_packed = true
+	 * only stores the key bits not implied by the bucket index, followed by
+	 * num_bits of other fields written by write() and restored by read().
+	 */
+	template<typename T, typename Key>
+	struct bucket_codec {
+		static constexpr bool is_packed = false;
+	};
+
+	// RAM allowance shared by DiskSort instances for keeping buckets in memory [thread-safe]
+	class ram_budget_t {
+	public:
+		explicit ram_budget_t(const uint64_t limit) : limit(limit) {}
+	
+		bool try_acquire(const uint64_t num_bytes) {
+			uint64_t prev = used.load(std::memory_order_relaxed);
+			do {
+				if(prev + num_bytes > limit) {
+					return false;
+				}
+			} while(!used.compare_exchange_weak(prev, prev + num_bytes, std::memory_order_relaxed));
+			return true;
+		}
+	
+		void release(const uint64_t num_bytes) {
+			used.fetch_sub(num_bytes, std::memory_order_relaxed);
+		}
+	
+		uint64_t get_limit() const {
+			return limit;
+		}
+	
+		uint64_t get_used() const {
+			return used.load(std::memory_order_relaxed);
+		}
+	
+	private:
+		const uint64_t limit;
+		std::atomic<uint64_t> used {0};
+	};
+
 	template<typename T, typename Key>
 	class DiskSort {
 	private:
+		/*
+		 * Entries go to RAM while ram_budget allows, the rest to the bucket file.
+		 * The file is only created once something overflows.
+		 */
 		struct bucket_t {
-			FILE* file = nullptr;
+			FILE* file = nullptr;						// for reading
+			std::unique_ptr<AsyncFile> writer;			// for writing
+			std::vector<std::vector<uint8_t>> ram;		// in-memory records, as written
 			std::mutex mutex;
 			std::wstring file_name;
-			size_t num_entries = 0;
+			size_t num_entries = 0;						// valid after close()
+			size_t num_ram_entries = 0;
+			size_t num_file_entries = 0;
+			size_t ram_bytes = 0;
+			size_t record_size = 0;
+			size_t write_buffer_size = 0;				// staging buffer of writer
+			bool direct_io = false;
+			ram_budget_t* ram_budget = nullptr;
 		
+			~bucket_t();
 			void open(const wchar_t* mode);
 			void write(const void* data, size_t count);
 			void close();
 			void remove();
 		};
 	
+		// per-thread arena used by read_bucket(), re-used for every bucket
+		struct read_local_t {
+			std::vector<uint8_t> data;		// raw bucket file content
+			std::vector<size_t> counts;
+		};
+	
+		// per-thread scratch for the block radix sort
+		struct sort_local_t {
+			std::vector<T> entries;
+			std::vector<size_t> counts;
+		};
+	
 	public:
 		DiskPlotterContext* context;
 		class WriteCache {
@@ -45,12 +162,13 @@ namespace mad {
 		private:
 			DiskSort* disk = nullptr;
 			const int key_shift = 0;
-			std::vector<write_buffer_t<T>> buckets;
+			std::vector<record_buffer_t> buckets;
 		};
 	
 		DiskSort(	int key_size, int log_num_buckets,
 					std::wstring file_prefix, bool read_only = false,
-					DiskPlotterContext* context = nullptr);
+					DiskPlotterContext* context = nullptr, bool direct_io = false,
+					std::shared_ptr<ram_budget_t> ram_budget = nullptr);
 	
 		~DiskSort() {
 			close();
@@ -77,23 +195,65 @@ namespace mad {
 			return buckets.size();
 		}
 	
+		// bytes per entry in the bucket files
+		size_t get_record_size() const {
+			return record_size;
+		}
+	
+		// total number of entries, valid after finish()
+		uint64_t get_num_entries() const {
+			uint64_t total = 0;
+			for(const auto& bucket : buckets) {
+				total += bucket.num_entries;
+			}
+			return total;
+		}
+	
 		void set_keep_files(bool enable) {
 			keep_files = enable;
 		}
 	
+		int get_key_size() const {
+			return key_size;
+		}
+	
+		const std::wstring& get_file_prefix() const {
+			return file_prefix;
+		}
+	
+		static std::wstring get_bucket_file_name(const std::wstring& file_prefix, size_t index) {
+			return file_prefix + L".sort_bucket_" + std::to_wstring(index) + L".tmp";
+		}
+	
+		// deletes the bucket files of a sort which is no longer open
+		static void remove_files(const std::wstring& file_prefix, int log_num_buckets) {
+			for(size_t i = 0; i < (size_t(1) << log_num_buckets); ++i) {
+				_wremove(get_bucket_file_name(file_prefix, i).c_str());
+			}
+		}
+	
 	private:
 	void read_bucket(	std::pair<size_t, size_t>& index,
 						std::vector<std::pair<std::vector<T>, size_t>>& out,
-							read_buffer_t<T>& buffer);
+						read_local_t& local);
+	
+		void encode(const T& entry, uint8_t* record) const;
+		void decode(T& entry, const uint8_t* record, const size_t bucket) const;
+	
+		// LSD radix sort on the lowest key_bits of Key
+		static void sort_block(std::vector<T>& block, const int key_bits, sort_local_t& local);
 	
 	private:
 		const int key_size = 0;
 		const int log_num_buckets = 0;
 		const int bucket_key_shift = 0;
+		const size_t record_size = 0;
+		const std::wstring file_prefix;
 	
 		bool keep_files = false;
 		bool is_finished = false;
 	
+		std::shared_ptr<ram_budget_t> ram_budget;
 		WriteCache cache;
 		std::vector<bucket_t> buckets;
 	
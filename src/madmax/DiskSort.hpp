@@ -11,12 +11,29 @@
 #include "DiskSort.h"
 #include "util.hpp"
 
-#include <map>
 #include <algorithm>
-#include <unordered_map>
 
 namespace mad {
 
+	// bytes per bucket file entry, key_bits = key bits not implied by the bucket index
+	template<typename T, typename Key>
+	size_t get_bucket_record_size(const int key_bits)
+	{
+		if constexpr(bucket_codec<T, Key>::is_packed) {
+			return cdiv(size_t(key_bits) + bucket_codec<T, Key>::num_bits, 8);
+		} else {
+			return T::disk_size;
+		}
+	}
+
+	template<typename T, typename Key>
+	DiskSort<T, Key>::bucket_t::~bucket_t()
+	{
+		if(ram_budget) {
+			ram_budget->release(ram_bytes);
+		}
+	}
+
 	template<typename T, typename Key>
 	void DiskSort<T, Key>::bucket_t::open(const wchar_t* mode)
 	{
@@ -32,18 +49,35 @@ namespace mad {
 	template<typename T, typename Key>
 	void DiskSort<T, Key>::bucket_t::write(const void* data, size_t count)
 	{
-		std::lock_guard<std::mutex> lock(mutex);
-		if(file) {
-			if(fwrite(data, T::disk_size, count, file) != count) {
-				throw std::runtime_error("fwrite() failed");
+		const size_t num_bytes = count * record_size;
+		if(ram_budget && ram_budget->try_acquire(num_bytes)) {
+			std::vector<uint8_t> chunk((const uint8_t*)data, (const uint8_t*)data + num_bytes);
+			std::lock_guard<std::mutex> lock(mutex);
+			ram.push_back(std::move(chunk));
+			ram_bytes += num_bytes;
+			num_ram_entries += count;
+			return;
+		}
+		AsyncFile* out = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(!writer) {
+				writer = std::make_unique<AsyncFile>(file_name, direct_io, write_buffer_size);
 			}
-			num_entries += count;
+			out = writer.get();
 		}
+		out->write(data, num_bytes);
 	}
 
 	template<typename T, typename Key>
 	void DiskSort<T, Key>::bucket_t::close()
 	{
+		if(writer) {
+			writer->close();
+			num_file_entries = writer->get_size() / record_size;
+			writer = nullptr;
+		}
+		num_entries = num_ram_entries + num_file_entries;
 		if(file) {
 			fclose(file);
 			file = nullptr;
@@ -54,12 +88,20 @@ namespace mad {
 	void DiskSort<T, Key>::bucket_t::remove()
 	{
 		close();
-		_wremove(file_name.c_str());
+		if(ram_budget) {
+			ram_budget->release(ram_bytes);
+		}
+		std::vector<std::vector<uint8_t>>().swap(ram);
+		ram_bytes = 0;
+		if(num_file_entries) {
+			_wremove(file_name.c_str());
+		}
 	}
 
 	template<typename T, typename Key>
 	DiskSort<T, Key>::WriteCache::WriteCache(DiskSort* disk, int key_shift, int num_buckets)
-		:	disk(disk), key_shift(key_shift), buckets(num_buckets)
+		:	disk(disk), key_shift(key_shift),
+			buckets(num_buckets, record_buffer_t(g_write_chunk_size, disk->record_size))
 	{
 	}
 
@@ -72,10 +114,10 @@ namespace mad {
 		}
 		auto& buffer = buckets[index];
 		if(buffer.count >= buffer.capacity) {
-			disk->write(index, buffer.data, buffer.count);
+			disk->write(index, buffer.data.data(), buffer.count);
 			buffer.count = 0;
 		}
-		entry.write(buffer.entry_at(buffer.count));
+		disk->encode(entry, buffer.entry_at(buffer.count));
 		buffer.count++;
 	}
 
@@ -85,7 +127,7 @@ namespace mad {
 		for(size_t index = 0; index < buckets.size(); ++index) {
 			auto& buffer = buckets[index];
 			if(buffer.count) {
-				disk->write(index, buffer.data, buffer.count);
+				disk->write(index, buffer.data.data(), buffer.count);
 				buffer.count = 0;
 			}
 		}
@@ -94,23 +136,42 @@ namespace mad {
 	template<typename T, typename Key>
 	DiskSort<T, Key>::DiskSort(	int key_size, int log_num_buckets,
 								std::wstring file_prefix, bool read_only, 
-								DiskPlotterContext* context)
+								DiskPlotterContext* context, bool direct_io,
+								std::shared_ptr<ram_budget_t> ram_budget)
 		:	key_size(key_size),
 			log_num_buckets(log_num_buckets),
 			bucket_key_shift(key_size - log_num_buckets),
+			record_size(get_bucket_record_size<T, Key>(key_size - log_num_buckets)),
+			file_prefix(file_prefix),
 			keep_files(read_only),
 			is_finished(read_only),
+			ram_budget(read_only ? nullptr : ram_budget),
 			cache(this, key_size - log_num_buckets, 1 << log_num_buckets),
 			buckets(1ull << log_num_buckets),
 			context(context)
 	{
+		if(record_size > sizeof(record_writer_t::buf) - 8) {
+			throw std::logic_error("record_size > " + std::to_string(sizeof(record_writer_t::buf) - 8));
+		}
+		// bound the staging memory of all bucket files to g_write_staging_size
+		const size_t write_buffer_size = std::min(std::max(
+				(g_write_staging_size / buckets.size()) / g_write_alignment * g_write_alignment,
+				g_write_alignment), g_write_buffer_size);
+
 		for(size_t i = 0; i < buckets.size(); ++i) {
 			auto& bucket = buckets[i];
-			bucket.file_name = file_prefix + L".sort_bucket_" + std::to_wstring(i) + L".tmp";
+			bucket.file_name = get_bucket_file_name(file_prefix, i);
+			bucket.record_size = record_size;
+			bucket.write_buffer_size = write_buffer_size;
+			bucket.direct_io = direct_io;
+			bucket.ram_budget = this->ram_budget.get();
 			if(read_only) {
-				bucket.num_entries = get_file_size(bucket.file_name.c_str()) / T::disk_size;
+				// buckets which never received an entry have no file
+				const int64_t file_size = get_file_size(bucket.file_name.c_str());
+				bucket.num_file_entries = file_size > 0 ? file_size / record_size : 0;
+				bucket.num_entries = bucket.num_file_entries;
 			} else {
-				bucket.open(L"wb");
+				_wremove(bucket.file_name.c_str());		// left-over from a previous run
 			}
 		}
 	}
@@ -133,6 +194,31 @@ namespace mad {
 		buckets[index].write(data, count);
 	}
 
+	template<typename T, typename Key>
+	void DiskSort<T, Key>::encode(const T& entry, uint8_t* record) const
+	{
+		if constexpr(bucket_codec<T, Key>::is_packed) {
+			record_writer_t out;
+			out.write(Key{}(entry), bucket_key_shift);
+			bucket_codec<T, Key>::write(entry, out);
+			memcpy(record, out.buf, record_size);
+		} else {
+			entry.write(record);
+		}
+	}
+
+	template<typename T, typename Key>
+	void DiskSort<T, Key>::decode(T& entry, const uint8_t* record, const size_t bucket) const
+	{
+		if constexpr(bucket_codec<T, Key>::is_packed) {
+			record_reader_t in(record, record_size);
+			const uint64_t key = (uint64_t(bucket) << bucket_key_shift) | in.read(bucket_key_shift);
+			bucket_codec<T, Key>::read(entry, key, in);
+		} else {
+			entry.read(record);
+		}
+	}
+
 	template<typename T, typename Key>
 	std::shared_ptr<typename DiskSort<T, Key>::WriteCache> DiskSort<T, Key>::add_cache()
 	{
@@ -146,16 +232,15 @@ void DiskSort<T, Key>::read(Processor<std::pair<std::vector<T>, size_t>>* output
 		if(num_threads_read < 0) {
 		num_threads_read = std::max(num_threads / 2, 2);
 		}
+		const int block_key_bits = bucket_key_shift - log_num_buckets;
 	
 	ThreadPool<	std::pair<std::vector<T>, size_t>,
-				std::pair<std::vector<T>, size_t>> sort_pool(
-		[](std::pair<std::vector<T>, size_t>& input, std::pair<std::vector<T>, size_t>& out, size_t&) {
-			std::sort(input.first.begin(), input.first.end(),
-					[](const T& lhs, const T& rhs) -> bool {
-						return Key{}(lhs) < Key{}(rhs);
-					});
+				std::pair<std::vector<T>, size_t>,
+				sort_local_t> sort_pool(
+		[block_key_bits](std::pair<std::vector<T>, size_t>& input, std::pair<std::vector<T>, size_t>& out, sort_local_t& local) {
+			sort_block(input.first, block_key_bits, local);
 				out = std::move(input);
-		}, output, num_threads, "Disk/sort");
+		}, output, num_threads, "Disk/sort", true, true);
 	
 	Thread<std::vector<std::pair<std::vector<T>, size_t>>> sort_thread(
 		[&sort_pool](std::vector<std::pair<std::vector<T>, size_t>>& input) {
@@ -166,7 +251,7 @@ void DiskSort<T, Key>::read(Processor<std::pair<std::vector<T>, size_t>>* output
 	
 	ThreadPool<	std::pair<size_t, size_t>,
 				std::vector<std::pair<std::vector<T>, size_t>>,
-				read_buffer_t<T>> read_pool(
+				read_local_t> read_pool(
 			std::bind(&DiskSort::read_bucket, this,
 				std::placeholders::_1, std::placeholders::_2, std::placeholders::_3),
 		&sort_thread, num_threads_read, "Disk/read");
@@ -184,58 +269,125 @@ void DiskSort<T, Key>::read(Processor<std::pair<std::vector<T>, size_t>>* output
 	template<typename T, typename Key>
 void DiskSort<T, Key>::read_bucket(	std::pair<size_t, size_t>& index,
 									std::vector<std::pair<std::vector<T>, size_t>>& out,
-		read_buffer_t<T>& buffer)
+									read_local_t& local)
 	{
 	auto& bucket = buckets[index.first];
-		bucket.open(L"rb");
 	
 		const int key_shift = bucket_key_shift - log_num_buckets;
 		if(key_shift < 0) {
 			throw std::logic_error("key_shift < 0");
 		}
-		std::unordered_map<size_t, std::vector<T>> table;
-		table.reserve(size_t(1) << log_num_buckets);
+		const size_t num_blocks = size_t(1) << log_num_buckets;
+		const size_t block_mask = num_blocks - 1;
+	
+		const auto task = this->context ? this->context->getCurrentTask() : nullptr;
+		if(task) {
+			task->totalWorkItem.add(bucket.num_entries);
+		}
+		auto& data = local.data;
+		data.resize(bucket.num_entries * record_size);
 	
-		if (this->context) {
-			this->context->getCurrentTask()->totalWorkItem += bucket.num_entries;
+		// RAM part first, then whatever overflowed to disk
+		size_t num_bytes = 0;
+		for(const auto& chunk : bucket.ram) {
+			memcpy(data.data() + num_bytes, chunk.data(), chunk.size());
+			num_bytes += chunk.size();
+		}
+		if(bucket.num_file_entries) {
+			bucket.open(L"rb");
 		}
-		for(size_t i = 0; i < bucket.num_entries;)
+		for(size_t i = bucket.num_ram_entries; i < bucket.num_entries;)
 		{
-			const size_t num_entries = std::min(buffer.capacity, bucket.num_entries - i);
-			if(fread(buffer.data, T::disk_size, num_entries, bucket.file) != num_entries) {
+			const size_t num_entries = std::min(g_read_chunk_size, bucket.num_entries - i);
+			if(fread(data.data() + i * record_size, record_size, num_entries, bucket.file) != num_entries) {
 				throw std::runtime_error("fread() failed");
 			}
-			for(size_t k = 0; k < num_entries; ++k) {
-				T entry;
-				entry.read(buffer.entry_at(k));
-			
-				auto& block = table[Key{}(entry) >> key_shift];
-				if(block.empty()) {
-					block.reserve((bucket.num_entries >> log_num_buckets) * 1.1);
-				}
-				block.push_back(entry);
-			}
 			i += num_entries;
-			if (this->context) {
-				this->context->getCurrentTask()->completedWorkItem++;
-			}
 		}
-		if(!keep_files) {
+		if(task) {
+			task->completedWorkItem.add(bucket.num_entries);
+		}
+		if(keep_files) {
+			bucket.close();
+		} else {
 			bucket.remove();
 		}
 	
-		std::map<size_t, std::vector<T>> sorted;
-		for(auto& entry : table) {
-			sorted.emplace(entry.first, std::move(entry.second));
+		// counting pass over the sub-bucket index
+		auto& counts = local.counts;
+		counts.assign(num_blocks, 0);
+		for(size_t i = 0; i < bucket.num_entries; ++i) {
+			T entry;
+			decode(entry, data.data() + i * record_size, index.first);
+			counts[(uint64_t(Key{}(entry)) >> key_shift) & block_mask]++;
 		}
-		table.clear();
 	
-		out.reserve(sorted.size());
-	uint64_t offset = index.second;
-		for(auto& entry : sorted) {
-		const auto count = entry.second.size();
-		out.emplace_back(std::move(entry.second), offset);
-		offset += count;
+		// allocate every block at its final size, then scatter (stable)
+		std::vector<std::vector<T>> blocks(num_blocks);
+		for(size_t i = 0; i < num_blocks; ++i) {
+			blocks[i].resize(counts[i]);
+			counts[i] = 0;
+		}
+		for(size_t i = 0; i < bucket.num_entries; ++i) {
+			T entry;
+			decode(entry, data.data() + i * record_size, index.first);
+			const size_t block = (uint64_t(Key{}(entry)) >> key_shift) & block_mask;
+			blocks[block][counts[block]++] = entry;
+		}
+	
+		uint64_t offset = index.second;
+		for(auto& block : blocks) {
+			if(block.empty()) {
+				continue;
+			}
+			const auto count = block.size();
+			out.emplace_back(std::move(block), offset);
+			offset += count;
+		}
+	}
+
+	template<typename T, typename Key>
+	void DiskSort<T, Key>::sort_block(std::vector<T>& block, const int key_bits, sort_local_t& local)
+	{
+		// split key_bits into as few passes as possible with at most 11 bits per digit
+		static constexpr int max_digit_bits = 11;
+		const int num_passes = (key_bits + max_digit_bits - 1) / max_digit_bits;
+		if(num_passes <= 0 || block.size() < 2) {
+			return;
+		}
+		const int digit_bits = (key_bits + num_passes - 1) / num_passes;
+		const size_t num_digits = size_t(1) << digit_bits;
+		const uint64_t digit_mask = num_digits - 1;
+	
+		auto& tmp = local.entries;
+		auto& counts = local.counts;
+		tmp.resize(block.size());
+	
+		for(int pass = 0; pass < num_passes; ++pass)
+		{
+			const int shift = pass * digit_bits;
+			counts.assign(num_digits, 0);
+			for(const auto& entry : block) {
+				counts[(uint64_t(Key{}(entry)) >> shift) & digit_mask]++;
+			}
+			bool is_trivial = false;
+			size_t sum = 0;
+			for(auto& count : counts) {
+				if(count == block.size()) {
+					is_trivial = true;		// all entries share this digit
+					break;
+				}
+				const auto tmp_count = count;
+				count = sum;
+				sum += tmp_count;
+			}
+			if(is_trivial) {
+				continue;
+			}
+			for(const auto& entry : block) {
+				tmp[counts[(uint64_t(Key{}(entry)) >> shift) & digit_mask]++] = entry;
+			}
+			std::swap(block, tmp);
 		}
 	}
 
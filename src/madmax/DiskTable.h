@@ -10,8 +10,10 @@
 
 #include "buffer.h"
 #include "ThreadPool.h"
+#include "AsyncWriter.h"
 
 #include <cstdio>
+#include <memory>
 
 namespace mad {
 	template<typename T>
@@ -29,13 +31,14 @@ namespace mad {
 		};
 		DiskPlotterContext* context;
 	public:
-		DiskTable(std::wstring file_name, size_t num_entries = 0, DiskPlotterContext* context = nullptr)
+		DiskTable(std::wstring file_name, size_t num_entries = 0, DiskPlotterContext* context = nullptr,
+				  bool direct_io = false)
 			:	file_name(file_name),
 				num_entries(num_entries),
 				context(context)
 		{
 			if(!num_entries) {
-				file_out = FOPEN(file_name.c_str(), L"wb");
+				file_out = std::make_unique<AsyncFile>(file_name, direct_io);
 			}
 		}
 	
@@ -103,9 +106,7 @@ namespace mad {
 		}
 	
 		void flush() {
-			if(fwrite(cache.data, cache.entry_size, cache.count, file_out) != cache.count) {
-				throw std::runtime_error("fwrite() failed");
-			}
+			file_out->write(cache.data, cache.entry_size * cache.count);
 			num_entries += cache.count;
 			cache.count = 0;
 		}
@@ -113,7 +114,7 @@ namespace mad {
 		void close() {
 			if(file_out) {
 				flush();
-				fclose(file_out);
+				file_out->close();
 				file_out = nullptr;
 			}
 		}
@@ -142,7 +143,66 @@ namespace mad {
 		size_t num_entries;
 	
 		write_buffer_t<T> cache;
-		FILE* file_out = nullptr;
+		std::unique_ptr<AsyncFile> file_out;
+	
+	};
+
+	/*
+	 * In-memory copy of a table in its disk encoding, filled block by block
+	 * while the table is read, so that a second pass does not touch the disk.
+	 */
+	template<typename T>
+	class TableCache {
+	public:
+		explicit TableCache(const size_t num_entries)
+			:	num_entries(num_entries),
+				data(new uint8_t[num_entries * T::disk_size])
+		{
+		}
+	
+		TableCache(TableCache&) = delete;
+		TableCache& operator=(TableCache&) = delete;
+	
+		static uint64_t get_num_bytes(const size_t num_entries) {
+			return uint64_t(num_entries) * T::disk_size;
+		}
+	
+		// stores a block as passed to DiskTable::read() outputs [thread-safe for disjoint blocks]
+		void write_block(const std::pair<std::vector<T>, size_t>& block) {
+			if(block.second + block.first.size() > num_entries) {
+				throw std::logic_error("TableCache::write_block(): out of bounds");
+			}
+			uint8_t* dst = data.get() + block.second * T::disk_size;
+			for(const auto& entry : block.first) {
+				dst += entry.write(dst);
+			}
+		}
+	
+		// same interface as DiskTable::read()
+		void read(	Processor<std::pair<std::vector<T>, size_t>>* output,
+					int num_threads_read = 2,
+					const size_t block_size = g_read_chunk_size) const
+		{
+			ThreadPool<std::pair<size_t, size_t>, std::pair<std::vector<T>, size_t>> pool(
+				[this](std::pair<size_t, size_t>& param, std::pair<std::vector<T>, size_t>& out, size_t&) {
+					const uint8_t* src = data.get() + param.first * T::disk_size;
+					auto& entries = out.first;
+					entries.resize(param.second);
+					for(size_t k = 0; k < param.second; ++k) {
+						src += entries[k].read(src);
+					}
+					out.second = param.first;
+				}, output, num_threads_read, "Table/cache");
+		
+			for(size_t offset = 0; offset < num_entries; offset += block_size) {
+				pool.take_copy(std::make_pair(offset, std::min(block_size, num_entries - offset)));
+			}
+			pool.close();
+		}
+	
+	private:
+		const size_t num_entries;
+		std::unique_ptr<uint8_t[]> data;
 	
 	};
 }
@@ -0,0 +1,299 @@
+/*
+ * PlotWriter.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_PLOTWRITER_H_
+#define INCLUDE_CHIA_PLOTWRITER_H_
+
+#include "settings.h"
+#include "util.hpp"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <sys/uio.h>
+#endif
+
+namespace mad {
+
+/*
+ * Writes (offset, buffer) pieces of an existing file, in any order.
+ * Adjacent pieces are collected into runs, a run is written with one positional
+ * gather write once it reaches g_plot_write_size bytes, or earlier if more than
+ * g_plot_write_window bytes are pending. Parks of a table are contiguous, so this
+ * turns one small seek + write per park into a few large sequential writes.
+ */
+class PlotWriter {
+public:
+	// opens an existing file for writing, without truncating it
+	explicit PlotWriter(const std::wstring& file_name)
+	{
+#ifdef _WIN32
+		handle = CreateFileW(file_name.c_str(), GENERIC_WRITE,
+				FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL, NULL);
+		if(handle == INVALID_HANDLE_VALUE) {
+			throw std::runtime_error("CreateFile() failed");
+		}
+#else
+		fd = ::open(ws2s(file_name).c_str(), O_WRONLY);
+		if(fd < 0) {
+			throw std::runtime_error("open() failed");
+		}
+#endif
+	}
+
+	~PlotWriter() {
+		try {
+			close();
+		} catch(...) {
+			// ignore
+		}
+	}
+
+	PlotWriter(PlotWriter&) = delete;
+	PlotWriter& operator=(PlotWriter&) = delete;
+
+	// pre-allocates disk space up to end_offset, so the file is not fragmented (best effort) [thread-safe]
+	void reserve(const uint64_t end_offset) {
+		std::lock_guard<std::mutex> lock(io_mutex);
+		if(end_offset <= reserved) {
+			return;
+		}
+#ifdef _WIN32
+		FILE_ALLOCATION_INFO info = {};
+		info.AllocationSize.QuadPart = end_offset;
+		SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info));
+#elif defined(__linux__)
+		::fallocate(fd, FALLOC_FL_KEEP_SIZE, reserved, end_offset - reserved);
+#endif
+		reserved = end_offset;
+	}
+
+	// takes ownership of data [thread-safe]
+	void write(const uint64_t offset, std::vector<uint8_t>&& data) {
+		if(data.empty()) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		check_error();
+		const uint64_t end = offset + data.size();
+		pending_bytes += data.size();
+
+		run_t* run = nullptr;
+		auto next = runs.find(end);
+		auto iter = runs.lower_bound(offset);
+		if(iter != runs.begin() && (--iter)->second.end == offset) {
+			run = &iter->second;
+			run->end = end;
+			run->pieces.emplace_back(std::move(data));
+		} else {
+			iter = runs.emplace(offset, run_t()).first;
+			run = &iter->second;
+			run->begin = offset;
+			run->end = end;
+			run->pieces.emplace_back(std::move(data));
+		}
+		if(next != runs.end()) {
+			run->end = next->second.end;
+			for(auto& piece : next->second.pieces) {
+				run->pieces.emplace_back(std::move(piece));
+			}
+			runs.erase(next);
+		}
+
+		std::vector<run_t> out;
+		if(run->end - run->begin >= g_plot_write_size) {
+			out.emplace_back(std::move(*run));
+			runs.erase(iter);
+			pending_bytes -= out.back().end - out.back().begin;
+		}
+		while(pending_bytes > g_plot_write_window && !runs.empty()) {
+			out.emplace_back(std::move(runs.begin()->second));
+			runs.erase(runs.begin());
+			pending_bytes -= out.back().end - out.back().begin;
+		}
+		write_out(out, lock);
+	}
+
+	// copies data [thread-safe]
+	void write(const uint64_t offset, const void* data, const size_t num_bytes) {
+		write(offset, std::vector<uint8_t>((const uint8_t*)data, (const uint8_t*)data + num_bytes));
+	}
+
+	// writes out everything pending [thread-safe]
+	void flush() {
+		std::unique_lock<std::mutex> lock(mutex);
+		std::vector<run_t> out;
+		for(auto& entry : runs) {
+			out.emplace_back(std::move(entry.second));
+		}
+		runs.clear();
+		pending_bytes = 0;
+		write_out(out, lock);
+		check_error();
+	}
+
+	// total bytes written so far [thread-safe]
+	uint64_t get_num_bytes() const {
+		std::lock_guard<std::mutex> lock(io_mutex);
+		return num_bytes_written;
+	}
+
+	// NOT thread-safe
+	void close() {
+#ifdef _WIN32
+		if(handle == INVALID_HANDLE_VALUE) {
+			return;
+		}
+#else
+		if(fd < 0) {
+			return;
+		}
+#endif
+		try {
+			flush();
+		} catch(...) {
+			close_handle();
+			throw;
+		}
+		close_handle();
+	}
+
+private:
+	struct run_t {
+		uint64_t begin = 0;
+		uint64_t end = 0;
+		std::vector<std::vector<uint8_t>> pieces;
+	};
+
+	// mutex must be locked, is unlocked during I/O
+	void write_out(std::vector<run_t>& out, std::unique_lock<std::mutex>& lock) {
+		if(out.empty()) {
+			return;
+		}
+		{
+			// take the I/O lock first, so that a later flush() cannot overtake these writes,
+			// and release it before mutex is locked again (lock order is mutex -> io_mutex)
+			std::lock_guard<std::mutex> io_lock(io_mutex);
+			lock.unlock();
+			for(const auto& run : out) {
+				if(!write_run(run)) {
+					std::lock_guard<std::mutex> err_lock(error_mutex);
+					if(error.empty()) {
+						error = "PlotWriter: write failed at offset " + std::to_string(run.begin);
+					}
+				}
+				num_bytes_written += run.end - run.begin;
+			}
+		}
+		lock.lock();
+	}
+
+	// io_mutex must be locked
+	bool write_run(const run_t& run) {
+#ifdef _WIN32
+		// no gather write for buffered files, copy into one buffer instead
+		buffer.resize(run.end - run.begin);
+		size_t pos = 0;
+		for(const auto& piece : run.pieces) {
+			memcpy(buffer.data() + pos, piece.data(), piece.size());
+			pos += piece.size();
+		}
+		uint64_t offset = run.begin;
+		for(size_t total = 0; total < buffer.size();) {
+			const DWORD count = DWORD(std::min<size_t>(buffer.size() - total, size_t(1) << 30));
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = DWORD(offset);
+			overlapped.OffsetHigh = DWORD(offset >> 32);
+			DWORD num_written = 0;
+			if(!WriteFile(handle, buffer.data() + total, count, &num_written, &overlapped) || !num_written) {
+				return false;
+			}
+			total += num_written;
+			offset += num_written;
+		}
+		return true;
+#else
+		std::vector<iovec> iov;
+		iov.reserve(run.pieces.size());
+		for(const auto& piece : run.pieces) {
+			iovec tmp;
+			tmp.iov_base = (void*)piece.data();
+			tmp.iov_len = piece.size();
+			iov.push_back(tmp);
+		}
+		uint64_t offset = run.begin;
+		size_t first = 0;
+		while(first < iov.size()) {
+			const int count = int(std::min<size_t>(iov.size() - first, IOV_MAX));
+			const auto ret = ::pwritev(fd, iov.data() + first, count, offset);
+			if(ret <= 0) {
+				return false;
+			}
+			offset += ret;
+			// skip what was written, a short write can end inside a piece
+			size_t left = ret;
+			while(first < iov.size() && left >= iov[first].iov_len) {
+				left -= iov[first].iov_len;
+				first++;
+			}
+			if(left) {
+				iov[first].iov_base = (uint8_t*)iov[first].iov_base + left;
+				iov[first].iov_len -= left;
+			}
+		}
+		return true;
+#endif
+	}
+
+	void check_error() const {
+		std::lock_guard<std::mutex> lock(error_mutex);
+		if(!error.empty()) {
+			throw std::runtime_error(error);
+		}
+	}
+
+	void close_handle() {
+#ifdef _WIN32
+		CloseHandle(handle);
+		handle = INVALID_HANDLE_VALUE;
+#else
+		::close(fd);
+		fd = -1;
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE handle = INVALID_HANDLE_VALUE;
+	std::vector<uint8_t> buffer;		// protected by io_mutex
+#else
+	int fd = -1;
+#endif
+	std::mutex mutex;
+	std::map<uint64_t, run_t> runs;		// pending runs by begin offset
+	uint64_t pending_bytes = 0;
+
+	mutable std::mutex io_mutex;
+	uint64_t reserved = 0;
+	uint64_t num_bytes_written = 0;
+
+	mutable std::mutex error_mutex;
+	std::string error;
+
+};
+
+} // mad
+
+#endif /* INCLUDE_CHIA_PLOTWRITER_H_ */
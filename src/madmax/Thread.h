@@ -8,9 +8,17 @@
 #ifndef INCLUDE_CHIA_THREAD_H_
 #define INCLUDE_CHIA_THREAD_H_
 
+#include "settings.h"
+#include "affinity.h"
+#include "CpuExecutor.h"
+
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
 #include <iostream>
 #include <functional>
 #include <condition_variable>
@@ -21,6 +29,20 @@
 
 namespace mad{
 
+inline void set_thread_name(const std::string& name)
+{
+	if(!name.empty()) {
+		std::string thread_name = name;
+		// limit the name to 15 chars, otherwise pthread_setname_np() fails
+		if(thread_name.size() > 15) {
+			thread_name.resize(15);
+		}
+#ifdef _GNU_SOURCE
+		pthread_setname_np(pthread_self(), thread_name.c_str());
+#endif
+	}
+}
+
 template<typename T>
 class Processor {
 public:
@@ -34,50 +56,128 @@ public:
 	}
 };
 
+/*
+ * Bounded lock-free queue, multiple producers and a single consumer.
+ * Each cell carries a sequence number which tells whether it is free for
+ * position pos (seq == pos) or holds the entry for position pos (seq == pos + 1),
+ * hence a minimum capacity of 2.
+ */
+template<typename T>
+class RingQueue {
+public:
+	explicit RingQueue(const size_t min_capacity)
+		:	capacity(std::max<size_t>(min_capacity, 2)), cells(new cell_t[capacity])
+	{
+		for(size_t i = 0; i < capacity; ++i) {
+			cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	RingQueue(RingQueue&) = delete;
+	RingQueue& operator=(RingQueue&) = delete;
+
+	// moves data into the queue, returns false if full [thread-safe]
+	bool push(T& data) {
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		while(true) {
+			auto& cell = cells[pos % capacity];
+			const auto dif = int64_t(cell.seq.load(std::memory_order_acquire)) - int64_t(pos);
+			if(dif == 0) {
+				if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.data = std::move(data);
+					cell.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if(dif < 0) {
+				return false;
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// returns false if empty [consumer only]
+	bool pop(T& data) {
+		const size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		auto& cell = cells[pos % capacity];
+		if(cell.seq.load(std::memory_order_acquire) != pos + 1) {
+			return false;
+		}
+		data = std::move(cell.data);
+		cell.seq.store(pos + capacity, std::memory_order_release);
+		dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// [thread-safe]
+	bool can_push() const {
+		const size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		return int64_t(cells[pos % capacity].seq.load(std::memory_order_acquire)) - int64_t(pos) >= 0;
+	}
+
+	// [thread-safe]
+	bool can_pop() const {
+		const size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		return cells[pos % capacity].seq.load(std::memory_order_acquire) == pos + 1;
+	}
+
+private:
+	struct cell_t {
+		std::atomic<size_t> seq {0};
+		T data;
+	};
+
+	const size_t capacity;
+	std::unique_ptr<cell_t[]> cells;
+	alignas(64) std::atomic<size_t> enqueue_pos {0};
+	alignas(64) std::atomic<size_t> dequeue_pos {0};
+
+};
+
+/*
+ * Pipeline stage with its own thread, fed through a RingQueue of depth inputs.
+ * Producers only block when the queue is full, waiting spins for a while
+ * before parking on a condition variable.
+ */
 template<typename T>
 class Thread : public Processor<T> {
 public:
-	Thread(const std::function<void(T&)>& func, const std::string& name = "")
-		:	execute(func)
+	Thread(const std::function<void(T&)>& func, const std::string& name = "",
+			const size_t depth = g_thread_queue_depth)
+		:	queue(depth), execute(func), affinity(affinity_t::get_thread()),
+			share(CpuExecutor::get_thread())
 	{
 		thread = std::thread(&Thread::loop, this, name);
 	}
 	
 	virtual ~Thread() {
-		close();
+		try {
+			close();
+		} catch(...) {
+			// ignore
+		}
 	}
 	
 	// thread-safe
 	void take(T& data) override {
-		std::unique_lock<std::mutex> lock(mutex);
-		while(do_run && is_avail) {
-			signal.wait(lock);
-		}
 		if(!do_run) {
 			return;
 		}
-		is_avail = true;
-		input = std::move(data);
-		
-		if(is_busy) {
-			// wait for thread to take new input (no triple buffering)
-			while(do_run && is_avail && is_busy) {
-				signal.notify_all();
-				signal.wait(lock);
+		num_pending++;
+		while(!queue.push(data)) {
+			park([this]() -> bool { return !do_run || queue.can_push(); });
+			if(!do_run) {
+				num_pending--;
+				return;
 			}
-		} else {
-			// simple notify since thread is just waiting for new input
-			lock.unlock();
-			signal.notify_all();
 		}
+		notify();
 	}
 	
 	// wait for thread to finish all pending input [thread-safe]
 	void wait() {
-		std::unique_lock<std::mutex> lock(mutex);
-		while(do_run && (is_avail || is_busy)) {
-			signal.wait(lock);
-		}
+		park([this]() -> bool { return !do_run || num_pending == 0; });
+		std::lock_guard<std::mutex> lock(mutex);
 		if(is_fail) {
 			throw std::runtime_error("thread failed with: " + ex_what);
 		}
@@ -85,67 +185,90 @@ public:
 	
 	// NOT thread-safe
 	void close() {
-		wait();
-		std::unique_lock<std::mutex> lock(mutex);
+		park([this]() -> bool { return !do_run || num_pending == 0; });
 		do_run = false;
+		notify();
 		if(thread.joinable()) {
-			lock.unlock();
-			signal.notify_all();
 			thread.join();
 		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if(is_fail) {
+			throw std::runtime_error("thread failed with: " + ex_what);
+		}
 	}
 	
 private:
 	void loop(const std::string& name) noexcept
 	{
-		if(!name.empty()) {
-			std::string thread_name = name;
-			// limit the name to 15 chars, otherwise pthread_setname_np() fails
-			if(thread_name.size() > 15) {
-				thread_name.resize(15);
-			}
-#ifdef _GNU_SOURCE
-			pthread_setname_np(pthread_self(), thread_name.c_str());
-#endif
-		}
-		std::unique_lock<std::mutex> lock(mutex);
+		set_thread_name(name);
+		affinity_t::set_thread(affinity);
+		CpuExecutor::set_thread(share);
 		while(true) {
-			while(do_run && !is_avail) {
-				signal.notify_all();	// notify about is_busy change
-				signal.wait(lock);
-			}
-			if(!do_run) {
-				break;
+			T tmp;
+			if(!queue.pop(tmp)) {
+				park([this]() -> bool { return !do_run || queue.can_pop(); });
+				if(!do_run) {
+					break;
+				}
+				continue;
 			}
-			T tmp = std::move(input);
-			is_avail = false;
-			is_busy = true;
-			lock.unlock();
-			signal.notify_all();		// notify about is_busy + is_avail change
+			notify();		// notify about free slot
 			try {
 				execute(tmp);
-				lock.lock();
 			} catch(const std::exception& ex) {
-				lock.lock();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					is_fail = true;
+					ex_what = ex.what();
+				}
 				do_run = false;
-				is_fail = true;
-				ex_what = ex.what();
+				notify();
+				break;
 			}
-			is_busy = false;
+			num_pending--;
+			notify();		// notify about num_pending change
+		}
+	}
+
+	// spin first, then sleep until pred() is true
+	template<typename F>
+	void park(const F& pred) {
+		for(int i = 0; i < g_thread_spin_count; ++i) {
+			if(pred()) {
+				return;
+			}
+			std::this_thread::yield();
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		num_parked++;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		while(!pred()) {
+			signal.wait(lock);
+		}
+		num_parked--;
+	}
+
+	// wake up parked threads after a state change
+	void notify() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(num_parked.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(mutex);
+			signal.notify_all();
 		}
-		signal.notify_all();		// notify about do_run + is_fail + is_busy change
 	}
 	
 private:
-	T input;
-	bool do_run = true;
+	RingQueue<T> queue;
+	std::atomic<bool> do_run {true};
+	std::atomic<uint64_t> num_pending {0};
+	std::atomic<int> num_parked {0};
 	bool is_fail = false;
-	bool is_busy = false;
-	bool is_avail = false;
 	std::mutex mutex;
 	std::thread thread;
 	std::condition_variable signal;
 	std::function<void(T&)> execute;
+	std::shared_ptr<const affinity_t> affinity;		// of the creating thread
+	std::shared_ptr<CpuExecutor::share_t> share;	// of the creating thread
 	std::string ex_what;
 	
 };
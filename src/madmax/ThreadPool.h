@@ -9,128 +9,285 @@
 #define INCLUDE_CHIA_THREADPOOL_H_
 
 #include "Thread.h"
+#include "CpuExecutor.h"
 
+#include <map>
+#include <deque>
+#include <chrono>
 #include <vector>
 #include <memory>
+#include <string>
+#include <stdexcept>
 
 namespace mad{
 
+/*
+ * Pool of worker threads fed from a shared queue, each input goes to whichever
+ * worker is idle first. With ordered = true the outputs pass through a reorder
+ * buffer and are delivered in input order, with ordered = false they are delivered
+ * as soon as they are ready (for commutative sinks like WriteCache adders).
+ * Outputs are always delivered by one thread at a time.
+ * With cpu_bound = true every input runs in a slot of the CpuExecutor, under the share
+ * of the job that created the pool.
+ */
 template<typename T, typename S, typename L = size_t>
 class ThreadPool : public Processor<T> {
+public:
+	struct stats_t {
+		uint64_t num_jobs = 0;
+		uint64_t busy_time = 0;		// [usec]
+		uint64_t idle_time = 0;		// [usec]
+	};
+
 private:
-	struct thread_t {
-		uint64_t job = -1;
-		std::mutex mutex;
-		std::condition_variable signal;
-		std::shared_ptr<Thread<T>> thread;
+	struct job_t {
+		uint64_t id = 0;
+		T data;
+	};
+
+	struct worker_t {
 		L local;
+		stats_t stats;
+		std::thread thread;
 	};
-	
+
 public:
 	ThreadPool(	const std::function<void(T&, S&, L&)>& func, Processor<S>* output,
-				const int num_threads, const std::string& name = "")
-		:	output(output),
-			execute(func)
+				const int num_threads, const std::string& name = "", const bool ordered = true,
+				const bool cpu_bound = false)
+		:	ordered(ordered),
+			max_pending(2 * size_t(num_threads)),
+			output(output),
+			execute(func),
+			affinity(affinity_t::get_thread()),
+			share(CpuExecutor::get_thread()),
+			cpu_bound(cpu_bound)
 	{
 		if(num_threads < 1) {
 			throw std::logic_error("num_threads < 1");
 		}
 		for(int i = 0; i < num_threads; ++i) {
-			threads.push_back(std::make_shared<thread_t>());
+			workers.push_back(std::make_shared<worker_t>());
 		}
 		for(int i = 0; i < num_threads; ++i) {
-			threads[i]->thread = std::make_shared<Thread<T>>(
-					std::bind(&ThreadPool::wrapper, this,
-							threads[i].get(),
-							threads[((i + num_threads) - 1) % num_threads].get(),
-							std::placeholders::_1),
+			workers[i]->thread = std::thread(&ThreadPool::loop, this, workers[i].get(),
 					name.empty() ? name : name + "/" + std::to_string(i));
 		}
 	}
-	
+
 	~ThreadPool() {
-		close();
+		try {
+			close();
+		} catch(...) {
+			// ignore
+		}
 	}
-	
-	// NOT thread-safe
+
+	// blocks while max_pending inputs are in flight [thread-safe]
 	void take(T& data) override {
-		const auto& state = threads[next % threads.size()];
-		state->thread->wait();
-		{
-			std::lock_guard<std::mutex> lock(state->mutex);
-			state->job = next;
+		std::unique_lock<std::mutex> lock(mutex);
+		while(do_run && next_job - num_done >= max_pending) {
+			signal.wait(lock);
+		}
+		if(!do_run) {
+			return;
 		}
-		state->thread->take(data);
-		next++;
+		job_t job;
+		job.id = next_job++;
+		job.data = std::move(data);
+		queue.push_back(std::move(job));
+		lock.unlock();
+		signal.notify_all();
 	}
-	
-	// NOT thread-safe
+
+	// wait for all pending input to be processed and delivered [thread-safe]
 	void wait() {
-		for(const auto& state : threads) {
-			state->thread->wait();
+		std::unique_lock<std::mutex> lock(mutex);
+		while(do_run && num_done < next_job) {
+			signal.wait(lock);
+		}
+		if(is_fail) {
+			throw std::runtime_error("thread failed with: " + ex_what);
 		}
 	}
-	
+
 	// NOT thread-safe
 	void close() {
-		wait();
-		for(const auto& state : threads) {
-			state->thread->close();
+		if(workers.empty()) {
+			return;
+		}
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(do_run && num_done < next_job) {
+				signal.wait(lock);
+			}
+			do_run = false;
+		}
+		signal.notify_all();
+		for(const auto& worker : workers) {
+			worker->thread.join();
+		}
+		workers.clear();
+
+		if(is_fail) {
+			throw std::runtime_error("thread failed with: " + ex_what);
 		}
-		threads.clear();
 	}
-	
+
 	// NOT thread-safe
 	size_t num_threads() const {
-		return threads.size();
+		return workers.size();
 	}
-	
+
 	// NOT thread-safe
 	L& get_local(size_t index) {
-		const auto& state = threads[index];
-		state->thread->wait();
-		return state->local;
+		wait();
+		return workers[index]->local;
 	}
-	
+
 	// NOT thread-safe
 	void set_local(size_t index, L&& value) {
-		const auto& state = threads[index];
-		state->thread->wait();
-		state->local = value;
+		wait();
+		workers[index]->local = value;
 	}
-	
+
+	// per worker statistics [thread-safe]
+	std::vector<stats_t> get_stats() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<stats_t> out;
+		for(const auto& worker : workers) {
+			out.push_back(worker->stats);
+		}
+		return out;
+	}
+
 private:
-	void wrapper(thread_t* state, thread_t* prev, T& input)
+	static uint64_t now_micros() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void loop(worker_t* worker, const std::string& name) noexcept
 	{
-		uint64_t job = -1;
-		{
-			std::lock_guard<std::mutex> lock(state->mutex);
-			job = state->job;
-		}
-		S out;
-		execute(input, out, state->local);
-		{
-			std::unique_lock<std::mutex> lock(prev->mutex);
-			while(prev->job < job) {
-				prev->signal.wait(lock);
+		set_thread_name(name);
+		affinity_t::set_thread(affinity);
+		CpuExecutor::set_thread(share);
+
+		auto time_mark = now_micros();
+		std::unique_lock<std::mutex> lock(mutex);
+		while(true) {
+			while(do_run && queue.empty()) {
+				signal.wait(lock);
+			}
+			if(!do_run) {
+				break;
+			}
+			auto job = std::move(queue.front());
+			queue.pop_front();
+			lock.unlock();
+
+			S out;
+			bool is_ok = true;
+			std::string what;
+			uint64_t begin = 0;
+			uint64_t end = 0;
+			{
+				CpuExecutor::slot_t slot(cpu_bound ? share.get() : nullptr);
+				begin = now_micros();
+				try {
+					execute(job.data, out, worker->local);
+				} catch(const std::exception& ex) {
+					is_ok = false;
+					what = ex.what();
+				}
+				end = now_micros();
+			}
+
+			lock.lock();
+			worker->stats.num_jobs++;
+			worker->stats.idle_time += begin - time_mark;
+			worker->stats.busy_time += end - begin;
+			time_mark = end;
+
+			if(!is_ok) {
+				fail(what);
+				break;
 			}
+			ready.emplace(job.id, std::move(out));
+			deliver(lock);
 		}
-		if(output) {
-			output->take(out);	// only one thread can be at this position
+		lock.unlock();
+		signal.notify_all();
+	}
+
+	// mutex must be locked, only one thread delivers at a time
+	void deliver(std::unique_lock<std::mutex>& lock) noexcept
+	{
+		if(is_delivering) {
+			return;		// current delivering thread will pick it up
 		}
-		{
-			std::lock_guard<std::mutex> lock(state->mutex);
-			state->job = -1;
+		is_delivering = true;
+		while(do_run && !ready.empty()) {
+			auto iter = ready.begin();
+			if(ordered && iter->first != num_done) {
+				break;	// waiting for an earlier job
+			}
+			S out = std::move(iter->second);
+			ready.erase(iter);
+			lock.unlock();
+
+			bool is_ok = true;
+			std::string what;
+			if(output) {
+				try {
+					output->take(out);
+				} catch(const std::exception& ex) {
+					is_ok = false;
+					what = ex.what();
+				}
+			}
+			lock.lock();
+			if(!is_ok) {
+				fail(what);
+				break;
+			}
+			num_done++;
+			signal.notify_all();
+		}
+		is_delivering = false;
+	}
+
+	// mutex must be locked
+	void fail(const std::string& what) {
+		if(!is_fail) {
+			is_fail = true;
+			ex_what = what;
 		}
-		state->signal.notify_all();
+		do_run = false;
+		signal.notify_all();
 	}
-	
+
 private:
-	uint64_t next = 0;
+	const bool ordered = true;
+	const size_t max_pending = 0;
 	Processor<S>* output = nullptr;
 	std::function<void(T&, S&, L&)> execute;
-	std::vector<std::shared_ptr<thread_t>> threads;
-	
+	std::shared_ptr<const affinity_t> affinity;		// of the creating thread
+	std::shared_ptr<CpuExecutor::share_t> share;	// of the creating thread
+	const bool cpu_bound = false;
+
+	bool do_run = true;
+	bool is_fail = false;
+	bool is_delivering = false;
+	uint64_t next_job = 0;
+	uint64_t num_done = 0;			// number of outputs delivered
+	std::deque<job_t> queue;
+	std::map<uint64_t, S> ready;	// reorder buffer
+	std::string ex_what;
+	mutable std::mutex mutex;
+	std::condition_variable signal;
+	std::vector<std::shared_ptr<worker_t>> workers;
+
 };
 
 }
@@ -0,0 +1,296 @@
+/*
+ * affinity.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_AFFINITY_H_
+#define INCLUDE_CHIA_AFFINITY_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace mad {
+
+/*
+ * Set of logical CPUs a plot job runs on, on Windows CPU i is bit (i % 64) of processor group (i / 64).
+ * set_thread() pins the calling thread and remembers the affinity, Thread and ThreadPool
+ * apply it to the threads they create, so pinning a job's main thread pins its whole pipeline.
+ * Memory is placed on the node of the thread that first touches it, so the buffers a pinned
+ * job allocates and fills (bitfields, sort buckets) end up on its own node.
+ */
+class affinity_t {
+public:
+	std::vector<int> cpus;		// sorted, empty = no restriction
+	int numa_node = -1;			// node that all cpus belong to, -1 = unknown / mixed
+
+	bool empty() const {
+		return cpus.empty();
+	}
+
+	// "0-7,16-23" or "0-7,16-23 (node 1)"
+	std::string to_string() const
+	{
+		std::string out;
+		for(size_t i = 0; i < cpus.size();) {
+			size_t k = i + 1;
+			while(k < cpus.size() && cpus[k] == cpus[k - 1] + 1) {
+				k++;
+			}
+			out += (out.empty() ? "" : ",") + std::to_string(cpus[i]);
+			if(k - i > 1) {
+				out += "-" + std::to_string(cpus[k - 1]);
+			}
+			i = k;
+		}
+		if(numa_node >= 0) {
+			out += " (node " + std::to_string(numa_node) + ")";
+		}
+		return out;
+	}
+
+	// pins the calling thread, nullptr / empty only resets the remembered affinity
+	static bool set_thread(std::shared_ptr<const affinity_t> affinity)
+	{
+		thread_affinity() = affinity;
+		if(!affinity || affinity->empty()) {
+			return true;
+		}
+#ifdef _WIN32
+		// a thread can only run in one processor group, take the one with most of the cpus
+		std::map<WORD, KAFFINITY> groups;
+		for(const auto cpu : affinity->cpus) {
+			groups[WORD(cpu / 64)] |= KAFFINITY(1) << (cpu % 64);
+		}
+		auto best = groups.begin();
+		for(auto iter = groups.begin(); iter != groups.end(); ++iter) {
+			if(count_bits(iter->second) > count_bits(best->second)) {
+				best = iter;
+			}
+		}
+		GROUP_AFFINITY group = {};
+		group.Group = best->first;
+		group.Mask = best->second;
+		return SetThreadGroupAffinity(GetCurrentThread(), &group, NULL);
+#elif defined(CPU_SET)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(const auto cpu : affinity->cpus) {
+			if(cpu >= 0 && cpu < CPU_SETSIZE) {
+				CPU_SET(cpu, &set);
+			}
+		}
+		return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// affinity last set with set_thread() in this thread, nullptr if none
+	static std::shared_ptr<const affinity_t> get_thread() {
+		return thread_affinity();
+	}
+
+	// "" = no restriction, "node:N" = all cpus of NUMA node N, otherwise a cpu list like "0-7,16-23"
+	static affinity_t parse(const std::string& spec)
+	{
+		affinity_t out;
+		if(spec.empty()) {
+			return out;
+		}
+		if(spec.compare(0, 5, "node:") == 0) {
+			size_t end = 0;
+			const int node = std::stoi(spec.substr(5), &end);
+			if(5 + end != spec.size() || node < 0 || node >= get_num_numa_nodes()) {
+				throw std::logic_error("invalid numa node: " + spec);
+			}
+			return get_numa_node(node);
+		}
+		out.cpus = parse_list(spec);
+		if(out.cpus.empty()) {
+			throw std::logic_error("invalid cpu list: " + spec);
+		}
+		return out;
+	}
+
+	/*
+	 * "auto" or "auto:N", the job takes one of N equal parts of the machine (see get_partition()).
+	 * num_parts = N, or 0 for plain "auto". Returns false for any other spec.
+	 */
+	static bool parse_auto(const std::string& spec, int& num_parts)
+	{
+		num_parts = 0;
+		if(spec == "auto") {
+			return true;
+		}
+		if(spec.compare(0, 5, "auto:") != 0) {
+			return false;
+		}
+		size_t end = 0;
+		try {
+			num_parts = std::stoi(spec.substr(5), &end);
+		} catch(const std::exception&) {
+			end = 0;
+		}
+		if(end == 0 || 5 + end != spec.size() || num_parts < 1) {
+			throw std::logic_error("invalid auto affinity: " + spec);
+		}
+		return true;
+	}
+
+	static affinity_t get_numa_node(const int node)
+	{
+		affinity_t out;
+		for(const auto& entry : get_topology()) {
+			if(entry.first == node) {
+				out.cpus.push_back(entry.second);
+			}
+		}
+		std::sort(out.cpus.begin(), out.cpus.end());
+		out.numa_node = node;
+		return out;
+	}
+
+	/*
+	 * Part index of count (about) equal parts of the machine. The cpus are ordered by node,
+	 * so with as many parts as nodes (or a multiple) every part stays within one node.
+	 */
+	static affinity_t get_partition(const int index, const int count)
+	{
+		affinity_t out;
+		const auto all = get_topology();
+		if(all.empty() || count < 1) {
+			return out;
+		}
+		const size_t begin = (size_t(index % count) * all.size()) / count;
+		const size_t end = std::max((size_t(index % count + 1) * all.size()) / count, begin + 1);
+		out.numa_node = all[begin].first;
+		for(size_t i = begin; i < end && i < all.size(); ++i) {
+			out.cpus.push_back(all[i].second);
+			if(all[i].first != out.numa_node) {
+				out.numa_node = -1;
+			}
+		}
+		std::sort(out.cpus.begin(), out.cpus.end());
+		return out;
+	}
+
+	static int get_num_numa_nodes()
+	{
+		int num_nodes = 0;
+		for(const auto& entry : get_topology()) {
+			num_nodes = std::max(num_nodes, entry.first + 1);
+		}
+		return std::max(num_nodes, 1);
+	}
+
+private:
+	static std::shared_ptr<const affinity_t>& thread_affinity() {
+		thread_local std::shared_ptr<const affinity_t> affinity;
+		return affinity;
+	}
+
+#ifdef _WIN32
+	static int count_bits(KAFFINITY mask) {
+		int count = 0;
+		for(; mask; mask &= mask - 1) {
+			count++;
+		}
+		return count;
+	}
+#endif
+
+	// "0-3,8,10-11"
+	static std::vector<int> parse_list(const std::string& list)
+	{
+		std::vector<int> out;
+		size_t pos = 0;
+		while(pos < list.size()) {
+			size_t next = list.find(',', pos);
+			if(next == std::string::npos) {
+				next = list.size();
+			}
+			const std::string range = list.substr(pos, next - pos);
+			const size_t dash = range.find('-');
+			try {
+				const int first = std::stoi(range.substr(0, dash));
+				const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+				for(int cpu = first; cpu >= 0 && cpu <= last && cpu < 65536; ++cpu) {
+					out.push_back(cpu);
+				}
+			} catch(const std::exception&) {
+				return {};
+			}
+			pos = next + 1;
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+		return out;
+	}
+
+	// (node, cpu) of every online cpu, ordered by node
+	static std::vector<std::pair<int, int>> get_topology()
+	{
+		std::vector<std::pair<int, int>> out;
+#ifdef _WIN32
+		ULONG highest_node = 0;
+		if(GetNumaHighestNodeNumber(&highest_node)) {
+			for(USHORT node = 0; node <= highest_node; ++node) {
+				GROUP_AFFINITY group = {};
+				if(GetNumaNodeProcessorMaskEx(node, &group)) {
+					for(int bit = 0; bit < 64; ++bit) {
+						if(group.Mask & (KAFFINITY(1) << bit)) {
+							out.emplace_back(node, group.Group * 64 + bit);
+						}
+					}
+				}
+			}
+		}
+		if(out.empty()) {
+			const WORD num_groups = GetActiveProcessorGroupCount();
+			for(WORD group = 0; group < num_groups; ++group) {
+				const DWORD count = GetActiveProcessorCount(group);
+				for(DWORD i = 0; i < count && i < 64; ++i) {
+					out.emplace_back(0, group * 64 + i);
+				}
+			}
+		}
+#else
+		for(int node = 0; ; ++node) {
+			std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			std::string list;
+			if(!in || !std::getline(in, list)) {
+				break;
+			}
+			for(const auto cpu : parse_list(list)) {
+				out.emplace_back(node, cpu);
+			}
+		}
+		if(out.empty()) {
+			const long count = sysconf(_SC_NPROCESSORS_ONLN);
+			for(int cpu = 0; cpu < count; ++cpu) {
+				out.emplace_back(0, cpu);
+			}
+		}
+#endif
+		std::stable_sort(out.begin(), out.end());
+		return out;
+	}
+
+};
+
+} // mad
+
+#endif /* INCLUDE_CHIA_AFFINITY_H_ */
@@ -10,6 +10,8 @@
 
 #include "settings.h"
 
+#include <vector>
+
 namespace mad {
 	template<typename T>
 	struct byte_buffer_t {
@@ -40,6 +42,20 @@ namespace mad {
 	struct write_buffer_t : byte_buffer_t<T> {
 		write_buffer_t() : byte_buffer_t<T>(g_write_chunk_size) {}
 	};
+
+	// same as byte_buffer_t, but with an entry size only known at runtime
+	struct record_buffer_t {
+		size_t count = 0;
+		size_t capacity = 0;
+		size_t entry_size = 0;
+		std::vector<uint8_t> data;
+	
+		record_buffer_t(const size_t capacity, const size_t entry_size)
+			:	capacity(capacity), entry_size(entry_size), data(capacity * entry_size) {}
+		uint8_t* entry_at(const size_t i) {
+			return data.data() + i * entry_size;
+		}
+	};
 }
 
 
@@ -0,0 +1,359 @@
+/*
+ * checkpoint.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: mad
+ */
+
+#ifndef INCLUDE_CHIA_CHECKPOINT_H_
+#define INCLUDE_CHIA_CHECKPOINT_H_
+
+#include "phase2.h"
+#include "phase3.h"
+#include "phase4.h"
+#include "DiskSort.hpp"
+#include "util.hpp"
+
+#include <map>
+#include <array>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <stdexcept>
+
+namespace mad {
+
+/*
+ * Manifest of the temporary files which make up the output of a phase.
+ * Written as "key=value" lines (UTF-8) at each phase boundary when
+ * input_t::checkpoint is set. A phase only leaves its input files in place
+ * in that case, they are removed via remove_files() once the next
+ * checkpoint has been saved.
+ */
+struct checkpoint_t {
+	int phase = 0;								// last completed phase
+	phase1::input_t params;						// ram_budget is not saved
+
+	std::array<table_t, 7> table;				// phase 1
+
+	table_t table_1;							// phase 2
+	table_t table_7;
+	std::wstring bitfield_file;
+	uint64_t bitfield_size = 0;
+	std::array<std::wstring, 6> sort_prefix;
+	int sort_key_size = 0;
+
+	int header_size = 0;						// phase 3
+	uint64_t num_written_7 = 0;
+	uint64_t final_pointer_7 = 0;
+	std::wstring plot_file_name;
+	std::wstring sort_7_prefix;
+	int sort_7_key_size = 0;
+
+	std::wstring final_plot_file_name;			// phase 4
+	uint64_t plot_size = 0;
+
+	std::map<std::string, std::string> extra;	// caller data, like the final destination
+
+	static std::wstring get_file_name(const std::wstring& tempDir, const std::wstring& plot_name) {
+		return tempDir + plot_name + L".checkpoint";
+	}
+
+	void set(const phase1::output_t& out) {
+		phase = 1;
+		params = out.params;
+		table = out.table;
+	}
+
+	// also writes a snapshot of bitfield_1
+	void set(const phase2::output_t& out) {
+		phase = 2;
+		table_1 = out.table_1;
+		table_7 = out.table_7;
+		bitfield_file = out.tempDir + out.plot_name + L".p2.bitfield_1.tmp";
+		bitfield_size = out.bitfield_1->size();
+		for(size_t i = 0; i < sort_prefix.size(); ++i) {
+			if(out.sort[i]) {
+				sort_prefix[i] = out.sort[i]->get_file_prefix();
+				sort_key_size = out.sort[i]->get_key_size();
+			}
+		}
+		FILE* file = FOPEN(bitfield_file.c_str(), L"wb");
+		if(!file) {
+			throw std::runtime_error("fopen() failed");
+		}
+		try {
+			out.bitfield_1->write(file);
+		} catch(...) {
+			fclose(file);
+			throw;
+		}
+		if(fclose(file)) {
+			throw std::runtime_error("fclose() failed");
+		}
+	}
+
+	void set(const phase3::output_t& out) {
+		phase = 3;
+		header_size = out.header_size;
+		num_written_7 = out.num_written_7;
+		final_pointer_7 = out.final_pointer_7;
+		plot_file_name = out.plot_file_name;
+		sort_7_prefix = out.sort_7->get_file_prefix();
+		sort_7_key_size = out.sort_7->get_key_size();
+	}
+
+	void set(const phase4::output_t& out) {
+		phase = 4;
+		final_plot_file_name = out.plot_file_name;
+		plot_size = out.plot_size;
+	}
+
+	void get(phase1::output_t& out) const {
+		check_phase(1);
+		out.params = params;
+		out.table = table;
+		get_common(out);
+	}
+
+	// re-opens the sorts read-only and loads the bitfield snapshot
+	void get(phase2::output_t& out) const {
+		check_phase(2);
+		out.params = params;
+		out.table_1 = table_1;
+		out.table_7 = table_7;
+		out.bitfield_1 = std::make_shared<bitfield>(bitfield_size);
+		FILE* file = FOPEN(bitfield_file.c_str(), L"rb");
+		if(!file) {
+			throw std::runtime_error("fopen() failed");
+		}
+		try {
+			out.bitfield_1->read(file);
+		} catch(...) {
+			fclose(file);
+			throw;
+		}
+		fclose(file);
+		for(size_t i = 0; i < sort_prefix.size(); ++i) {
+			if(!sort_prefix[i].empty()) {
+				out.sort[i] = std::make_shared<phase2::DiskSortT>(
+						sort_key_size, params.log_num_buckets, sort_prefix[i], true, nullptr, params.direct_io);
+			}
+		}
+		get_common(out);
+	}
+
+	void get(phase3::output_t& out) const {
+		check_phase(3);
+		out.params = params;
+		out.header_size = header_size;
+		out.num_written_7 = num_written_7;
+		out.final_pointer_7 = final_pointer_7;
+		out.plot_file_name = plot_file_name;
+		out.sort_7 = std::make_shared<phase3::DiskSortNP>(
+				sort_7_key_size, params.log_num_buckets, sort_7_prefix, true, nullptr, params.direct_io_2);
+		get_common(out);
+	}
+
+	void get(phase4::output_t& out) const {
+		check_phase(4);
+		out.params = params;
+		out.plot_file_name = final_plot_file_name;
+		out.plot_size = plot_size;
+	}
+
+	// deletes the files of a phase's output which are not passed on to the next phase
+	void remove_files(const int of_phase) const {
+		switch(of_phase) {
+			case 1:
+				for(size_t i = 1; i < table.size(); ++i) {
+					_wremove(table[i].file_name.c_str());
+				}
+				break;
+			case 2:
+				_wremove(table_1.file_name.c_str());
+				_wremove(table_7.file_name.c_str());
+				_wremove(bitfield_file.c_str());
+				for(const auto& prefix : sort_prefix) {
+					if(!prefix.empty()) {
+						phase2::DiskSortT::remove_files(prefix, params.log_num_buckets);
+					}
+				}
+				break;
+			case 3:
+				phase3::DiskSortNP::remove_files(sort_7_prefix, params.log_num_buckets);
+				break;
+		}
+	}
+
+	// writes to a temporary file first, so a crash never leaves a partial manifest
+	void save(const std::wstring& file_name) const {
+		std::map<std::string, std::string> values;
+		values["phase"] = std::to_string(phase);
+		values["id"] = hexStr(std::vector<uint8_t>(params.id.begin(), params.id.end()));
+		values["memo"] = hexStr(params.memo);
+		values["plot_name"] = ws2s(params.plot_name);
+		values["temp_dir"] = ws2s(params.tempDir);
+		values["temp_dir2"] = ws2s(params.tempDir2);
+		values["log_num_buckets"] = std::to_string(params.log_num_buckets);
+		values["num_threads"] = std::to_string(params.num_threads);
+		values["direct_io"] = std::to_string(int(params.direct_io));
+		values["direct_io_2"] = std::to_string(int(params.direct_io_2));
+		for(size_t i = 0; i < table.size(); ++i) {
+			set_table(values, "p1.table." + std::to_string(i + 1), table[i]);
+		}
+		if(phase >= 2) {
+			set_table(values, "p2.table_1", table_1);
+			set_table(values, "p2.table_7", table_7);
+			values["p2.bitfield.file"] = ws2s(bitfield_file);
+			values["p2.bitfield.size"] = std::to_string(bitfield_size);
+			values["p2.sort.key_size"] = std::to_string(sort_key_size);
+			for(size_t i = 0; i < sort_prefix.size(); ++i) {
+				if(!sort_prefix[i].empty()) {
+					values["p2.sort." + std::to_string(i)] = ws2s(sort_prefix[i]);
+				}
+			}
+		}
+		if(phase >= 3) {
+			values["p3.header_size"] = std::to_string(header_size);
+			values["p3.num_written_7"] = std::to_string(num_written_7);
+			values["p3.final_pointer_7"] = std::to_string(final_pointer_7);
+			values["p3.plot_file"] = ws2s(plot_file_name);
+			values["p3.sort_7"] = ws2s(sort_7_prefix);
+			values["p3.sort_7.key_size"] = std::to_string(sort_7_key_size);
+		}
+		if(phase >= 4) {
+			values["p4.plot_file"] = ws2s(final_plot_file_name);
+			values["p4.plot_size"] = std::to_string(plot_size);
+		}
+		for(const auto& entry : extra) {
+			values["extra." + entry.first] = entry.second;
+		}
+
+		const std::wstring tmp_name = file_name + L".tmp";
+		{
+			std::ofstream out(std::filesystem::path(tmp_name), std::ios::trunc);
+			for(const auto& entry : values) {
+				out << entry.first << '=' << entry.second << '\n';
+			}
+			out.flush();
+			if(!out) {
+				throw std::runtime_error("failed to write checkpoint " + ws2s(tmp_name));
+			}
+		}
+		std::error_code ec;
+		std::filesystem::rename(std::filesystem::path(tmp_name), std::filesystem::path(file_name), ec);
+		if(ec) {
+			throw std::runtime_error("failed to write checkpoint " + ws2s(file_name) + " (" + ec.message() + ")");
+		}
+	}
+
+	void load(const std::wstring& file_name) {
+		std::ifstream in{std::filesystem::path(file_name)};
+		if(!in) {
+			throw std::runtime_error("failed to open checkpoint " + ws2s(file_name));
+		}
+		std::map<std::string, std::string> values;
+		std::string line;
+		while(std::getline(in, line)) {
+			const auto pos = line.find('=');
+			if(pos != std::string::npos) {
+				values[line.substr(0, pos)] = line.substr(pos + 1);
+			}
+		}
+		*this = checkpoint_t();
+		phase = std::stoi(get_value(values, "phase"));
+
+		const auto id = get_value(values, "id");
+		if(id.size() != 2 * params.id.size()) {
+			throw std::runtime_error("invalid checkpoint: id");
+		}
+		HexToBytes(id, params.id.data());
+		const auto memo = get_value(values, "memo");
+		params.memo.resize(memo.size() / 2);
+		HexToBytes(memo, params.memo.data());
+		params.plot_name = s2ws(get_value(values, "plot_name"));
+		params.tempDir = s2ws(get_value(values, "temp_dir"));
+		params.tempDir2 = s2ws(get_value(values, "temp_dir2"));
+		params.log_num_buckets = std::stoi(get_value(values, "log_num_buckets"));
+		params.num_threads = std::stoi(get_value(values, "num_threads"));
+		params.direct_io = std::stoi(get_value(values, "direct_io"));
+		params.direct_io_2 = std::stoi(get_value(values, "direct_io_2"));
+		params.checkpoint = true;
+		for(size_t i = 0; i < table.size(); ++i) {
+			table[i] = get_table(values, "p1.table." + std::to_string(i + 1));
+		}
+		if(phase >= 2) {
+			table_1 = get_table(values, "p2.table_1");
+			table_7 = get_table(values, "p2.table_7");
+			bitfield_file = s2ws(get_value(values, "p2.bitfield.file"));
+			bitfield_size = std::stoull(get_value(values, "p2.bitfield.size"));
+			sort_key_size = std::stoi(get_value(values, "p2.sort.key_size"));
+			for(size_t i = 0; i < sort_prefix.size(); ++i) {
+				const auto iter = values.find("p2.sort." + std::to_string(i));
+				if(iter != values.end()) {
+					sort_prefix[i] = s2ws(iter->second);
+				}
+			}
+		}
+		if(phase >= 3) {
+			header_size = std::stoi(get_value(values, "p3.header_size"));
+			num_written_7 = std::stoull(get_value(values, "p3.num_written_7"));
+			final_pointer_7 = std::stoull(get_value(values, "p3.final_pointer_7"));
+			plot_file_name = s2ws(get_value(values, "p3.plot_file"));
+			sort_7_prefix = s2ws(get_value(values, "p3.sort_7"));
+			sort_7_key_size = std::stoi(get_value(values, "p3.sort_7.key_size"));
+		}
+		if(phase >= 4) {
+			final_plot_file_name = s2ws(get_value(values, "p4.plot_file"));
+			plot_size = std::stoull(get_value(values, "p4.plot_size"));
+		}
+		for(const auto& entry : values) {
+			if(entry.first.rfind("extra.", 0) == 0) {
+				extra[entry.first.substr(6)] = entry.second;
+			}
+		}
+	}
+
+private:
+	void check_phase(const int expected) const {
+		if(phase != expected) {
+			throw std::logic_error("checkpoint is at phase " + std::to_string(phase)
+					+ ", not " + std::to_string(expected));
+		}
+	}
+
+	template<typename T>
+	void get_common(T& out) const {
+		out.plot_name = params.plot_name;
+		out.tempDir = params.tempDir;
+		out.tempDir2 = params.tempDir2;
+		out.log_num_buckets = params.log_num_buckets;
+		out.num_threads = params.num_threads;
+	}
+
+	static void set_table(std::map<std::string, std::string>& values, const std::string& key, const table_t& table) {
+		values[key + ".file"] = ws2s(table.file_name);
+		values[key + ".entries"] = std::to_string(table.num_entries);
+	}
+
+	static table_t get_table(const std::map<std::string, std::string>& values, const std::string& key) {
+		table_t table;
+		table.file_name = s2ws(get_value(values, key + ".file"));
+		table.num_entries = std::stoull(get_value(values, key + ".entries"));
+		return table;
+	}
+
+	static const std::string& get_value(const std::map<std::string, std::string>& values, const std::string& key) {
+		const auto iter = values.find(key);
+		if(iter == values.end()) {
+			throw std::runtime_error("invalid checkpoint: missing " + key);
+		}
+		return iter->second;
+	}
+
+};
+
+} // mad
+
+#endif /* INCLUDE_CHIA_CHECKPOINT_H_ */
@@ -81,6 +81,11 @@ struct table_t {
 
 class DiskPlotterContext : public CreatePlotContext {
 	public:
+		DiskPlotterContext() {
+			// build all ANS encode tables up front, the park writers then never lock
+			tmCache.Prepare(kRValues, 6, TMemoCache::Tables::kEncode);
+			tmCache.Prepare(&kC3R, 1, TMemoCache::Tables::kEncode);
+		}
 		TMemoCache tmCache;
 	};
 }
@@ -9,47 +9,352 @@
 #define INCLUDE_CHIA_COPY_H_
 
 #include "settings.h"
+#include "AsyncWriter.h"
 
 #include <string>
 #include <vector>
+#include <future>
+#include <exception>
+#include <functional>
 #include <stdexcept>
 
 #include <cstdio>
 #include <cstdint>
 
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
 namespace mad {
+	// on_chunk is called with the number of bytes after each chunk written (optional)
+	typedef std::function<void(uint64_t)> copy_callback_t;
+
+#ifdef _WIN32
+	struct copy_progress_t {
+		const copy_callback_t* on_chunk = nullptr;
+		uint64_t num_bytes = 0;
+		std::exception_ptr error;
+	};
+
 	inline
-	uint64_t copy_file(const std::wstring& src_path, const std::wstring& dst_path)
+	DWORD CALLBACK copy_progress_routine(LARGE_INTEGER, LARGE_INTEGER total_transferred,
+			LARGE_INTEGER, LARGE_INTEGER, DWORD, DWORD, HANDLE, HANDLE, LPVOID data)
 	{
-		FILE* src = FOPEN(src_path.c_str(), L"rb");
-		if(!src) {
-			throw std::runtime_error("fopen() failed");
+		auto progress = (copy_progress_t*)data;
+		const uint64_t num_bytes = total_transferred.QuadPart;
+		if(num_bytes > progress->num_bytes) {
+			try {
+				(*progress->on_chunk)(num_bytes - progress->num_bytes);
+			} catch(...) {
+				progress->error = std::current_exception();
+				return PROGRESS_CANCEL;
+			}
+			progress->num_bytes = num_bytes;
 		}
-		FILE* dst = FOPEN(dst_path.c_str(), L"wb");
-		if(!dst) {
-			throw std::runtime_error("fopen() failed");
+		return PROGRESS_CONTINUE;
+	}
+
+	/*
+	 * Copies with CopyFileEx() in unbuffered mode, the kernel moves the data in large
+	 * chunks without going through the page cache.
+	 */
+	inline
+	uint64_t copy_file(const std::wstring& src_path, const std::wstring& dst_path,
+			const copy_callback_t& on_chunk = copy_callback_t())
+	{
+		copy_progress_t progress;
+		progress.on_chunk = &on_chunk;
+		BOOL cancel = FALSE;
+		if(!CopyFileExW(src_path.c_str(), dst_path.c_str(), on_chunk ? &copy_progress_routine : NULL,
+				&progress, &cancel, COPY_FILE_NO_BUFFERING))
+		{
+			if(progress.error) {
+				std::rethrow_exception(progress.error);
+			}
+			throw std::runtime_error("CopyFileEx() failed with " + std::to_string(GetLastError()));
 		}
-		uint64_t total_bytes = 0;
-		std::vector<uint8_t> buffer(g_read_chunk_size);
-		while(true) {
-			const auto num_bytes = fread(buffer.data(), 1, buffer.size(), src);
-			if(fwrite(buffer.data(), 1, num_bytes, dst) != num_bytes) {
-				throw std::runtime_error("fwrite() failed");
-			}
-			total_bytes += num_bytes;
-			if(num_bytes < buffer.size()) {
+		WIN32_FILE_ATTRIBUTE_DATA info = {};
+		if(!GetFileAttributesExW(dst_path.c_str(), GetFileExInfoStandard, &info)) {
+			return progress.num_bytes;
+		}
+		return (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	}
+#else
+	class copy_fd_t {
+	public:
+		explicit copy_fd_t(int fd = -1) : fd(fd) {}
+		~copy_fd_t() {
+			if(fd >= 0) {
+				::close(fd);
+			}
+		}
+		copy_fd_t(copy_fd_t&) = delete;
+		copy_fd_t& operator=(copy_fd_t&) = delete;
+		void reset(int new_fd) {
+			if(fd >= 0) {
+				::close(fd);
+			}
+			fd = new_fd;
+		}
+		int close() {
+			const int ret = ::close(fd);
+			fd = -1;
+			return ret;
+		}
+		int fd;
+	};
+
+	/*
+	 * Drops the copied ranges from the page cache, so that a plot copy does not evict
+	 * the cache of everything else. Written ranges are flushed one chunk behind,
+	 * so the device keeps writing while the next chunk is copied.
+	 */
+	class copy_cache_dropper_t {
+	public:
+		copy_cache_dropper_t(int src, int dst) : src(src), dst(dst) {
+#ifdef POSIX_FADV_SEQUENTIAL
+			posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		}
+		void add(const uint64_t offset, const uint64_t num_bytes) {
+#ifdef POSIX_FADV_DONTNEED
+			posix_fadvise(src, offset, num_bytes, POSIX_FADV_DONTNEED);
+#endif
+#ifdef __linux__
+			sync_file_range(dst, offset, num_bytes, SYNC_FILE_RANGE_WRITE);
+#endif
+			flush();
+			prev_offset = offset;
+			prev_bytes = num_bytes;
+		}
+		void flush() {
+			if(!prev_bytes) {
+				return;
+			}
+#ifdef __linux__
+			sync_file_range(dst, prev_offset, prev_bytes,
+					SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+			posix_fadvise(dst, prev_offset, prev_bytes, POSIX_FADV_DONTNEED);
+#endif
+			prev_bytes = 0;
+		}
+	private:
+		const int src;
+		const int dst;
+		uint64_t prev_offset = 0;
+		uint64_t prev_bytes = 0;
+	};
+
+	// reads up to num_bytes at offset, less only at the end of the file
+	inline
+	size_t copy_read(const int fd, uint8_t* buffer, const size_t num_bytes, const uint64_t offset)
+	{
+		size_t total = 0;
+		while(total < num_bytes) {
+			const auto ret = ::pread(fd, buffer + total, num_bytes - total, offset + total);
+			if(ret < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				throw std::runtime_error("pread() failed");
+			}
+			if(ret == 0) {
 				break;
 			}
+			total += ret;
 		}
-		if(fclose(dst)) {
-			throw std::runtime_error("fclose() failed");
+		return total;
+	}
+
+	inline
+	void copy_write(const int fd, const uint8_t* buffer, const size_t num_bytes, const uint64_t offset)
+	{
+		size_t total = 0;
+		while(total < num_bytes) {
+			const auto ret = ::pwrite(fd, buffer + total, num_bytes - total, offset + total);
+			if(ret < 0 && errno == EINTR) {
+				continue;
+			}
+			if(ret <= 0) {
+				throw std::runtime_error("pwrite() failed");
+			}
+			total += ret;
 		}
-		fclose(src);
-		return total_bytes;
 	}
 
+	// in-kernel copy, returns false if not supported for these files (nothing copied yet)
+	inline
+	bool copy_file_kernel(const int src, const int dst, const uint64_t file_size,
+			copy_cache_dropper_t& cache, const copy_callback_t& on_chunk)
+	{
+#ifdef __linux__
+		bool use_sendfile = false;
+		uint64_t total = 0;
+		while(total < file_size) {
+			const size_t count = std::min<uint64_t>(file_size - total, g_copy_chunk_size);
+			ssize_t ret = 0;
+			if(!use_sendfile) {
+				loff_t src_offset = total;
+				loff_t dst_offset = total;
+				ret = copy_file_range(src, &src_offset, dst, &dst_offset, count, 0);
+			} else {
+				off_t src_offset = total;
+				ret = sendfile(dst, src, &src_offset, count);
+			}
+			if(ret < 0 && errno == EINTR) {
+				continue;
+			}
+			if(ret < 0 && total == 0) {
+				if(errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+					if(use_sendfile) {
+						return false;
+					}
+					use_sendfile = true;
+					continue;
+				}
+			}
+			if(ret < 0) {
+				throw std::runtime_error(use_sendfile ? "sendfile() failed" : "copy_file_range() failed");
+			}
+			if(ret == 0) {
+				throw std::runtime_error("unexpected end of file");
+			}
+			cache.add(total, ret);
+			total += ret;
+			if(on_chunk) {
+				on_chunk(ret);
+			}
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	/*
+	 * Double buffered copy, the next chunk is read while the current one is written.
+	 * Both files are opened with O_DIRECT if possible, the tail is padded to
+	 * g_write_alignment and truncated again.
+	 */
+	inline
+	void copy_file_buffered(const std::string& src_path, const std::string& dst_path,
+			const int src_fd, const int dst_fd, const uint64_t file_size,
+			copy_cache_dropper_t& cache, const copy_callback_t& on_chunk)
+	{
+		copy_fd_t src_direct;
+		copy_fd_t dst_direct;
+#ifdef O_DIRECT
+		src_direct.reset(::open(src_path.c_str(), O_RDONLY | O_DIRECT));
+		if(src_direct.fd >= 0) {
+			dst_direct.reset(::open(dst_path.c_str(), O_WRONLY | O_DIRECT));
+		}
+#endif
+		const bool direct_io = src_direct.fd >= 0 && dst_direct.fd >= 0;
+		const int src = direct_io ? src_direct.fd : src_fd;
+		const int dst = direct_io ? dst_direct.fd : dst_fd;
+
+		uint8_t* buffers[2] = {AsyncWriter::alloc_aligned(g_copy_chunk_size), nullptr};
+		try {
+			buffers[1] = AsyncWriter::alloc_aligned(g_copy_chunk_size);
+		} catch(...) {
+			AsyncWriter::free_aligned(buffers[0]);
+			throw;
+		}
+		std::future<size_t> next;
+		try {
+			uint64_t offset = 0;
+			size_t num_bytes = copy_read(src, buffers[0], g_copy_chunk_size, 0);
+			for(int i = 0; num_bytes; ++i) {
+				uint8_t* buffer = buffers[i % 2];
+				uint8_t* next_buffer = buffers[(i + 1) % 2];
+				const uint64_t next_offset = offset + num_bytes;
+				if(num_bytes == g_copy_chunk_size) {
+					next = std::async(std::launch::async, [=]() {
+						return copy_read(src, next_buffer, g_copy_chunk_size, next_offset);
+					});
+				}
+				size_t write_size = num_bytes;
+				if(direct_io && write_size % g_write_alignment) {
+					write_size = cdiv(write_size, int(g_write_alignment)) * g_write_alignment;
+					memset(buffer + num_bytes, 0, write_size - num_bytes);
+				}
+				copy_write(dst, buffer, write_size, offset);
+				if(!direct_io) {
+					cache.add(offset, num_bytes);
+				}
+				if(on_chunk) {
+					on_chunk(num_bytes);
+				}
+				offset = next_offset;
+				num_bytes = next.valid() ? next.get() : 0;
+			}
+			if(offset != file_size) {
+				throw std::runtime_error("unexpected end of file");
+			}
+			if(direct_io && (file_size % g_write_alignment)) {
+				if(::ftruncate(dst, file_size)) {
+					throw std::runtime_error("ftruncate() failed");
+				}
+			}
+		} catch(...) {
+			if(next.valid()) {
+				next.wait();
+			}
+			AsyncWriter::free_aligned(buffers[0]);
+			AsyncWriter::free_aligned(buffers[1]);
+			throw;
+		}
+		AsyncWriter::free_aligned(buffers[0]);
+		AsyncWriter::free_aligned(buffers[1]);
+	}
+
+	/*
+	 * Copies in the kernel (copy_file_range / sendfile) if possible, otherwise with
+	 * a double buffered read / write loop. The source and destination are dropped
+	 * from the page cache as the copy goes.
+	 */
+	inline
+	uint64_t copy_file(const std::wstring& src_path, const std::wstring& dst_path,
+			const copy_callback_t& on_chunk = copy_callback_t())
+	{
+		const std::string src_name = ws2s(src_path);
+		const std::string dst_name = ws2s(dst_path);
+		copy_fd_t src(::open(src_name.c_str(), O_RDONLY));
+		if(src.fd < 0) {
+			throw std::runtime_error("open() failed");
+		}
+		struct stat info = {};
+		if(::fstat(src.fd, &info)) {
+			throw std::runtime_error("fstat() failed");
+		}
+		const uint64_t file_size = info.st_size;
+		copy_fd_t dst(::open(dst_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+		if(dst.fd < 0) {
+			throw std::runtime_error("open() failed");
+		}
+		copy_cache_dropper_t cache(src.fd, dst.fd);
+		if(!copy_file_kernel(src.fd, dst.fd, file_size, cache, on_chunk)) {
+			copy_file_buffered(src_name, dst_name, src.fd, dst.fd, file_size, cache, on_chunk);
+		}
+		cache.flush();
+		if(dst.close()) {
+			throw std::runtime_error("close() failed");
+		}
+		return file_size;
+	}
+#endif
+
 	inline
-	uint64_t final_copy(const std::wstring& src_path, const std::wstring& dst_path)
+	uint64_t final_copy(const std::wstring& src_path, const std::wstring& dst_path,
+			const copy_callback_t& on_chunk = copy_callback_t())
 	{
 		if(src_path == dst_path) {
 			return 0;
@@ -58,7 +363,7 @@ namespace mad {
 		uint64_t total_bytes = 0;
 		if(_wrename(src_path.c_str(), tmp_dst_path.c_str())) {
 			// try manual copy
-			total_bytes = copy_file(src_path, tmp_dst_path);
+			total_bytes = copy_file(src_path, tmp_dst_path, on_chunk);
 		}
 		_wremove(src_path.c_str());
 		_wrename(tmp_dst_path.c_str(), dst_path.c_str());
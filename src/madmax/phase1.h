@@ -29,6 +29,10 @@ struct input_t {
 	std::wstring tempDir2;
 	int log_num_buckets;
 	int num_threads;
+	bool direct_io = false;			// bypass page cache for files in tempDir
+	bool direct_io_2 = false;		// bypass page cache for files in tempDir2
+	std::shared_ptr<ram_budget_t> ram_budget;		// keeps tempDir2 buckets and phase 2 tables in RAM, optional
+	bool checkpoint = false;		// keep each phase's input files, see checkpoint.h
 };
 
 struct entry_1 {
@@ -224,4 +228,48 @@ struct output_t {
 
 } // phase1
 
+namespace mad {
+
+// y is the sort key, implied prefix is dropped
+template<>
+struct bucket_codec<phase1::entry_1, phase1::get_y<phase1::entry_1>> {
+	static constexpr bool is_packed = true;
+	static constexpr size_t num_bits = 32;
+	
+	static void write(const phase1::entry_1& entry, record_writer_t& out) {
+		out.write(entry.x, 32);
+	}
+	static void read(phase1::entry_1& entry, const uint64_t key, record_reader_t& in) {
+		entry.y = key;
+		entry.x = in.read(32);
+	}
+};
+
+template<int N>
+struct bucket_codec<phase1::entry_xm<N>, phase1::get_y<phase1::entry_xm<N>>> {
+	static constexpr bool is_packed = true;
+	static constexpr size_t num_bits = 32 + 10 + N * 32;
+	
+	static void write(const phase1::entry_xm<N>& entry, record_writer_t& out) {
+		out.write(entry.pos, 32);
+		out.write(entry.off, 10);
+		for(int i = 0; i < N; ++i) {
+			uint32_t tmp;
+			memcpy(&tmp, entry.meta.data() + i * 4, 4);
+			out.write(tmp, 32);
+		}
+	}
+	static void read(phase1::entry_xm<N>& entry, const uint64_t key, record_reader_t& in) {
+		entry.y = key;
+		entry.pos = in.read(32);
+		entry.off = in.read(10);
+		for(int i = 0; i < N; ++i) {
+			const uint32_t tmp = in.read(32);
+			memcpy(entry.meta.data() + i * 4, &tmp, 4);
+		}
+	}
+};
+
+} // mad
+
 #endif /* INCLUDE_CHIA_PHASE1_H_ */
@@ -12,33 +12,12 @@
 #include "ThreadPool.h"
 #include "DiskTable.h"
 #include "bits.hpp"
+#include "bc_matcher.hpp"
 
 #include "b3/blake3.h"
 #include "chacha8.h"
 
 namespace mad::phase1 {
-	static bool L_targets_initialized;
-	static uint16_t L_targets[2][kBC][kExtraBitsPow];
-	static void load_tables()
-	{
-		for (uint8_t parity = 0; parity < 2; parity++) {
-			for (uint16_t i = 0; i < kBC; i++) {
-				uint16_t indJ = i / kC;
-				for (uint16_t m = 0; m < kExtraBitsPow; m++) {
-					uint16_t yr =
-						((indJ + m) % kB) * kC + (((2 * m + parity) * (2 * m + parity) + i) % kC);
-					L_targets[parity][i][m] = yr;
-				}
-			}
-		}
-	}
-	static void initialize() {
-		if (!L_targets_initialized) {
-			L_targets_initialized = true;
-			load_tables();
-		}		
-	}
-
 	class F1Calculator {
 	public:
 		F1Calculator(const uint8_t* orig_key)
@@ -54,25 +33,37 @@ namespace mad::phase1 {
 		}
 
 		/*
-		 * x = [index * 16 .. index * 16 + 15]
-		 * block = entry_1[16]
+		 * x = [first_block * 16 .. (first_block + num_blocks) * 16 - 1]
+		 * out = entry_1[num_blocks * 16]
 		 */
-		void compute_block(const uint64_t index, entry_1* block)
+		void compute_blocks(const uint64_t first_block, const size_t num_blocks, entry_1* out)
 		{
-			uint8_t buf[64];
-			chacha8_get_keystream(&enc_ctx_, index, 1, buf);
-		
-			for(uint64_t i = 0; i < 16; ++i)
+			for(size_t offset = 0; offset < num_blocks; offset += batch_size)
 			{
-				const uint64_t x = index * 16 + i;
-				const uint64_t y = SliceInt64FromBytes(buf, i * 32, 32);
-				block[i].x = x;
-				block[i].y = (y << kExtraBits) | (x >> (32 - kExtraBits));
+				const size_t count = std::min(num_blocks - offset, batch_size);
+				const uint64_t index = first_block + offset;
+
+				// multi-block keystream, computed with SIMD where available
+				chacha8_get_keystream(&enc_ctx_, index, count, buf);
+
+				entry_1* block = out + offset * 16;
+				for(size_t i = 0; i < count * 16; ++i)
+				{
+					uint32_t tmp;
+					memcpy(&tmp, buf + i * 4, 4);
+					const uint64_t x = index * 16 + i;
+					const uint64_t y = bswap_32(tmp);	// k = 32 bits, big-endian
+					block[i].x = x;
+					block[i].y = (y << kExtraBits) | (x >> (32 - kExtraBits));
+				}
 			}
 		}
 
 	private:
+		static constexpr size_t batch_size = 256;	// blocks per keystream call
+
 		chacha8_ctx enc_ctx_ {};
+		uint8_t buf[batch_size * 64];
 	};
 
 	// Class to evaluate F2 .. F7.
@@ -80,6 +71,7 @@ namespace mad::phase1 {
 	class FxCalculator {
 	public:
 		static constexpr uint8_t k_ = 32;
+		static constexpr size_t batch_size = 64;		// inputs per blake3_hash_many_short()
 	
 		FxCalculator(int table_index) {
 			table_index_ = table_index;
@@ -88,72 +80,91 @@ namespace mad::phase1 {
 		// Disable copying
 		FxCalculator(const FxCalculator&) = delete;
 
-		// Performs one evaluation of the f function.
-		void evaluate(const T& L, const T& R, S& entry) const
+		// Evaluates the f function for a block of matches, output[i] = f(matches[i]).
+		void evaluate(const match_t<T>* matches, const size_t count, S* output) const
 		{
-			Bits C;
-			Bits input;
-			uint8_t input_bytes[64];
-			uint8_t hash_bytes[32];
-			uint8_t L_meta[16];
-			uint8_t R_meta[16];
-        
-			size_t L_meta_bytes = 0;
-			size_t R_meta_bytes = 0;
-			get_meta<T>{}(L, L_meta, &L_meta_bytes);
-			get_meta<T>{}(R, R_meta, &R_meta_bytes);
-        
-			const Bits Y_1(L.y, k_ + kExtraBits);
-			const Bits L_c(L_meta, L_meta_bytes, L_meta_bytes * 8);
-			const Bits R_c(R_meta, R_meta_bytes, R_meta_bytes * 8);
-
-			if (table_index_ < 4) {
-				C = L_c + R_c;
-				input = Y_1 + C;
-			} else {
-				input = Y_1 + L_c + R_c;
+			uint8_t input[batch_size][BLAKE3_BLOCK_LEN];
+			uint8_t meta[batch_size][32];
+			uint8_t hash[batch_size][BLAKE3_OUT_LEN];
+			const uint8_t* inputs[batch_size];
+			for(size_t i = 0; i < batch_size; ++i) {
+				inputs[i] = input[i];
 			}
-			input.ToBytes(input_bytes);
-
-			blake3_hasher hasher;
-			blake3_hasher_init(&hasher);
-			blake3_hasher_update(&hasher, input_bytes, cdiv(input.GetSize(), 8));
-			blake3_hasher_finalize(&hasher, hash_bytes, sizeof(hash_bytes));
-
-			entry.y = EightBytesToInt(hash_bytes) >> (64 - (k_ + (table_index_ < 7 ? kExtraBits : 0)));
-
-			if (table_index_ < 4) {
-				// c is already computed
-			} else if (table_index_ < 7) {
-				uint8_t len = kVectorLens[table_index_ + 1];
-				uint8_t start_byte = (k_ + kExtraBits) / 8;
-				uint8_t end_bit = k_ + kExtraBits + k_ * len;
-				uint8_t end_byte = cdiv(end_bit, 8);
-
-				// TODO: proper support for partial bytes in Bits ctor
-				C = Bits(hash_bytes + start_byte, end_byte - start_byte, (end_byte - start_byte) * 8);
-
-				C = C.Slice((k_ + kExtraBits) % 8, end_bit - start_byte * 8);
+			const int y_shift = 64 - (k_ + (table_index_ < 7 ? kExtraBits : 0));
+		
+			for(size_t offset = 0; offset < count; offset += batch_size)
+			{
+				const size_t num_inputs = std::min(count - offset, batch_size);
+				size_t meta_bytes = 0;
+				for(size_t i = 0; i < num_inputs; ++i) {
+					const auto& match = matches[offset + i];
+					meta_bytes = pack_input(match.left, match.right, input[i], meta[i]);
+				}
+				// input = y (38 bits) + L_meta + R_meta
+				blake3_hash_many_short(inputs, num_inputs, 5 + meta_bytes, hash[0]);
+			
+				for(size_t i = 0; i < num_inputs; ++i) {
+					const auto& match = matches[offset + i];
+					auto& entry = output[offset + i];
+					entry.pos = match.pos;
+					entry.off = match.off;
+					entry.y = EightBytesToInt(hash[i]) >> y_shift;
+				
+					if(table_index_ < 4) {
+						// C = L_meta + R_meta
+						set_meta<S>{}(entry, meta[i], meta_bytes);
+					} else if(table_index_ < 7) {
+						// C = hash bits [k + kExtraBits, k + kExtraBits + k * len)
+						static_assert((k_ + kExtraBits) / 8 == 4 && (k_ + kExtraBits) % 8 == 6);
+						const size_t C_bytes = k_ / 8 * kVectorLens[table_index_ + 1];
+						uint8_t C[16];
+						for(size_t j = 0; j < C_bytes; ++j) {
+							C[j] = (hash[i][4 + j] << 6) | (hash[i][5 + j] >> 2);
+						}
+						set_meta<S>{}(entry, C, C_bytes);
+					} else {
+						set_meta<S>{}(entry, nullptr, 0);
+					}
+				}
 			}
-			uint8_t C_bytes[16];
-			C.ToBytes(C_bytes);
-			set_meta<S>{}(entry, C_bytes, C.GetSize() / 8);
 		}
 
+	private:
+		/*
+		 * Writes y as 38 bits big-endian followed by L_meta + R_meta at bit 38,
+		 * zero padded to BLAKE3_BLOCK_LEN bytes.
+		 * meta = L_meta + R_meta, returns meta size in bytes.
+		 */
+		static size_t pack_input(const T& L, const T& R, uint8_t* buf, uint8_t* meta)
+		{
+			size_t L_bytes = 0;
+			size_t R_bytes = 0;
+			get_meta<T>{}(L, meta, &L_bytes);
+			get_meta<T>{}(R, meta + L_bytes, &R_bytes);
+			const size_t num_bytes = L_bytes + R_bytes;
+		
+			const uint64_t y = bswap_64(L.y << (64 - (k_ + kExtraBits)));
+			memcpy(buf, &y, 8);
+			for(size_t i = 0; i < num_bytes; ++i) {
+				buf[4 + i] |= meta[i] >> 6;
+				buf[5 + i] = meta[i] << 2;
+			}
+			memset(buf + 5 + num_bytes, 0, BLAKE3_BLOCK_LEN - 5 - num_bytes);
+			return num_bytes;
+		}
+	
 	private:
 		int table_index_ = 0;
 	};
 
+	static_assert(kBC == BC_MATCH_KBC && kExtraBitsPow == BC_MATCH_NUM_TARGETS, "BC group mismatch");
+
 	template<typename T>
 	class FxMatcher {
 	public:
-		struct rmap_item {
-			uint16_t pos;
-			uint16_t count;
-		};
-	
-		FxMatcher() {
-			rmap.resize(kBC);
+		FxMatcher()
+			:	idx_L(kBC), idx_R(kBC)
+		{
 		}
 
 		// Disable copying
@@ -168,62 +179,26 @@ namespace mad::phase1 {
 		//   (yr % kBC) / kC - (yl % kBC) / kC = m   (mod kB)  AND
 		//   (yr % kBC) % kC - (yl % kBC) % kC = (2m + (yl/kBC) % 2)^2   (mod kC)
 		//
-		// Instead of doing the naive algorithm, which is an O(kExtraBitsPow * N^2) comparisons on
-		// bucket length, we can store all the R values and lookup each of our 32 candidates to see if
-		// any R value matches. This function can be further optimized by removing the inner loop, and
-		// being more careful with memory allocation.
+		// The R values are stored in a map indexed by yr % kBC, the 64 candidates of each
+		// L value are then looked up with SIMD gathers (see BCMatcher).
 		int find_matches_ex(
 			const std::vector<T>& bucket_L,
 			const std::vector<T>& bucket_R,
 			uint16_t* idx_L,
-			uint16_t* idx_R)
+			uint16_t* idx_R,
+			const size_t max_matches = kBC)
 		{
-			if(bucket_L.empty() || bucket_R.empty()) {
-        		return 0;
-			}
-    		const uint16_t parity = (bucket_L[0].y / kBC) % 2;
-
-			for (auto yl : rmap_clean) {
-				rmap[yl].count = 0;
-			}
-			rmap_clean.clear();
-
-			const uint64_t offset = (bucket_R[0].y / kBC) * kBC;
-			for (size_t pos_R = 0; pos_R < bucket_R.size(); pos_R++) {
-				const uint64_t r_y = bucket_R[pos_R].y - offset;
-
-				if (!rmap[r_y].count) {
-					rmap[r_y].pos = pos_R;
-				}
-				rmap[r_y].count++;
-				rmap_clean.push_back(r_y);
-			}
-
-			int idx_count = 0;
-			const uint64_t offset_y = offset - kBC;
-			for (size_t pos_L = 0; pos_L < bucket_L.size(); pos_L++) {
-				const uint64_t r = bucket_L[pos_L].y - offset_y;
-				for (int i = 0; i < kExtraBitsPow; i++) {
-					const uint16_t r_target = L_targets[parity][r][i];
-					for (size_t j = 0; j < rmap[r_target].count; j++) {
-						idx_L[idx_count] = pos_L;
-						idx_R[idx_count] = rmap[r_target].pos + j;
-						idx_count++;
-					}
-				}
-			}
-			return idx_count;
+			return matcher.find_matches(bucket_L.data(), bucket_L.size(),
+					bucket_R.data(), bucket_R.size(), idx_L, idx_R, max_matches);
 		}
-    
+
 		int find_matches(	const uint64_t& L_pos_begin,
 							const std::vector<T>& bucket_L,
 							const std::vector<T>& bucket_R,
 							std::vector<match_t<T>>& out)
 		{
-    		uint16_t* idx_L = new uint16_t[kBC];
-			uint16_t* idx_R = new uint16_t[kBC];
-			const int count = find_matches_ex(bucket_L, bucket_R, idx_L, idx_R);
-		
+			const int count = find_matches_ex(bucket_L, bucket_R, idx_L.data(), idx_R.data(), idx_L.size());
+
 			for(int i = 0; i < count; ++i) {
 				const auto pos = L_pos_begin + idx_L[i];
 				if(pos < (uint64_t(1) << 32)) {
@@ -235,15 +210,13 @@ namespace mad::phase1 {
 					out.push_back(match);
 				}
 			}
-
-			delete[] idx_L;
-			delete[] idx_R;
 			return count;
 		}
 
 	private:
-		std::vector<rmap_item> rmap;
-		std::vector<size_t> rmap_clean;
+		BCMatcher matcher;
+		std::vector<uint16_t> idx_L;
+		std::vector<uint16_t> idx_R;
 	};
 
 
@@ -271,22 +244,20 @@ namespace mad::phase1 {
 					if(!cache) {
 						cache = T1_sort->add_cache();
 					}
-					this->context->getCurrentTask()->totalWorkItem += input.size();
+					const auto task = this->context->getCurrentTask();
+					task->totalWorkItem.add(input.size());
 					for(auto& entry : input) {
 						cache->add(entry);
-						this->context->getCurrentTask()->completedWorkItem++;
 					}
-				}, nullptr, std::max(num_threads / 2, 1), "phase1/add");
+					task->completedWorkItem.add(input.size());
+				}, nullptr, std::max(num_threads / 2, 1), "phase1/add", false);
 	
 			ThreadPool<uint64_t, std::vector<entry_1>> pool(
 				[id, this](uint64_t& block, std::vector<entry_1>& out, size_t&) {
 					out.resize(M * 16);
 					F1Calculator F1(id);
-					
-					for(size_t i = 0; i < M; ++i) {
-						F1.compute_block(block * M + i, &out[i * 16]);						
-					}
-				}, &output, num_threads, "phase1/F1");
+					F1.compute_blocks(block * M, M, out.data());
+				}, &output, num_threads, "phase1/F1", true, true);
 	
 			for(uint64_t k = 0; k < (uint64_t(1) << 28) / M; ++k) {
 				pool.take_copy(k);
@@ -326,7 +297,7 @@ namespace mad::phase1 {
 					for(auto& entry : input) {
 						cache->add(entry);
 					}
-				}, nullptr, std::max(num_threads / 2, 1), "phase1/add");
+				}, nullptr, std::max(num_threads / 2, 1), "phase1/add", false);
 	
 			Processor<std::vector<S>>* R_out = &R_add;
 			if(R_tmp_out) {
@@ -335,16 +306,10 @@ namespace mad::phase1 {
 	
 			ThreadPool<std::vector<match_t<T>>, std::vector<S>> eval_pool(
 				[R_index](std::vector<match_t<T>>& matches, std::vector<S>& out, size_t&) {
-					out.reserve(matches.size());
+					out.resize(matches.size());
 					FxCalculator<T, S> Fx(R_index);
-					for(const auto& match : matches) {
-						S entry;
-						entry.pos = match.pos;
-						entry.off = match.off;
-						Fx.evaluate(match.left, match.right, entry);
-						out.push_back(entry);
-					}
-				}, R_out, num_threads, "phase1/eval");
+					Fx.evaluate(matches.data(), matches.size(), out.data());
+				}, R_out, num_threads, "phase1/eval", true, true);
 	
 			ThreadPool<std::vector<match_input_t>, std::vector<match_t<T>>, FxMatcher<T>> match_pool(
 				[&num_found, &num_written]
@@ -354,7 +319,7 @@ namespace mad::phase1 {
 						num_found += Fx.find_matches(pair.L_offset[1], *pair.L_bucket[1], *pair.L_bucket[0], out);
 					}
 					num_written += out.size();
-				}, &eval_pool, num_threads, "phase1/match");
+				}, &eval_pool, num_threads, "phase1/match", true, true);
 	
 			Thread<std::pair<std::vector<T>, size_t>> read_thread(		
 				[&L_index, &L_offset, &L_bucket, &avg_bucket_size, &match_pool, L_tmp_out]
@@ -426,22 +391,24 @@ namespace mad::phase1 {
 		{
 			Thread<std::vector<T>> L_write(
 				[L_tmp, this](std::vector<T>& input) {
-					this->context->getCurrentTask()->totalWorkItem += input.size();
+					const auto task = this->context->getCurrentTask();
+					task->totalWorkItem.add(input.size());
 					for(const auto& entry : input) {
 						R tmp;
 						tmp.assign(entry);
 						L_tmp->write(tmp);
-						this->context->getCurrentTask()->completedWorkItem++;
 					}
+					task->completedWorkItem.add(input.size());
 				}, "phase1/write/L");
 	
 			Thread<std::vector<S>> R_write(
 				[R_tmp, this](std::vector<S>& input) {
-					this->context->getCurrentTask()->totalWorkItem += input.size();
+					const auto task = this->context->getCurrentTask();
+					task->totalWorkItem.add(input.size());
 					for(const auto& entry : input) {
 						R_tmp->write(entry);
-						this->context->getCurrentTask()->completedWorkItem++;
 					}
+					task->completedWorkItem.add(input.size());
 				}, "phase1/write/R");
 	
 			const auto begin = get_wall_time_micros();
@@ -472,8 +439,6 @@ namespace mad::phase1 {
 		{
 			const auto total_begin = get_wall_time_micros();
 	
-			initialize();
-	
 			const std::wstring prefix = input.tempDir + input.plot_name + L".p1.";
 			const std::wstring prefix_2 = input.tempDir2 + input.plot_name + L".p1.";
 			const uint8_t k = 32;
@@ -488,48 +453,48 @@ namespace mad::phase1 {
 			context->pushTask("Phase1.Table1", currentTask);
 
 			context->getCurrentTask()->start();
-			DiskSort1 sort_1(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t1", false, context);
+			DiskSort1 sort_1(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t1", false, context, input.direct_io_2, input.ram_budget);
 			compute_f1(input.id.data(), input.num_threads, &sort_1);
 			context->popTask();
 
 			context->getCurrentTask()->start();
-			DiskTable<tmp_entry_1> tmp_1(prefix + L"table1.tmp",0,context);
-			DiskSort2 sort_2(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t2", false, context);
+			DiskTable<tmp_entry_1> tmp_1(prefix + L"table1.tmp",0,context,input.direct_io);
+			DiskSort2 sort_2(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t2", false, context, input.direct_io_2, input.ram_budget);
 			compute_table<entry_1, entry_2, tmp_entry_1>(
 					2, input.num_threads, &sort_1, &sort_2, &tmp_1);
 			context->popTask();
 	
 			context->getCurrentTask()->start();
-			DiskTable<tmp_entry_x> tmp_2(prefix + L"table2.tmp",0,context);
-			DiskSort3 sort_3(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t3", false, context);
+			DiskTable<tmp_entry_x> tmp_2(prefix + L"table2.tmp",0,context,input.direct_io);
+			DiskSort3 sort_3(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t3", false, context, input.direct_io_2, input.ram_budget);
 			compute_table<entry_2, entry_3, tmp_entry_x>(
 					3, input.num_threads, &sort_2, &sort_3, &tmp_2);
 			context->popTask();
 	
 			context->getCurrentTask()->start();
-			DiskTable<tmp_entry_x> tmp_3(prefix + L"table3.tmp",0,context);
-			DiskSort4 sort_4(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t4", false, context);
+			DiskTable<tmp_entry_x> tmp_3(prefix + L"table3.tmp",0,context,input.direct_io);
+			DiskSort4 sort_4(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t4", false, context, input.direct_io_2, input.ram_budget);
 			compute_table<entry_3, entry_4, tmp_entry_x>(
 					4, input.num_threads, &sort_3, &sort_4, &tmp_3);
 			context->popTask();
 	
 			context->getCurrentTask()->start();
-			DiskTable<tmp_entry_x> tmp_4(prefix + L"table4.tmp",0,context);
-			DiskSort5 sort_5(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t5", false, context);
+			DiskTable<tmp_entry_x> tmp_4(prefix + L"table4.tmp",0,context,input.direct_io);
+			DiskSort5 sort_5(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t5", false, context, input.direct_io_2, input.ram_budget);
 			compute_table<entry_4, entry_5, tmp_entry_x>(
 					5, input.num_threads, &sort_4, &sort_5, &tmp_4);
 			context->popTask();
 	
 			context->getCurrentTask()->start();
-			DiskTable<tmp_entry_x> tmp_5(prefix + L"table5.tmp",0,context);
-			DiskSort6 sort_6(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t6", false, context);
+			DiskTable<tmp_entry_x> tmp_5(prefix + L"table5.tmp",0,context,input.direct_io);
+			DiskSort6 sort_6(k + kExtraBits, input.log_num_buckets, prefix_2 + L"t6", false, context, input.direct_io_2, input.ram_budget);
 			compute_table<entry_5, entry_6, tmp_entry_x>(
 					6, input.num_threads, &sort_5, &sort_6, &tmp_5);
 			context->popTask();
 	
 			context->getCurrentTask()->start();
-			DiskTable<tmp_entry_x> tmp_6(prefix + L"table6.tmp",0,context);
-			DiskTable<entry_7> tmp_7(prefix_2 + L"table7.tmp",0,context);
+			DiskTable<tmp_entry_x> tmp_6(prefix + L"table6.tmp",0,context,input.direct_io);
+			DiskTable<entry_7> tmp_7(prefix_2 + L"table7.tmp",0,context,input.direct_io_2);
 			compute_table<entry_6, entry_7, tmp_entry_x, DiskSort6, DiskSort7>(
 					7, input.num_threads, &sort_6, nullptr, &tmp_6, &tmp_7);
 			context->popTask();
@@ -90,4 +90,25 @@ struct output_t {
 
 } // phase2
 
+namespace mad {
+
+// pos is the sort key, implied prefix is dropped
+template<>
+struct bucket_codec<phase2::entry_x, phase2::get_pos<phase2::entry_x>> {
+	static constexpr bool is_packed = true;
+	static constexpr size_t num_bits = 32 + 10;
+	
+	static void write(const phase2::entry_x& entry, record_writer_t& out) {
+		out.write(entry.key, 32);
+		out.write(entry.off, 10);
+	}
+	static void read(phase2::entry_x& entry, const uint64_t key, record_reader_t& in) {
+		entry.pos = key;
+		entry.key = in.read(32);
+		entry.off = in.read(10);
+	}
+};
+
+} // mad
+
 #endif /* INCLUDE_CHIA_PHASE2_H_ */
@@ -21,27 +21,38 @@ void compute_table(	int R_index, int num_threads,
 					const table_t& R_table,
 					bitfield* L_used,
 					const bitfield* R_used,
+					ram_budget_t* ram_budget,
 					DiskPlotterContext& context)
 {
 	const int num_threads_read = std::max(num_threads / 4, 2);
 	
 	DiskTable<T> R_input(R_table);
+	
+	// keep the table in RAM for the second pass if the budget allows
+	std::unique_ptr<TableCache<T>> R_cache;
+	const auto cache_bytes = TableCache<T>::get_num_bytes(R_table.num_entries);
+	if(ram_budget && ram_budget->try_acquire(cache_bytes)) {
+		R_cache = std::make_unique<TableCache<T>>(R_table.num_entries);
+	}
 	{
 		const auto begin = get_wall_time_micros();
 		
 		ThreadPool<std::pair<std::vector<T>, size_t>, size_t> pool(
-			[L_used, R_used, &context](std::pair<std::vector<T>, size_t>& input, size_t&, size_t&) {
+			[L_used, R_used, &R_cache, &context](std::pair<std::vector<T>, size_t>& input, size_t&, size_t&) {
+				if(R_cache) {
+					R_cache->write_block(input);
+				}
 				uint64_t offset = 0;
-				context.getCurrentTask()->totalWorkItem += input.first.size();
+				const auto task = context.getCurrentTask();
+				task->totalWorkItem.add(input.first.size());
 				for(const auto& entry : input.first) {
 					if(R_used && !R_used->get(input.second + (offset++))) {
-						context.getCurrentTask()->completedWorkItem++;
 						continue;	// drop it
 					}
 					L_used->set(entry.pos);
 					L_used->set(uint64_t(entry.pos) + entry.off);
-					context.getCurrentTask()->completedWorkItem++;
 				}
+				task->completedWorkItem.add(input.first.size());
 			}, nullptr, num_threads, "phase2/mark");
 		
 		L_used->clear();
@@ -49,22 +60,24 @@ void compute_table(	int R_index, int num_threads,
 		pool.close();
 		
 		context.log("[P2] Table " + std::to_string(R_index) + " scan took "
-				+ std::to_string((get_wall_time_micros() - begin) / 1e6) + " sec");
+				+ std::to_string((get_wall_time_micros() - begin) / 1e6) + " sec"
+				+ (R_cache ? ", cached " + std::to_string(cache_bytes >> 20) + " MB in RAM" : ""));
 	}
 	const auto begin = get_wall_time_micros();
 	
 	uint64_t num_written = 0;
-	const bitfield_index index(*L_used);
+	const bitfield_index index(*L_used, num_threads);
 	
 	typedef typename DS::WriteCache WriteCache;
 	
 	Thread<std::vector<S>> R_write(
 		[R_file, &context](std::vector<S>& input) {
-			context.getCurrentTask()->totalWorkItem += input.size();
+			const auto task = context.getCurrentTask();
+			task->totalWorkItem.add(input.size());
 			for(auto& entry : input) {
 				R_file->write(entry);
-				context.getCurrentTask()->completedWorkItem++;
 			}
+			task->completedWorkItem.add(input.size());
 		}, "phase2/write");
 	
 	ThreadPool<std::vector<S>, size_t, std::shared_ptr<WriteCache>> R_add(
@@ -72,12 +85,13 @@ void compute_table(	int R_index, int num_threads,
 			if(!cache) {
 				cache = R_sort->add_cache();
 			}
-			context.getCurrentTask()->totalWorkItem += input.size();
+			const auto task = context.getCurrentTask();
+			task->totalWorkItem.add(input.size());
 			for(auto& entry : input) {
 				cache->add(entry);
-				context.getCurrentTask()->completedWorkItem++;
 			}
-		}, nullptr, std::max(num_threads / 2, 1), "phase2/add");
+			task->completedWorkItem.add(input.size());
+		}, nullptr, std::max(num_threads / 2, 1), "phase2/add", false);
 	
 	Processor<std::vector<S>>* R_out = &R_add;
 	if(R_file) {
@@ -86,11 +100,12 @@ void compute_table(	int R_index, int num_threads,
 	
 	Thread<std::vector<S>> R_count(
 		[R_out, &num_written, &context](std::vector<S>& input) {
-			context.getCurrentTask()->totalWorkItem += input.size();
+			const auto task = context.getCurrentTask();
+			task->totalWorkItem.add(input.size());
 			for(auto& entry : input) {
 				set_sort_key<S>{}(entry, num_written++);
-				context.getCurrentTask()->completedWorkItem++;
 			}
+			task->completedWorkItem.add(input.size());
 			R_out->take(input);
 		}, "phase2/count");
 	
@@ -98,10 +113,10 @@ void compute_table(	int R_index, int num_threads,
 		[&index, R_used, &context](std::pair<std::vector<T>, size_t>& input, std::vector<S>& out, size_t&) {
 			out.reserve(input.first.size());
 			uint64_t offset = 0;
-			context.getCurrentTask()->totalWorkItem += input.first.size();
+			const auto task = context.getCurrentTask();
+			task->totalWorkItem.add(input.first.size());
 			for(const auto& entry : input.first) {
 				if(R_used && !R_used->get(input.second + (offset++))) {
-					context.getCurrentTask()->completedWorkItem++;
 					continue;	// drop it
 				}
 				S tmp;
@@ -110,17 +125,25 @@ void compute_table(	int R_index, int num_threads,
 				tmp.pos = pos_off.first;
 				tmp.off = pos_off.second;
 				out.push_back(tmp);
-				context.getCurrentTask()->completedWorkItem++;
 			}
-		}, &R_count, num_threads*2, "phase2/remap");
+			task->completedWorkItem.add(input.first.size());
+		}, &R_count, num_threads*2, "phase2/remap", true, true);
 	
-	R_input.read(&map_pool, num_threads_read);
+	if(R_cache) {
+		R_cache->read(&map_pool, num_threads_read);
+	} else {
+		R_input.read(&map_pool, num_threads_read);
+	}
 	
 	map_pool.close();
 	R_count.close();
 	R_write.close();
 	R_add.close();
 	
+	if(R_cache) {
+		R_cache = nullptr;
+		ram_budget->release(cache_bytes);
+	}
 	if(R_sort) {
 		R_sort->finish();
 	}
@@ -160,13 +183,16 @@ void compute(	DiskPlotterContext& context,
 	auto curr_bitfield = std::make_shared<bitfield>(max_table_size);
 	auto next_bitfield = std::make_shared<bitfield>(max_table_size);
 	
-	DiskTable<entry_7> table_7(prefix_2 + L"table7.tmp");
+	DiskTable<entry_7> table_7(prefix_2 + L"table7.tmp", 0, nullptr, input.params.direct_io_2);
 	
 	compute_table<entry_7, entry_7, DiskSort7>(
-			7, input.num_threads, nullptr, &table_7, input.table[6], next_bitfield.get(), nullptr, context);
+			7, input.num_threads, nullptr, &table_7, input.table[6], next_bitfield.get(), nullptr,
+			input.params.ram_budget.get(), context);
 	
 	table_7.close();
-	_wremove(input.table[6].file_name.c_str());
+	if(!input.params.checkpoint) {
+		_wremove(input.table[6].file_name.c_str());
+	}
 
 	context.popTask();
 	
@@ -174,12 +200,16 @@ void compute(	DiskPlotterContext& context,
 	{
 		context.getCurrentTask()->start();
 		std::swap(curr_bitfield, next_bitfield);
-		out.sort[i] = std::make_shared<DiskSortT>(32, input.log_num_buckets, prefix + L"t" + std::to_wstring(i + 1));
+		out.sort[i] = std::make_shared<DiskSortT>(32, input.log_num_buckets, prefix + L"t" + std::to_wstring(i + 1),
+				false, nullptr, input.params.direct_io);
 		
 		compute_table<phase1::tmp_entry_x, entry_x, DiskSortT>(
-			i + 1, input.num_threads, out.sort[i].get(), nullptr, input.table[i], next_bitfield.get(), curr_bitfield.get(), context);
+			i + 1, input.num_threads, out.sort[i].get(), nullptr, input.table[i], next_bitfield.get(), curr_bitfield.get(),
+			input.params.ram_budget.get(), context);
 		
-		_wremove(input.table[i].file_name.c_str());
+		if(!input.params.checkpoint) {
+			_wremove(input.table[i].file_name.c_str());
+		}
 		context.popTask();
 	}
 	
@@ -109,4 +109,38 @@ struct output_t {
 
 } // phase3
 
+namespace mad {
+
+// line point is the sort key, implied prefix is dropped
+template<>
+struct bucket_codec<phase3::entry_lp, phase3::get_line_point<phase3::entry_lp>> {
+	static constexpr bool is_packed = true;
+	static constexpr size_t num_bits = 32;
+	
+	static void write(const phase3::entry_lp& entry, record_writer_t& out) {
+		out.write(entry.key, 32);
+	}
+	static void read(phase3::entry_lp& entry, const uint64_t key, record_reader_t& in) {
+		entry.point = key;
+		entry.key = in.read(32);
+	}
+};
+
+// key (sort_key) is the sort key, implied prefix is dropped
+template<>
+struct bucket_codec<phase3::entry_np, phase3::get_sort_key<phase3::entry_np>> {
+	static constexpr bool is_packed = true;
+	static constexpr size_t num_bits = 32;
+	
+	static void write(const phase3::entry_np& entry, record_writer_t& out) {
+		out.write(entry.pos, 32);
+	}
+	static void read(phase3::entry_np& entry, const uint64_t key, record_reader_t& in) {
+		entry.key = key;
+		entry.pos = in.read(32);
+	}
+};
+
+} // mad
+
 #endif /* INCLUDE_CHIA_PHASE3_H_ */
@@ -11,7 +11,9 @@
 #include "chia.h"
 #include "phase3.h"
 #include "encoding.hpp"
+#include "bit_stream.hpp"
 #include "DiskTable.h"
+#include "PlotWriter.h"
 
 #include <list>
 
@@ -97,7 +99,7 @@ void compute_stage1(int L_index, int num_threads,
 				cache->add(tmp);
 			}
 			R_num_write += input.size();
-		}, nullptr, std::max(num_threads / 2, 1), "phase3/add");
+		}, nullptr, std::max(num_threads / 2, 1), "phase3/add", false);
 	
 	ThreadPool<std::pair<std::vector<S>, size_t>, std::vector<entry_kpp>, merge_buffer_t> R_read(
 		[&mutex, &signal, &signal_1, &L_input, &L_is_end] (
@@ -163,7 +165,10 @@ void compute_stage1(int L_index, int num_threads,
 		}, &R_add_2, num_threads_merge, "phase3/merge");
 	
 	std::thread R_sort_read(
-		[&mutex, &signal_1, num_threads, L_table, R_sort, R_table, &R_read, &R_is_end]() {
+		[&mutex, &signal_1, num_threads, L_table, R_sort, R_table, &R_read, &R_is_end,
+		 affinity = affinity_t::get_thread(), share = CpuExecutor::get_thread()]() {
+			affinity_t::set_thread(affinity);
+			CpuExecutor::set_thread(share);
 			if(R_table) {
 				R_table->read(&R_read, std::max(num_threads / 4, 2));
 			} else {
@@ -291,14 +296,12 @@ void WritePark(
     IntTo16Bytes(index, first_line_point);
     index += CalculateLinePointSize(k);
 
-    // We use ParkBits instead of Bits since it allows storing more data
-    ParkBits park_stubs_bits;
+    const uint32_t stubs_size = CalculateStubsSize(k);
+    bit_writer park_stubs_bits(index, stubs_size);
     for (uint64_t stub : park_stubs) {
-        park_stubs_bits.AppendValue(stub, (k - kStubMinusBits));
+        park_stubs_bits.write(stub, k - kStubMinusBits);
     }
-    uint32_t stubs_size = CalculateStubsSize(k);
-    uint32_t stubs_valid_size = cdiv(park_stubs_bits.GetSize(), 8);
-    park_stubs_bits.ToBytes(index);
+    const size_t stubs_valid_size = park_stubs_bits.flush();
     memset(index + stubs_valid_size, 0, stubs_size - stubs_valid_size);
     index += stubs_size;
 
@@ -306,7 +309,8 @@ void WritePark(
     // be small, so we can compress them
     const double R = kRValues[table_index - 1];
     uint8_t* deltas_start = index + 2;
-    size_t deltas_size = Encoding::ANSEncodeDeltas(context.tmCache, park_deltas, R, deltas_start);
+    size_t deltas_size = Encoding::ANSEncodeDeltas(context.tmCache, park_deltas, R, deltas_start,
+                                                   park_buffer_size - (deltas_start - park_buffer));
 
     if (!deltas_size) {
         // Uncompressed
@@ -331,7 +335,7 @@ inline
 uint64_t compute_stage2(DiskPlotterContext& context,
 						int L_index, int num_threads,
 						DiskSortLP* R_sort, DiskSortNP* L_sort,
-						FILE* plot_file, uint64_t L_final_begin, uint64_t* R_final_begin)
+						PlotWriter* plot_writer, uint64_t L_final_begin, uint64_t* R_final_begin)
 {
 	const auto begin = get_wall_time_micros();
 	
@@ -351,6 +355,10 @@ uint64_t compute_stage2(DiskPlotterContext& context,
 	
 	const auto park_size_bytes = CalculateParkSize(32, L_index);
 	
+	// parks beyond 32-bit positions are skipped, see below
+	const uint64_t num_parks = cdiv(std::min(R_sort->get_num_entries(), uint64_t(1) << 32), int(kEntriesPerPark));
+	plot_writer->reserve(L_final_begin + num_parks * park_size_bytes);
+	
 	typedef DiskSortNP::WriteCache WriteCache;
 	
 	ThreadPool<std::pair<std::vector<entry_lp>, size_t>, size_t, std::shared_ptr<WriteCache>> L_add(
@@ -370,21 +378,23 @@ uint64_t compute_stage2(DiskPlotterContext& context,
 				cache->add(tmp);
 			}
 			L_num_write += index - input.second;
-		}, nullptr, std::max(num_threads / 2, 1), "phase3/add");
+		}, nullptr, std::max(num_threads / 2, 1), "phase3/add", false);
 	
 	Thread<std::vector<park_out_t>> park_write(
-		[plot_file,&context](std::vector<park_out_t>& input) {
-			context.getCurrentTask()->totalWorkItem += input.size();
-			for(const auto& park : input) {
-				fwrite_at(plot_file, park.offset, park.buffer.data(), park.buffer.size());
-				context.getCurrentTask()->completedWorkItem++;
+		[plot_writer,&context](std::vector<park_out_t>& input) {
+			const auto task = context.getCurrentTask();
+			task->totalWorkItem.add(input.size());
+			for(auto& park : input) {
+				plot_writer->write(park.offset, std::move(park.buffer));
 			}
+			task->completedWorkItem.add(input.size());
 		}, "phase3/write");
 	
 	ThreadPool<std::vector<park_data_t>, std::vector<park_out_t>> park_threads(
 		[L_index, L_final_begin, park_size_bytes, &num_written_final, &context]
 		 (std::vector<park_data_t>& input, std::vector<park_out_t>& out, size_t&) {
-			context.getCurrentTask()->totalWorkItem += input.size();
+			const auto task = context.getCurrentTask();
+			task->totalWorkItem.add(input.size());
 			for(const auto& park : input) {
 				const auto& points = park.points;
 				if(points.empty()) {
@@ -415,9 +425,9 @@ uint64_t compute_stage2(DiskPlotterContext& context,
 					tmp.buffer.size());
 				out.emplace_back(std::move(tmp));
 				num_written_final += points.size();
-				context.getCurrentTask()->completedWorkItem++;
 			}
-		}, &park_write, std::max(num_threads / 2, 1), "phase3/park");
+			task->completedWorkItem.add(input.size());
+		}, &park_write, std::max(num_threads / 2, 1), "phase3/park", false, true);
 	
 	Thread<std::pair<std::vector<entry_lp>, size_t>> R_read(
 		[&R_num_read, &L_add, &park, &park_threads](std::pair<std::vector<entry_lp>, size_t>& input) {
@@ -486,13 +496,25 @@ void compute(	DiskPlotterContext& context,
 	out.params = input.params;
 	out.plot_file_name = input.tempDir + input.plot_name + L".plot.tmp";
 	
-	FILE* plot_file = FOPEN(out.plot_file_name.c_str(), L"wb");
-	if(!plot_file) {
+	if(input.params.checkpoint) {
+		// phase 2 output stays valid until the next checkpoint
+		for(const auto& sort : input.sort) {
+			if(sort) {
+				sort->set_keep_files(true);
+			}
+		}
+	}
+	
+	FILE* header_file = FOPEN(out.plot_file_name.c_str(), L"wb");
+	if(!header_file) {
 		throw std::runtime_error("fopen() failed");
 	}
-	out.header_size = WriteHeader(	plot_file, 32, input.params.id.data(),
+	out.header_size = WriteHeader(	header_file, 32, input.params.id.data(),
 									input.params.memo.data(), input.params.memo.size());
+	fclose(header_file);
 	context.log("Wrote plot header with " + std::to_string(out.header_size) + " bytes");
+	
+	PlotWriter plot_writer(out.plot_file_name);
 
 	std::vector<uint64_t> final_pointers(8, 0);
 	final_pointers[1] = out.header_size;
@@ -502,7 +524,8 @@ void compute(	DiskPlotterContext& context,
 	DiskTable<phase2::entry_1> L_table_1(input.table_1);
 	
 	auto R_sort_lp = std::make_shared<DiskSortLP>(
-			63, input.log_num_buckets, prefix_2 + L"p3s1.t2");
+			63, input.log_num_buckets, prefix_2 + L"p3s1.t2",
+			false, nullptr, input.params.direct_io_2, input.params.ram_budget);
 
 	std::shared_ptr<JobTaskItem> currentTask = context.getCurrentTask();
 	context.pushTask("Phase3-Table7-Stage2", currentTask);
@@ -523,16 +546,19 @@ void compute(	DiskPlotterContext& context,
 			1, input.num_threads, nullptr, input.sort[1].get(), R_sort_lp.get(), &L_table_1, input.bitfield_1.get());
 	
 	input.bitfield_1 = nullptr;
-	_wremove(input.table_1.file_name.c_str());
+	if(!input.params.checkpoint) {
+		_wremove(input.table_1.file_name.c_str());
+	}
 	context.popTask();
 	
 	context.getCurrentTask()->start();
 	auto L_sort_np = std::make_shared<DiskSortNP>(
-			32, input.log_num_buckets, prefix_2 + L"p3s2.t2");
+			32, input.log_num_buckets, prefix_2 + L"p3s2.t2",
+			false, nullptr, input.params.direct_io_2, input.params.ram_budget);
 	
 	num_written_final += compute_stage2(context,
 			1, input.num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[1], &final_pointers[2]);
+			&plot_writer, final_pointers[1], &final_pointers[2]);
 	context.popTask();
 	
 	for(int L_index = 2; L_index < 6; ++L_index)
@@ -541,25 +567,28 @@ void compute(	DiskPlotterContext& context,
 		
 		context.getCurrentTask()->start();
 		R_sort_lp = std::make_shared<DiskSortLP>(
-				63, input.log_num_buckets, prefix_2 + L"p3s1." + R_t);
+				63, input.log_num_buckets, prefix_2 + L"p3s1." + R_t,
+				false, nullptr, input.params.direct_io_2, input.params.ram_budget);
 		
 		compute_stage1<entry_np, phase2::entry_x, DiskSortNP, phase2::DiskSortT>(
 				L_index, input.num_threads, L_sort_np.get(), input.sort[L_index].get(), R_sort_lp.get());
 		context.popTask();
 		
 		L_sort_np = std::make_shared<DiskSortNP>(
-				32, input.log_num_buckets, prefix_2 + L"p3s2." + R_t);
+				32, input.log_num_buckets, prefix_2 + L"p3s2." + R_t,
+				false, nullptr, input.params.direct_io_2, input.params.ram_budget);
 		
 		context.getCurrentTask()->start();
 		num_written_final += compute_stage2(context,
 				L_index, input.num_threads, R_sort_lp.get(), L_sort_np.get(),
-				plot_file, final_pointers[L_index], &final_pointers[(size_t)L_index + 1]);
+				&plot_writer, final_pointers[L_index], &final_pointers[(size_t)L_index + 1]);
 		context.popTask();
 	}
 	
 	DiskTable<phase2::entry_7> R_table_7(input.table_7);
 	
-	R_sort_lp = std::make_shared<DiskSortLP>(63, input.log_num_buckets, prefix_2 + L"p3s1.t7");
+	R_sort_lp = std::make_shared<DiskSortLP>(63, input.log_num_buckets, prefix_2 + L"p3s1.t7",
+			false, nullptr, input.params.direct_io_2, input.params.ram_budget);
 	
 	context.getCurrentTask()->start();
 	compute_stage1<entry_np, phase2::entry_7, DiskSortNP, phase2::DiskSort7>(
@@ -567,23 +596,26 @@ void compute(	DiskPlotterContext& context,
 	context.popTask();
 	
 	context.getCurrentTask()->start();
-	_wremove(input.table_7.file_name.c_str());
+	if(!input.params.checkpoint) {
+		_wremove(input.table_7.file_name.c_str());
+	}
 	
-	L_sort_np = std::make_shared<DiskSortNP>(32, input.log_num_buckets, prefix_2 + L"p3s2.t7");
+	// with checkpoints the output has to be on disk entirely
+	L_sort_np = std::make_shared<DiskSortNP>(32, input.log_num_buckets, prefix_2 + L"p3s2.t7",
+			false, nullptr, input.params.direct_io_2,
+			input.params.checkpoint ? nullptr : input.params.ram_budget);
 	
 	const auto num_written_final_7 = compute_stage2(context,
 			6, input.num_threads, R_sort_lp.get(), L_sort_np.get(),
-			plot_file, final_pointers[6], &final_pointers[7]);
+			&plot_writer, final_pointers[6], &final_pointers[7]);
 	num_written_final += num_written_final_7;
 	
-	fseek_set(plot_file, (size_t)out.header_size - 10 * 8);
+	std::vector<uint8_t> pointers((final_pointers.size() - 1) * 8);
 	for(size_t i = 1; i < final_pointers.size(); ++i) {
-		uint8_t tmp[8] = {};
-		IntToEightBytes(tmp, final_pointers[i]);
-		fwrite_ex(plot_file, tmp, sizeof(tmp));
+		IntToEightBytes(pointers.data() + (i - 1) * 8, final_pointers[i]);
 	}
-	fflush(plot_file);
-	fclose(plot_file);
+	plot_writer.write((size_t)out.header_size - 10 * 8, std::move(pointers));
+	plot_writer.close();
 	
 	out.sort_7 = L_sort_np;
 	out.num_written_7 = num_written_final_7;
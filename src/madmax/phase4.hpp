@@ -8,6 +8,8 @@
 #include "phase4.h"
 #include "DiskSort.hpp"
 #include "encoding.hpp"
+#include "bit_stream.hpp"
+#include "PlotWriter.h"
 #include "util.hpp"
 
 
@@ -25,6 +27,15 @@ static uint32_t CalculateC3Size(uint8_t k)
 	}
 }
 
+// Writes one k bit C1 / C2 entry (ByteAlign(k) / 8 bytes)
+static void write_checkpoint(uint8_t* buf, const uint64_t value)
+{
+	static constexpr uint8_t k = 32;
+	bit_writer out(buf, ByteAlign(k) / 8);
+	out.write(value, k);
+	out.flush();
+}
+
 // Writes the checkpoint tables. The purpose of these tables, is to store a list of ~2^k values
 // of size k (the proof of space outputs from table 7), in a way where they can be looked up for
 // proofs, but also efficiently. To do this, we assume table 7 is sorted by f7, and we write the
@@ -42,7 +53,7 @@ static uint32_t CalculateC3Size(uint8_t k)
 // C2 (checkpoint values into)
 // C3 (deltas of f7s between C1 checkpoints)
 inline uint64_t compute(	DiskPlotterContext* context,
-					FILE* plot_file, const int header_size,
+					PlotWriter* plot_writer, const int header_size,
 					phase3::DiskSortNP* L_sort_7, int num_threads,
 					const uint64_t final_pointer_7,
 					const uint64_t final_entries_written)
@@ -70,6 +81,8 @@ inline uint64_t compute(	DiskPlotterContext* context,
     final_table_begin_pointers[9] = begin_byte_C2;
     final_table_begin_pointers[10] = begin_byte_C3;
     final_table_begin_pointers[11] = end_byte;
+    
+    plot_writer->reserve(end_byte);
 
     uint64_t final_file_writer_1 = begin_byte_C1;
     uint64_t final_file_writer_3 = final_table_begin_pointers[7];
@@ -102,12 +115,13 @@ inline uint64_t compute(	DiskPlotterContext* context,
 	};
     
     Thread<std::vector<write_data_t>> plot_write(
-		[plot_file, context](std::vector<write_data_t>& input) {
-			context->getCurrentTask()->totalWorkItem += input.size();
-			for(const auto& write : input) {
-				fwrite_at(plot_file, write.offset, write.buffer.data(), write.buffer.size());
-				context->getCurrentTask()->completedWorkItem++;
+		[plot_writer, context](std::vector<write_data_t>& input) {
+			const auto task = context->getCurrentTask();
+			task->totalWorkItem.add(input.size());
+			for(auto& write : input) {
+				plot_writer->write(write.offset, std::move(write.buffer));
 			}
+			task->completedWorkItem.add(input.size());
 		}, "phase4/write");
     
     ThreadPool<std::vector<park_data_t>, std::vector<write_data_t>> p7_threads(
@@ -116,29 +130,30 @@ inline uint64_t compute(	DiskPlotterContext* context,
 				write_data_t tmp;
 				tmp.offset = park.offset;
 				tmp.buffer.resize(P7_park_size);
-				ParkBits bits;
+				bit_writer bits(tmp.buffer.data(), tmp.buffer.size());
 				for(uint64_t new_pos : park.array) {
-					bits += ParkBits(new_pos, k + 1);
+					bits.write(new_pos, k + 1);
 				}
-				bits.ToBytes(tmp.buffer.data());
+				bits.flush();
 				out.emplace_back(std::move(tmp));
     		}
-		}, &plot_write, std::max(num_threads / 2, 1), "phase4/P7");
+		}, &plot_write, std::max(num_threads / 2, 1), "phase4/P7", false, true);
     
 	ThreadPool<park_deltas_t, std::vector<write_data_t>> park_threads(
 		[C3_size,context](park_deltas_t& park, std::vector<write_data_t>& out, size_t&) {
 			write_data_t tmp;
 			tmp.offset = park.offset;
 			tmp.buffer.resize(C3_size);
-			const size_t num_bytes =
-					Encoding::ANSEncodeDeltas(context->tmCache,park.deltas, kC3R, tmp.buffer.data() + 2);
+			const size_t num_bytes = Encoding::ANSEncodeDeltas(
+					context->tmCache, park.deltas, kC3R, tmp.buffer.data() + 2, C3_size - 2);
 			
-			if(num_bytes + 2 > C3_size) {
+			// FSE returns 0 if the output didn't fit (and for less than 3 deltas)
+			if(!num_bytes && park.deltas.size() > 2) {
 				throw std::logic_error("C3 overflow");
 			}
 			IntToTwoBytes(tmp.buffer.data(), num_bytes);	// Write the size
 			out.emplace_back(std::move(tmp));
-		}, &plot_write, std::max(num_threads / 2, 1), "phase4/C3");
+		}, &plot_write, std::max(num_threads / 2, 1), "phase4/C3", false, true);
 
     // We read each table7 entry, which is sorted by f7, but we don't need f7 anymore. Instead,
 	// we will just store pos6, and the deltas in table C3, and checkpoints in tables C1 and C2.
@@ -150,7 +165,8 @@ inline uint64_t compute(	DiskPlotterContext* context,
 		std::vector<park_data_t> parks;
 		parks.reserve(input.first.size() / kEntriesPerPark + 2);
 		uint64_t index = input.second;
-		context->getCurrentTask()->totalWorkItem += input.first.size();
+		const auto task = context->getCurrentTask();
+		task->totalWorkItem.add(input.first.size());
 		for(const auto& entry : input.first) {
 			const uint64_t entry_y = entry.key;
 	
@@ -171,7 +187,7 @@ inline uint64_t compute(	DiskPlotterContext* context,
 				write_data_t out;
 				out.offset = final_file_writer_1;
 				out.buffer.resize(4);
-				Bits(entry_y, k).ToBytes(out.buffer.data());
+				write_checkpoint(out.buffer.data(), entry_y);
 				final_file_writer_1 += out.buffer.size();
 				{
 					std::vector<write_data_t> out_;
@@ -194,8 +210,8 @@ inline uint64_t compute(	DiskPlotterContext* context,
 			}
 			prev_y = entry_y;
 			index++;
-			context->getCurrentTask()->completedWorkItem++;
 		}
+		task->completedWorkItem.add(input.first.size());
 		p7_threads.take(parks);
 	}, "phase4/read");
     
@@ -220,9 +236,9 @@ inline uint64_t compute(	DiskPlotterContext* context,
     plot_write.close();
 
     uint8_t C1_entry_buf[4] = {};
-    Bits(0, ByteAlign(k)).ToBytes(C1_entry_buf);
-    final_file_writer_1 +=
-    		fwrite_at(plot_file, final_file_writer_1, C1_entry_buf, sizeof(C1_entry_buf));
+    write_checkpoint(C1_entry_buf, 0);
+    plot_writer->write(final_file_writer_1, C1_entry_buf, sizeof(C1_entry_buf));
+    final_file_writer_1 += sizeof(C1_entry_buf);
     
     context->log("[P4] Finished writing C1 and C3 tables");
     context->log("[P4] Writing C2 table");
@@ -230,13 +246,13 @@ inline uint64_t compute(	DiskPlotterContext* context,
 
 	context->getCurrentTask()->start();
     for(const uint64_t C2_entry : C2) {
-        Bits(C2_entry, k).ToBytes(C1_entry_buf);
-        final_file_writer_1 +=
-        		fwrite_at(plot_file, final_file_writer_1, C1_entry_buf, sizeof(C1_entry_buf));
+        write_checkpoint(C1_entry_buf, C2_entry);
+        plot_writer->write(final_file_writer_1, C1_entry_buf, sizeof(C1_entry_buf));
+        final_file_writer_1 += sizeof(C1_entry_buf);
     }
-    Bits(0, ByteAlign(k)).ToBytes(C1_entry_buf);
-    final_file_writer_1 +=
-    		fwrite_at(plot_file, final_file_writer_1, C1_entry_buf, sizeof(C1_entry_buf));
+    write_checkpoint(C1_entry_buf, 0);
+    plot_writer->write(final_file_writer_1, C1_entry_buf, sizeof(C1_entry_buf));
+    final_file_writer_1 += sizeof(C1_entry_buf);
     
     context->log("[P4] Finished writing C2 table");
 	context->popTask();
@@ -247,8 +263,8 @@ inline uint64_t compute(	DiskPlotterContext* context,
     // Writes the pointers to the start of the tables, for proving
     for (int i = 8; i <= 10; i++) {
         IntToEightBytes(table_pointer_bytes, final_table_begin_pointers[i]);
-        final_file_writer_1 +=
-        		fwrite_at(plot_file, final_file_writer_1, table_pointer_bytes, 8);
+        plot_writer->write(final_file_writer_1, table_pointer_bytes, 8);
+        final_file_writer_1 += 8;
     }
     return end_byte;
 }
@@ -259,16 +275,15 @@ void compute(	DiskPlotterContext& context,
 {
 	const auto total_begin = get_wall_time_micros();
 	
-	FILE* plot_file = FOPEN(input.plot_file_name.c_str(), L"rb+");
-	if(!plot_file) {
-		throw std::runtime_error("fopen() failed");
+	if(input.params.checkpoint) {
+		input.sort_7->set_keep_files(true);		// phase 3 output stays valid until the next checkpoint
+	}
+	{
+		PlotWriter plot_writer(input.plot_file_name);
+		out.plot_size = compute(&context, &plot_writer, input.header_size, input.sort_7.get(),
+								input.num_threads, input.final_pointer_7, input.num_written_7);
+		plot_writer.close();
 	}
-	
-	out.plot_size = compute(&context, plot_file, input.header_size, input.sort_7.get(),
-							input.num_threads, input.final_pointer_7, input.num_written_7);
-	
-	fflush(plot_file);
-	fclose(plot_file);
 	
 	out.params = input.params;
 	out.plot_file_name = input.tempDir + input.plot_name + L".plot";
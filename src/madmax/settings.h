@@ -23,6 +23,67 @@ const size_t g_read_chunk_size = 65536;
  * default = 4096
  */
 const size_t g_write_chunk_size = 4096;
+
+/*
+ * Number of I/O threads writing temporary files.
+ * default = 4
+ */
+const int g_write_threads = 4;
+
+/*
+ * Size of each asynchronous write in bytes, must be a multiple of g_write_alignment.
+ * default = 262144
+ */
+const size_t g_write_buffer_size = 262144;
+
+/*
+ * Total size of the write staging buffers of one DiskSort in bytes (one per bucket file).
+ * Each bucket gets an equal share, a multiple of g_write_alignment up to g_write_buffer_size.
+ * default = 8388608
+ */
+const size_t g_write_staging_size = 8388608;
+
+/*
+ * Maximum number of write buffers in flight before writers block.
+ * default = 64
+ */
+const size_t g_write_queue_depth = 64;
+
+/*
+ * Buffer and offset alignment in bytes required for unbuffered (direct) I/O.
+ * default = 4096
+ */
+const size_t g_write_alignment = 4096;
+
+/*
+ * Number of inputs each pipeline Thread can queue before producers block.
+ * default = 4
+ */
+const size_t g_thread_queue_depth = 4;
+
+/*
+ * Number of times a pipeline Thread polls (yielding) before it sleeps.
+ * default = 256
+ */
+const int g_thread_spin_count = 256;
+
+/*
+ * Size of the contiguous runs written to the final plot file in bytes.
+ * default = 8388608
+ */
+const uint64_t g_plot_write_size = 8388608;
+
+/*
+ * Maximum number of bytes buffered for the final plot file before runs are written early.
+ * default = 134217728
+ */
+const uint64_t g_plot_write_window = 134217728;
+
+/*
+ * Size of each chunk when copying the final plot, must be a multiple of g_write_alignment.
+ * default = 16777216
+ */
+const size_t g_copy_chunk_size = 16777216;
 }
 
 #endif /* INCLUDE_CHIA_SETTINGS_H_ */
@@ -25,6 +25,7 @@
 #include "chiapos/entry_sizes.hpp"
 
 #include "JobCreatePlot.h"
+#include "CopyQueue.h"
 
 
 extern "C" {
@@ -164,6 +165,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 		}
 		catch(...){}
 	}
+	JobManager::getInstance().setCpuThreads(MainApp::settings.cpuThreads);
 	if (nArgs < 2) {
 		ImFrame::Run("uraymeiviar", "Chia Plotter", [] (const auto & params) { 
 			return std::make_unique<MainApp>(params); 
@@ -216,7 +218,13 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 						std::cout << "  -m  --mem         : max memory buffer in MB (default 4608 )" << std::endl;
 						std::cout << "  -s  --stripes     : stripes count           (default 65536)" << std::endl;
 						std::cout << "  -n  --no-bitfield : use bitfield            (default set  )" << std::endl;
-						std::cout << "  -w  --plotter     : madmax | chiapos        (default madmax)" << std::endl << std::endl;
+						std::cout << "  -w  --plotter     : madmax | chiapos        (default madmax)" << std::endl;
+						std::cout << "  -u  --unbuffered  : none | temp | temp2 | both (default none)" << std::endl;
+						std::cout << "                      bypass OS file cache for madmax temporary writes" << std::endl;
+						std::cout << "  -a  --ram-budget  : MB of madmax temp2 / phase 2 data kept in RAM (default 0)" << std::endl;
+						std::cout << "  -x  --checkpoint  : save a madmax checkpoint after each phase (default off)" << std::endl;
+						std::cout << "                      needs more temp space, see the resume command" << std::endl;
+						std::cout << "  -g  --affinity    : madmax cpus: auto | auto:N | node:N | cpu list like 0-7,16-23 (default any)" << std::endl << std::endl;
 						std::cout << " common usage example :" << std::endl;
 						std::cout << exePath.filename().string() << " create -f b6cce9c6ff637f1dc9726f5db64776096fdb4101d673afc4e27ec71f0f9a859b2f1d661c92f3b8e6932a3f7634bc4c12 -p 86e2a9cf0b409c8ca7258f03ef7698565658a17f6f7dd9e9b0ac9be6ca3891ac09fa8468951f24879c00870e88fa66bb -d D:\\chia-plots -t C:\\chia-temp" << std::endl << std::endl;
 						std::cout << "this command will create default 100GB k-32 plot to D:\\chia-plots\\ and use C:\\chia-plots as temporary directory, plot id, memo, and filename will be generated from farm and plot public key, its recommend to use buckets, k-size and stripes to default value" << std::endl;
@@ -239,6 +247,11 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 						int stripes = 65556;
 						bool useMadMax = true;
 						bool bitfield = true;
+						bool tempDirectIO = false;
+						bool temp2DirectIO = false;
+						int ramBudget = 0;
+						bool checkpoint = false;
+						std::string affinity;
 
 						std::string lastArg = "";
 						for (int i = 2; i < nArgs; i++) {
@@ -247,6 +260,10 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 								if (lastArg == "-n" || lastArg == "--no-bitfield") {
 									bitfield = false;
 								}
+								else if (lastArg == "-x" || lastArg == "--checkpoint") {
+									checkpoint = true;
+									lastArg = "";
+								}
 							}
 							else {
 								if (lastArg == "-f" || lastArg == "--farmkey") {
@@ -360,6 +377,30 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 										useMadMax = false;
 									}
 								}
+								else if (lastArg == "-u" || lastArg == "--unbuffered") {
+									std::wstring valStr = lowercase(std::wstring(args[i]));
+									tempDirectIO = (valStr == L"temp" || valStr == L"both");
+									temp2DirectIO = (valStr == L"temp2" || valStr == L"both");
+									lastArg = "";
+								}
+								else if (lastArg == "-a" || lastArg == "--ram-budget") {
+									std::wstring valStr = std::wstring(args[i]);
+									try {
+										ramBudget = std::stoi(valStr);
+										if (ramBudget < 0) {
+											ramBudget = 0;
+										}
+									}
+									catch (...) {
+										std::cout << "parsing error on ram budget argument, revert back to default 0" << std::endl;
+										ramBudget = 0;
+									}
+									lastArg = "";
+								}
+								else if (lastArg == "-g" || lastArg == "--affinity") {
+									affinity = lowercase(ws2s(std::wstring(args[i])));
+									lastArg = "";
+								}
 								else {
 									std::wcout << L"ignored unknown argument " << args[i] << std::endl;
 									lastArg = "";
@@ -422,10 +463,22 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 						std::cout << "buckets count = " << std::to_string(buckets) << std::endl;
 						std::cout << "max memsize   = " << std::to_string(mem) << " MB" << std::endl;
 						std::cout << "stripes count = " << std::to_string(stripes) << std::endl;
+						if (tempDirectIO || temp2DirectIO) {
+							std::cout << "unbuffered io = " << (tempDirectIO ? "temp " : "") << (temp2DirectIO ? "temp2" : "") << std::endl;
+						}
+						if (ramBudget > 0) {
+							std::cout << "ram budget    = " << std::to_string(ramBudget) << " MB" << std::endl;
+						}
+						if (checkpoint) {
+							std::cout << "checkpoints   = enabled" << std::endl;
+						}
+						if (!affinity.empty()) {
+							std::cout << "cpu affinity  = " << affinity << std::endl;
+						}
 
 						try {
 							if (useMadMax) {
-								cli_create_mad(farmkey,poolkey,puzzleHash,poolContract, dest,temp,temp2,buckets,nthreads);
+								cli_create_mad(farmkey,poolkey,puzzleHash,poolContract, dest,temp,temp2,buckets,nthreads,tempDirectIO,temp2DirectIO,ramBudget,checkpoint,affinity);
 							}
 							else {
 								cli_create(farmkey,poolkey,dest,temp,temp2,filename,memo,id,ksize,buckets,stripes,nthreads,mem,!bitfield);
@@ -436,6 +489,36 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 						}
 					}
 				}
+				else if (lowercase(command) == L"resume") {
+					if (nArgs < 3) {
+						std::cout << "Usage "<< exePath.filename().string() <<" resume <checkpoint> [ram budget] [affinity]" << std::endl;
+						std::cout << "   checkpoint : <temp>/<plot name>.checkpoint of a madmax plot created with --checkpoint" << std::endl;
+						std::cout << "   ram budget : MB of temp2 / phase 2 data kept in RAM (default 0)" << std::endl;
+						std::cout << "   affinity   : cpus to run on, auto | auto:N | node:N | cpu list like 0-7,16-23 (default any)" << std::endl;
+					}
+					else {
+						std::filesystem::path targetPath(args[2]);
+						if (std::filesystem::exists(targetPath) && std::filesystem::is_regular_file(targetPath)) {
+							uint32_t ramBudget = 0;
+							if (nArgs >= 4) {
+								try {
+									ramBudget = std::max(std::stoi(std::wstring(args[3])), 0);
+								}
+								catch (...) {
+									ramBudget = 0;
+								}
+							}
+							std::string affinity;
+							if (nArgs >= 5) {
+								affinity = lowercase(ws2s(std::wstring(args[4])));
+							}
+							cli_resume_mad(targetPath, ramBudget, affinity);
+						}
+						else {
+							std::cerr << "file not exist" << std::endl;
+						}
+					}
+				}
 				else if (lowercase(command) == L"proof") {
 					if (nArgs < 4) {
 						std::cout << "Usage "<< exePath.filename().string() <<" proof <filepath> <challenge>" << std::endl;
@@ -469,9 +552,11 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 				}
 				else if (lowercase(command) == L"check") {
 					if (nArgs < 3) {
-						std::cout << "Usage "<< exePath.filename().string() <<" check <filepath> [iteration]" << std::endl;
+						std::cout << "Usage "<< exePath.filename().string() <<" check <filepath> [iteration] [mmap] [parks]" << std::endl;
 						std::cout << "   filepath  : path to file to check" << std::endl;
 						std::cout << "   iteration : number of iteration to perform (default:100)" << std::endl;
+						std::cout << "   mmap      : read the plot through a memory mapping (local SSDs only)" << std::endl;
+						std::cout << "   parks     : number of decoded parks to cache, 32 KiB each (default:0)" << std::endl;
 					}
 					else {
 						uint32_t iteration = 100;
@@ -486,7 +571,22 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 									iteration = 100;
 								}
 							}
-							cli_check(iteration,targetPath.wstring());
+							bool useMmap = false;
+							uint32_t parkCacheSize = 0;
+							for (int i = 4; i < nArgs; i++) {
+								if (lowercase(std::wstring(args[i])) == L"mmap") {
+									useMmap = true;
+								}
+								else {
+									try {
+										parkCacheSize = std::max(std::stoi(std::wstring(args[i])), 0);
+									}
+									catch (...) {
+										parkCacheSize = 0;
+									}
+								}
+							}
+							cli_check(iteration,targetPath.wstring(),useMmap,parkCacheSize);
 						}
 						else {
 							std::cerr << "file not exist" << std::endl;
@@ -501,6 +601,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 				std::cout << "Usage "<< exePath.filename().string() <<" <command> <args>" << std::endl;
 				std::cout << "command options:" << std::endl;
 				std::cout << "    create " << std::endl;
+				std::cout << "    resume " << std::endl;
 				std::cout << "    proof " << std::endl;
 				std::cout << "    verify " << std::endl;
 				std::cout << "    check " << std::endl;
@@ -515,6 +616,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLin
 			FreeConsole();
 		}
 	}
+	CopyQueue::getInstance().stop();
 	JobManager::getInstance().stop();
 	return 1;
 }
@@ -1009,6 +1111,58 @@ void MainApp::settingsPage()
 				changed |= ImGui::Checkbox("##settings-bitfeld", &MainApp::settings.bitfield);
 				ImGui::PopItemWidth();
 
+				ImGui::Text("CPU threads");
+				ImGui::SameLine(120.0f);
+				ImGui::PushItemWidth(fieldWidth-130.0f);
+				static int cpuThreadsInput = (int)MainApp::settings.cpuThreads;
+				if (ImGui::InputInt("##settings-cputhreads", &cpuThreadsInput, 1, 2)) {
+					if (cpuThreadsInput < 0) {
+						cpuThreadsInput = 0;
+					}
+					MainApp::settings.cpuThreads = cpuThreadsInput;
+					JobManager::getInstance().setCpuThreads(MainApp::settings.cpuThreads);
+					changed |= true;
+				}
+				if (ImGui::IsItemHovered()) {
+					ImGui::BeginTooltip();
+					ImGui::Text("threads shared by the CPU-bound work of all running plot jobs, 0 = one per core");
+					ImGui::EndTooltip();
+				}
+				ImGui::PopItemWidth();
+
+				ImGui::Text("Copy threads");
+				ImGui::SameLine(120.0f);
+				ImGui::PushItemWidth(fieldWidth-130.0f);
+				static int copyThreadsInput = (int)MainApp::settings.copyThreads;
+				if (ImGui::InputInt("##settings-copythreads", &copyThreadsInput, 1, 2)) {
+					MainApp::settings.copyThreads = copyThreadsInput;
+					if (copyThreadsInput < 1) {
+						MainApp::settings.copyThreads = 1;
+						copyThreadsInput = 1;
+					}
+					changed |= true;
+				}
+				ImGui::PopItemWidth();
+
+				ImGui::Text("Copy MB/s");
+				ImGui::SameLine(120.0f);
+				ImGui::PushItemWidth(fieldWidth-130.0f);
+				static int copyBandwidthInput = (int)MainApp::settings.copyBandwidth;
+				if (ImGui::InputInt("##settings-copybandwidth", &copyBandwidthInput, 10, 100)) {
+					MainApp::settings.copyBandwidth = copyBandwidthInput;
+					if (copyBandwidthInput < 0) {
+						MainApp::settings.copyBandwidth = 0;
+						copyBandwidthInput = 0;
+					}
+					changed |= true;
+				}
+				if (ImGui::IsItemHovered()) {
+					ImGui::BeginTooltip();
+					ImGui::Text("limit per destination directory, 0 = unlimited");
+					ImGui::EndTooltip();
+				}
+				ImGui::PopItemWidth();
+
 				if (changed) {
 					MainApp::settings.save(std::filesystem::current_path() / "settings.json");
 				}
@@ -1167,6 +1321,30 @@ void AppSettings::load(std::filesystem::path f)
 						}
 					}
 
+					if (settings.HasMember("cputhreads")) {
+						json::Value& cputhreads = settings["cputhreads"];
+						if (cputhreads.IsInt()) {
+							this->cpuThreads = std::max(cputhreads.GetInt(), 0);
+						}
+					}
+
+					if (settings.HasMember("copythreads")) {
+						json::Value& copythreads = settings["copythreads"];
+						if (copythreads.IsInt()) {
+							this->copyThreads = copythreads.GetInt();
+						}
+						if (this->copyThreads < 1) {
+							this->copyThreads = 1;
+						}
+					}
+
+					if (settings.HasMember("copybandwidth")) {
+						json::Value& copybandwidth = settings["copybandwidth"];
+						if (copybandwidth.IsInt()) {
+							this->copyBandwidth = copybandwidth.GetInt();
+						}
+					}
+
 					if (settings.HasMember("bitfield")) {
 						json::Value& bitfield = settings["bitfield"];
 						if (bitfield.IsInt()) {
@@ -1214,6 +1392,9 @@ void AppSettings::save(std::filesystem::path f)
 	settings.AddMember("threads" ,this->threads, doc.GetAllocator());
 	settings.AddMember("buffer"  ,this->buffer, doc.GetAllocator());
 	settings.AddMember("bitfield",this->bitfield, doc.GetAllocator());
+	settings.AddMember("cputhreads",this->cpuThreads, doc.GetAllocator());
+	settings.AddMember("copythreads",this->copyThreads, doc.GetAllocator());
+	settings.AddMember("copybandwidth",this->copyBandwidth, doc.GetAllocator());
 	
 	doc.AddMember("settings",settings, doc.GetAllocator());	
 	std::ofstream ofs( f.string());
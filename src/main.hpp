@@ -23,6 +23,9 @@ public:
 	uint8_t threads {2};
 	uint32_t buffer {4096};
 	bool bitfield {true};
+	uint32_t copyThreads {1};
+	uint32_t copyBandwidth {0};
+	uint32_t cpuThreads {0};
 
 	static uint8_t defaultKSize;
 	static uint32_t defaultBuckets;